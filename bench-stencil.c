@@ -0,0 +1,386 @@
+/**
+ * @file bench-stencil.c
+ * @author Leslie Horace
+ * @brief Main program for benchmarking the stencil kernels in-process against the stream bandwidth (roofline)
+ * @version 1.0
+ *
+ */
+#include "kernel_utils.h"
+
+#define BENCH_STREAM 0                  // what each benchmark thread sweeps
+#define BENCH_2D 1
+#define BENCH_3D 2
+
+#define BENCH_POINTS 20000000L          // points swept per repetition when --iterations is not given
+#define STREAM_MIN_COUNT 8388608L       // min elements of each stream array (64 MB of doubles)
+#define MAX_LIST 64                     // max entries of each list option
+#define TRIAD_SCALAR 0.5
+
+/**
+ *  @struct _benchShared
+ *  @typedef BenchShared (shared)
+ *  @brief struct for all shared variables needed by each benchmark thread
+ */
+typedef struct _benchShared{
+    int mode;               // BENCH_STREAM | BENCH_2D | BENCH_3D
+    elem_t * A;             // matrices or volumes (A, B), or stream arrays (A = B + s*C)
+    elem_t * B;
+    elem_t * C;
+    long count;             // # elements of each stream array
+    int planes;             // 3D only
+    int rows;
+    int cols;
+    int num_threads;
+    int iterations;         // # sweeps per repetition
+    int warmup;             // # untimed repetitions
+    int reps;               // # timed repetitions
+    double * times;         // time of each timed repetition (rank 0)
+    pthread_barrier_t barrier;
+}BenchShared;
+
+/**
+ *  @struct _benchPrivate
+ *  @typedef BenchPrivate (private)
+ *  @brief thread struct holding the shared struct pointer and private variables
+ */
+typedef struct _benchPrivate{
+    BenchShared * bs;
+    int rank;
+    RowSums * rs;           // row sums for the separable kernel (NULL = box kernel)
+}BenchPrivate;
+
+/**
+ *  @brief Fills rows lo..hi with values in [1, 2), every average of them stays in [1, 2) so no iteration
+ *         slows down on denormals
+ *  @param X (elem_t*) matrix (or volume as planes*rows rows) to fill
+ *  @param lo (long) first row
+ *  @param hi (long) last row
+ *  @param n (int) # columns
+ */
+void fillBench(elem_t * X, long lo, long hi, int n){
+    for(long i = lo; i <= hi; i++){
+        for(long j = 0; j < n; j++) X[IDX(i,j,(long)n)] = 1.0 + ((i*31+j*17) % 64)/64.0;
+    }
+}
+
+void * benchLoop(void * bp_ptr){
+    BenchPrivate * bp = bp_ptr;
+    BenchShared * bs = bp->bs;
+    elem_t * X = bs->A, * Y = bs->B, * tmp = NULL;
+    double start = 0.0, end = 0.0;
+    int r = (bs->mode == BENCH_2D) ? stencilRadius2D() : 1, ret = 0;
+    long lo = 0, hi = 0, first = 0, last = 0, span = 0;
+
+    // each thread sweeps a share of the stream elements, the interior rows, or the interior planes
+    if(bs->mode == BENCH_STREAM) r = 0;
+    span = (bs->mode == BENCH_STREAM) ? bs->count : (bs->mode == BENCH_2D) ? bs->rows-2*r : bs->planes-2;
+    lo = BLOCK_LOW(bp->rank, bs->num_threads, span)+r;
+    hi = lo+BLOCK_SIZE(bp->rank, bs->num_threads, span)-1;
+    // first touch this thread's share (+ the boundary) so its pages are on this thread's NUMA node
+    first = (bp->rank == 0) ? 0 : lo;
+    last = (bp->rank == bs->num_threads-1) ? span+2*r-1 : hi;
+    if(bs->mode == BENCH_STREAM){
+        for(long i = first; i <= last; i++){
+            bs->A[i] = 0;
+            bs->B[i] = 1;
+            bs->C[i] = 2;
+        }
+    }else if(bs->mode == BENCH_2D){
+        fillBench(X, first, last, bs->cols);
+        fillBench(Y, first, last, bs->cols);
+    }else{
+        fillBench(X, first*bs->rows, (last+1)*bs->rows-1, bs->cols);
+        fillBench(Y, first*bs->rows, (last+1)*bs->rows-1, bs->cols);
+    }
+    for(int rep = -bs->warmup; rep < bs->reps; rep++){
+        // every thread starts the repetition together
+        ret = pthread_barrier_wait(&bs->barrier);
+        if(handleBarrier(ret, "Error [bench-stencil:benchLoop:pthread_barrier_wait()]") == ERROR) break;
+        if(bp->rank == 0) GET_TIME(start);
+        for(int k = 0; k < bs->iterations; k++){
+            if(bs->mode == BENCH_STREAM){
+                for(long i = lo; i <= hi; i++) bs->A[i] = bs->B[i] + TRIAD_SCALAR*bs->C[i];
+            }else{
+                if(bs->mode == BENCH_2D) timeBlock2D(X, Y, lo, hi, 1, 0, 0, bs->cols, bp->rs);
+                else sweep3D(X, Y, lo, hi, bs->rows, bs->cols);
+                tmp = X, X = Y, Y = tmp;
+            }
+            // wait for all rows of this sweep before the next one reads them
+            ret = pthread_barrier_wait(&bs->barrier);
+            if(handleBarrier(ret, "Error [bench-stencil:benchLoop:pthread_barrier_wait()]") == ERROR) return NULL;
+        }
+        if(bp->rank == 0) GET_TIME(end);
+        if(bp->rank == 0 && rep >= 0) bs->times[rep] = end-start;
+    }
+    return NULL;
+}
+
+/**
+ *  @brief Runs the warmup and timed repetitions of a benchmark with num_threads threads
+ *  @param bs (BenchShared*) shared benchmark data, bs->times gets the time of each timed repetition
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int runBench(BenchShared * bs){
+    pthread_t * th_handles = NULL;
+    BenchPrivate * bp = NULL;
+    int ret = ERROR, created = 0, err = 0;
+
+    if(malloc1D((void*)&th_handles, bs->num_threads*PTR_SIZE, "th_handles") == ERROR) goto end_all;
+    if(malloc1D((void*)&bp, bs->num_threads*sizeof(BenchPrivate), "bp") == ERROR) goto end_a;
+    for(int tid = 0; tid < bs->num_threads; tid++) bp[tid].rs = NULL;
+    // each thread needs its own row sums for the separable kernel
+    for(int tid = 0; tid < bs->num_threads && bs->mode == BENCH_2D; tid++){
+        if(mallocRowSums(&bp[tid].rs, 1, bs->cols) == ERROR) goto end_b;
+    }
+    err = pthread_barrier_init(&bs->barrier, NULL, bs->num_threads);
+    if(handleBarrier(err, "Error [bench-stencil:runBench:pthread_barrier_init()]") == ERROR) goto end_b;
+    for(int tid = 0; tid < bs->num_threads; tid++){
+        bp[tid].bs = bs;
+        bp[tid].rank = tid;
+        if((err = pthread_create(&th_handles[tid], NULL, benchLoop, (void*)&bp[tid])) != SUCCESS){
+            errno = err;
+            perror("Error [bench-stencil:runBench:pthread_create()]");
+            // the threads already created wait at the first barrier forever
+            exit(EXIT_FAILURE);
+        }
+        created++;
+    }
+    for(int tid = 0; tid < created; tid++){
+        if((err = pthread_join(th_handles[tid], NULL)) != SUCCESS){
+            errno = err;
+            perror("Error [bench-stencil:runBench:pthread_join()]");
+        }
+    }
+    err = pthread_barrier_destroy(&bs->barrier);
+    if(handleBarrier(err, "Error [bench-stencil:runBench:pthread_barrier_destroy()]") == ERROR) goto end_b;
+    ret = SUCCESS;
+
+end_b:
+    if(bs->mode == BENCH_2D){
+        for(int tid = 0; tid < bs->num_threads; tid++) freeRowSums(bp[tid].rs, 1);
+    }
+    free(bp);
+end_a:
+    free(th_handles);
+end_all:
+    return ret;
+}
+
+/**
+ *  @brief Splits a comma separated list option in place
+ *  @param list (char*) list to split
+ *  @param items (char**) MAX_LIST pointers to each item
+ *  @param opt_name (char*) option name for error messages
+ *  @return [arg] items (addr); [val]: # items | ERROR (-1)
+ */
+int splitList(char * list, char ** items, char * opt_name){
+    int count = 0;
+    for(char * item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")){
+        if(count == MAX_LIST){
+            printf("Error [bench-stencil:splitList()]: %s has more than %d items\n", opt_name, MAX_LIST);
+            return ERROR;
+        }
+        items[count++] = item;
+    }
+    if(count == 0){
+        printf("Error [bench-stencil:splitList()]: %s is empty\n", opt_name);
+        return ERROR;
+    }
+    return count;
+}
+
+/**
+ *  @brief Splits a comma separated list option of ints in place
+ *  @param list (char*) list to split
+ *  @param values (int*) MAX_LIST parsed values
+ *  @param arg_min (int) min valid integer
+ *  @param opt_name (char*) option name for error messages
+ *  @return [arg] values (addr); [val]: # values | ERROR (-1)
+ */
+int splitIntList(char * list, int * values, int arg_min, char * opt_name){
+    char * items[MAX_LIST];
+    int count = splitList(list, items, opt_name);
+    for(int i = 0; i < count; i++){
+        if((values[i] = parseInt(items[i], arg_min, SKIP_ARG, opt_name)) == ERROR) return ERROR;
+    }
+    return count;
+}
+
+int compareRates(const void * a, const void * b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ *  @brief Gets the nearest rank percentile of sorted values
+ *  @param sorted (double*) values in ascending order
+ *  @param count (int) # values
+ *  @param pct (int) percentile [0-100]
+ *  @return [val]: percentile value (double)
+ */
+double percentile(double * sorted, int count, int pct){
+    int i = (int)ceil(pct/100.0*count)-1;
+    return sorted[MIN(MAX(i, 0), count-1)];
+}
+
+int main(int argn, char **argv) {
+    int ret = EXIT_FAILURE;
+    char * sizes_arg = NULL, * threads_arg = NULL, * simd_arg = NULL, * kernel_arg = NULL, * stencil_arg = NULL, * csv_file = NULL;
+    char default_sizes[] = "512,2048,4096", default_kernels[] = "box", default_stencils[] = "9pt";
+    char default_threads[32], default_simd[64] = "";
+    char * simds[MAX_LIST], * kernels[MAX_LIST], * stencils[MAX_LIST];
+    int sizes[MAX_LIST], threads[MAX_LIST], num_sizes = 0, num_threads = 0, num_simds = 0, num_kernels = 0, num_stencils = 0;
+    double stream_bw[MAX_LIST], * rates = NULL;
+    char ran[MAX_LIST][160];        // kernels already run for this size and stencil
+    int num_ran = 0;
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    FILE * csv = NULL;
+    BenchShared bs = {.mode=BENCH_STREAM, .A=NULL, .B=NULL, .C=NULL, .count=0, .planes=0, .rows=0, .cols=0,
+        .num_threads=1, .iterations=0, .warmup=0, .reps=0, .times=NULL};
+
+    // parse optional args, no positional args are left
+    int fast_math = popOption(&argn, argv, "--fast-math", NULL);
+    int iterations = parseIntOption(&argn, argv, "--iterations", 1, SKIP_ARG, 0);
+    if(iterations == ERROR) goto end_all;
+    if((bs.warmup = parseIntOption(&argn, argv, "--warmup", 0, SKIP_ARG, 2)) == ERROR) goto end_all;
+    if((bs.reps = parseIntOption(&argn, argv, "--reps", 1, SKIP_ARG, 10)) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--sizes", &sizes_arg) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--threads", &threads_arg) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--simd", &simd_arg) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--kernel", &kernel_arg) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--stencil", &stencil_arg) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--csv", &csv_file) == ERROR) goto end_all;
+
+    if(argn != 1){
+        printf("Usage: %s [--sizes <n,...>] [--threads <t,...>] [--simd <scalar,sse2,avx2,avx512,...>] [--kernel <box,separable>] [--stencil <5pt,9pt,13pt,25pt,file,7pt,27pt,...>] [--fast-math] [--iterations <k>] [--warmup <w>] [--reps <r>] [--csv <file>]\n", argv[0]);
+        goto end_all;
+    }
+    // default to 1 thread and every cpu, and to every isa this cpu supports
+    snprintf(default_threads, sizeof(default_threads), (num_cpus > 1) ? "1,%ld" : "1", num_cpus);
+    for(int i = 0; i < 4; i++){
+        char * isa[] = {"scalar", "sse2", "avx2", "avx512"};
+        if(!kernelAvailable(isa[i])) continue;
+        if(default_simd[0] != '\0') strcat(default_simd, ",");
+        strcat(default_simd, isa[i]);
+    }
+    if((num_sizes = splitIntList((sizes_arg != NULL) ? sizes_arg : default_sizes, sizes, 8, "--sizes")) == ERROR) goto end_all;
+    if((num_threads = splitIntList((threads_arg != NULL) ? threads_arg : default_threads, threads, 1, "--threads")) == ERROR) goto end_all;
+    if((num_simds = splitList((simd_arg != NULL) ? simd_arg : default_simd, simds, "--simd")) == ERROR) goto end_all;
+    if((num_kernels = splitList((kernel_arg != NULL) ? kernel_arg : default_kernels, kernels, "--kernel")) == ERROR) goto end_all;
+    if((num_stencils = splitList((stencil_arg != NULL) ? stencil_arg : default_stencils, stencils, "--stencil")) == ERROR) goto end_all;
+    if(malloc1D((void*)&bs.times, bs.reps*sizeof(double), "bs.times") == ERROR) goto end_all;
+    if(malloc1D((void*)&rates, bs.reps*sizeof(double), "rates") == ERROR) goto end_a;
+    if(csv_file != NULL && (csv = fopen(csv_file, "w")) == NULL){
+        printf("Error [bench-stencil:main:fopen()]: cannot open/write '%s'\n", csv_file);
+        goto end_b;
+    }
+    if(csv != NULL) fprintf(csv, "stencil,kernel,planes,rows,cols,threads,iterations,reps,gflops_p10,gflops_median,gflops_p90,eff_gbs_median,stream_gbs,roofline_pct\n");
+
+    // stream triad bandwidth for each thread count, arrays far larger than the last level cache
+    long l3_size = cacheSize(3);
+    bs.count = MAX(STREAM_MIN_COUNT, (l3_size == ERROR) ? 0 : 4*l3_size/ELEM_SIZE);
+    if(malloc1D((void*)&bs.A, bs.count*ELEM_SIZE, "bs.A") == ERROR) goto end_c;
+    if(malloc1D((void*)&bs.B, bs.count*ELEM_SIZE, "bs.B") == ERROR) goto end_c;
+    if(malloc1D((void*)&bs.C, bs.count*ELEM_SIZE, "bs.C") == ERROR) goto end_c;
+    printf("------------------------------------------------------\n");
+    for(int t = 0; t < num_threads; t++){
+        double best = 0.0;
+        bs.num_threads = threads[t];
+        bs.iterations = 1;
+        if(runBench(&bs) == ERROR) goto end_c;
+        for(int rep = 0; rep < bs.reps; rep++) best = MAX(best, 3*bs.count*ELEM_SIZE/bs.times[rep]*1e-9);
+        stream_bw[t] = best;
+        printf("[Stream Triad] %d threads: %g GB/s (best of %d, 3 x %g MB arrays)\n", threads[t], best, bs.reps, bs.count*ELEM_SIZE/1048576.0);
+    }
+    free(bs.A); free(bs.B); free(bs.C);
+    bs.A = bs.B = bs.C = NULL;
+
+    printf("------------------------------------------------------\n");
+    printf("%-40s %-13s %7s %9s %9s %9s %9s %8s\n", "[Kernel]", "size", "threads", "p10", "median", "p90", "eff GB/s", "roofline");
+    for(int s = 0; s < num_sizes; s++){
+        for(int st = 0; st < num_stencils; st++){
+            // the 3D stencils get a cube with as many points as the 2D matrix
+            int is_3d = (strcmp(stencils[st], "7pt") == 0 || strcmp(stencils[st], "27pt") == 0);
+            int edge = (is_3d) ? MAX((int)round(cbrt((double)sizes[s]*sizes[s])), 3) : sizes[s], r = 1;
+            long points = 0;
+            char size_name[48];     // room for three full-width ints
+            bs.mode = (is_3d) ? BENCH_3D : BENCH_2D;
+            bs.planes = (is_3d) ? edge : 1;
+            bs.rows = bs.cols = edge;
+            if(is_3d){
+                if(setStencil3D(stencils[st]) == ERROR) goto end_c;
+                snprintf(size_name, sizeof(size_name), "%dx%dx%d", edge, edge, edge);
+                points = VOLUME_COUNT(edge-2, edge-2, edge-2);
+            }else{
+                if(setStencil2D(stencils[st]) == ERROR) goto end_c;
+                r = stencilRadius2D();
+                snprintf(size_name, sizeof(size_name), "%dx%d", edge, edge);
+                points = MATRIX_COUNT(edge-2*r, edge-2*r);
+            }
+            if(points <= 0){
+                printf("Warning [bench-stencil:main]: size %s has no interior for stencil %s, skipped\n", size_name, stencils[st]);
+                continue;
+            }
+            // enough sweeps per repetition to time them well, threads first touch their own rows
+            bs.iterations = (iterations > 0) ? iterations : (int)MAX(1, BENCH_POINTS/points);
+            if(malloc1D((void*)&bs.A, VOLUME_SIZE(bs.planes, bs.rows, bs.cols), "bs.A") == ERROR) goto end_c;
+            num_ran = 0;
+            if(malloc1D((void*)&bs.B, VOLUME_SIZE(bs.planes, bs.rows, bs.cols), "bs.B") == ERROR) goto end_c;
+            for(int i = 0; i < num_simds; i++){
+                // the 3D kernels have no separable variant
+                for(int k = 0; k < ((is_3d) ? 1 : num_kernels); k++){
+                    int flops = 0, bytes = 0;
+                    char * name = NULL;
+                    if(is_3d){
+                        if(setKernel3D(simds[i], fast_math) == ERROR || setBlock3D(NULL, bs.rows, bs.cols) == ERROR) continue;
+                        kernelCounts3D(&flops, &bytes);
+                        name = kernelName3D();
+                    }else{
+                        if(setKernel2D(simds[i], kernels[k], fast_math) == ERROR) continue;
+                        kernelCounts2D(&flops, &bytes);
+                        name = kernelName2D();
+                    }
+                    // variants without a kernel for the isa (separable, generic stencils) fall back to the same scalar kernel
+                    int seen = 0;
+                    for(int v = 0; v < num_ran && !seen; v++) seen = (strcmp(ran[v], name) == 0);
+                    if(seen) continue;
+                    if(num_ran < MAX_LIST) snprintf(ran[num_ran++], sizeof(ran[0]), "%s", name);
+                    for(int t = 0; t < num_threads; t++){
+                        double eff = 0.0;
+                        bs.num_threads = threads[t];
+                        if(runBench(&bs) == ERROR) goto end_c;
+                        for(int rep = 0; rep < bs.reps; rep++) rates[rep] = flops*(double)points*bs.iterations/bs.times[rep]*1e-9;
+                        qsort(rates, bs.reps, sizeof(double), compareRates);
+                        // each point is read and written once from memory at best (the stream triad convention)
+                        eff = percentile(rates, bs.reps, 50)/flops*2*ELEM_SIZE;
+                        printf("%-40s %-13s %7d %9.3g %9.3g %9.3g %9.3g %7.0f%%\n", name, size_name, threads[t],
+                            percentile(rates, bs.reps, 10), percentile(rates, bs.reps, 50), percentile(rates, bs.reps, 90), eff, 100.0*eff/stream_bw[t]);
+                        if(csv != NULL) fprintf(csv, "%s,%s,%d,%d,%d,%d,%d,%d,%g,%g,%g,%g,%g,%g\n", stencils[st], name, bs.planes, bs.rows, bs.cols,
+                            threads[t], bs.iterations, bs.reps, percentile(rates, bs.reps, 10), percentile(rates, bs.reps, 50),
+                            percentile(rates, bs.reps, 90), eff, stream_bw[t], 100.0*eff/stream_bw[t]);
+                        fflush(stdout);
+                    }
+                }
+            }
+            free(bs.A); free(bs.B);
+            bs.A = bs.B = NULL;
+        }
+    }
+    printf("------------------------------------------------------\n");
+    printf("GFLOP/s percentiles of %d repetitions (after %d warmup), roofline = eff GB/s (%d B/pt read + write) / stream GB/s\n",
+        bs.reps, bs.warmup, (int)(2*ELEM_SIZE));
+    ret = EXIT_SUCCESS;
+
+end_c:
+    free(bs.A); free(bs.B); free(bs.C);
+    if(csv != NULL && fclose(csv) != 0){
+        perror("Error [bench-stencil:main:fclose()]");
+        ret = EXIT_FAILURE;
+    }
+end_b:
+    free(rates);
+end_a:
+    free(bs.times);
+end_all:
+    exit(ret);
+}
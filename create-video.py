@@ -5,12 +5,34 @@ import numpy as np
 import matplotlib.pyplot as plt
 import cv2
 import subprocess
+import struct
 
+SAMPLE_MAGIC = b'SMP1'
+SAMPLE_HEADER_SIZE = 48     # magic, elem_size, rows, cols, then 8 ints of sampling options
 
-def main(input_file, cols, iterations):
+
+def read_sample_header(input_file):
+    # sampled stacked files (--every, --roi, --pool) start with a header, whole matrix files have none
+    with open(input_file, 'rb') as f:
+        head = f.read(SAMPLE_HEADER_SIZE)
+    if len(head) < SAMPLE_HEADER_SIZE or head[:4] != SAMPLE_MAGIC:
+        return None
+    elem_size, rows, cols, src_rows, src_cols, every, row0, col0, roi_rows, roi_cols, pool = struct.unpack('<11i', head[4:])
+    frames = (os.path.getsize(input_file) - SAMPLE_HEADER_SIZE) // max(rows * cols * elem_size, 1)
+    print(f"Processing '{input_file}' as {frames} frames of size {rows}x{cols} (every {every} iterations of the "
+          f"{roi_rows}x{roi_cols} region at ({row0},{col0}) of a {src_rows}x{src_cols} matrix, {pool}x{pool} pooling)")
+    return elem_size, rows, cols, frames
+
+
+def main(input_file, cols=0, iterations=0):
+    offset = 0
+    header = read_sample_header(input_file) if cols == 0 else None
     # Parse input file name
     tmp = re.findall('(\d+)', input_file)
-    if cols == 0:
+    if header is not None:
+        elem_size, rows, cols, iterations = header
+        offset = SAMPLE_HEADER_SIZE
+    elif cols == 0:
         if len(tmp) == 3:
             rows = int(tmp[0])
             cols = int(tmp[1])
@@ -28,7 +50,10 @@ def main(input_file, cols, iterations):
         input_file = f'{str(rows)}-{str(cols)}-{str(iterations)}.raw'
         iterations+=1
     # Read binary data and reshapes into a 3D array
-    data = np.fromfile(input_file, dtype=np.double)
+    # whole matrix stacked files have no metadata, builds with PRECISION=single|mixed write 4-byte floats
+    if header is None:
+        elem_size = os.path.getsize(input_file) // max(rows * cols * iterations, 1)
+    data = np.fromfile(input_file, dtype=np.float32 if elem_size == 4 else np.double, offset=offset)
     expected_size = rows * cols * iterations
     actual_size = data.size
 
@@ -67,7 +92,7 @@ def main(input_file, cols, iterations):
 
 if __name__ == "__main__":
     if len(sys.argv) == 2:
-        if not os.path.isfile(sys.argv[1], 0, 0):
+        if not os.path.isfile(sys.argv[1]):
             print(f"Error: file {sys.argv[1]} does not exist")
         else:
             main(sys.argv[1])
@@ -0,0 +1,1148 @@
+/**
+ * @file kernel_utils.c
+ * @author Leslie Horace
+ * @brief File storing the stencil row kernels, stencil descriptions, and runtime kernel selection
+ * @version 1.0
+ *
+ * All kernels add the 9 points in the same order as the scalar kernel, so the
+ * strict kernels give bit-identical results for every ISA. The fast kernels
+ * multiply by 1/9 instead of dividing by 9, which is within FAST_MATH_ULP.
+ * The separable kernel sums each row of 3 once and reuses it for 3 output
+ * rows, the different summation order is not bit-identical to the box kernel.
+ * Sums are done in acc_t, which is double for mixed precision builds, so
+ * float elements are widened on load and rounded once on store.
+ *
+ * Other stencils are a table of weights over a (2r+1)x(2r+1) footprint. The
+ * 5-pt, 9-pt, 13-pt (diamond), and 25-pt footprints have kernels unrolled by
+ * the FOOTPRINT_* macros for each ISA, any other footprint uses the generic
+ * kernel. Both add the weighted points in row major order, so they are also
+ * bit-identical to each other and across ISAs.
+ *
+ * A volume is a matrix of planes*rows rows, so the 3D kernels are row kernels
+ * that also reach a plane (rows*cols elements) up and down. The 7-pt and
+ * 27-pt kernels add their points in plane major order for every ISA.
+ */
+#include "kernel_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_KERNELS
+#endif
+
+// sum of the 9-pt footprint around Y[i][j], order matches the vector kernels (summed in acc_t)
+#define POINT_SUM(Y,i,j,c) ((acc_t)Y[IDX(i-1,j-1,c)] + Y[IDX(i-1,j,c)] + Y[IDX(i-1,j+1,c)] \
+            + Y[IDX(i,j+1,c)] + Y[IDX(i+1,j+1,c)] + Y[IDX(i+1,j,c)] \
+            + Y[IDX(i+1,j-1,c)] + Y[IDX(i,j-1,c)] + Y[IDX(i,j,c)])
+
+// sum of the 9-pt footprint for a vector of columns starting at column j, order matches POINT_SUM
+#define VECTOR_SUM(s,LOAD,ADD,up,mid,dn,j) \
+    s = ADD(LOAD(&up[j-1]), LOAD(&up[j])); \
+    s = ADD(s, LOAD(&up[j+1])); s = ADD(s, LOAD(&mid[j+1])); \
+    s = ADD(s, LOAD(&dn[j+1])); s = ADD(s, LOAD(&dn[j])); \
+    s = ADD(s, LOAD(&dn[j-1])); s = ADD(s, LOAD(&mid[j-1])); \
+    s = ADD(s, LOAD(&mid[j]));
+
+#define NINE ((acc_t)9.0)       // divisor used by strict kernels
+
+#define MAX_POINTS (MAX_STENCIL_WIDTH*MAX_STENCIL_WIDTH)
+#define MAX_SHAPE_POINTS 25     // points of the largest footprint with unrolled kernels
+
+// footprints with unrolled kernels as P(weight index, row offset, col offset), row major like the generic kernel
+#define FOOTPRINT_5PT(P) P(0,-1,0) P(1,0,-1) P(2,0,0) P(3,0,1) P(4,1,0)
+#define FOOTPRINT_9PT(P) P(0,-1,-1) P(1,-1,0) P(2,-1,1) P(3,0,-1) P(4,0,0) P(5,0,1) P(6,1,-1) P(7,1,0) P(8,1,1)
+#define FOOTPRINT_13PT(P) P(0,-2,0) P(1,-1,-1) P(2,-1,0) P(3,-1,1) P(4,0,-2) P(5,0,-1) P(6,0,0) \
+    P(7,0,1) P(8,0,2) P(9,1,-1) P(10,1,0) P(11,1,1) P(12,2,0)
+#define FOOTPRINT_25PT(P) P(0,-2,-2) P(1,-2,-1) P(2,-2,0) P(3,-2,1) P(4,-2,2) P(5,-1,-2) P(6,-1,-1) \
+    P(7,-1,0) P(8,-1,1) P(9,-1,2) P(10,0,-2) P(11,0,-1) P(12,0,0) P(13,0,1) P(14,0,2) P(15,1,-2) \
+    P(16,1,-1) P(17,1,0) P(18,1,1) P(19,1,2) P(20,2,-2) P(21,2,-1) P(22,2,0) P(23,2,1) P(24,2,2)
+
+// 3D footprints as V(plane offset, row offset, col offset), plane major
+#define PLANE_9PT(V,dk) V(dk,-1,-1) V(dk,-1,0) V(dk,-1,1) V(dk,0,-1) V(dk,0,0) V(dk,0,1) V(dk,1,-1) V(dk,1,0) V(dk,1,1)
+#define FOOTPRINT_7PT(V) V(-1,0,0) V(0,-1,0) V(0,0,-1) V(0,0,0) V(0,0,1) V(0,1,0) V(1,0,0)
+#define FOOTPRINT_27PT(V) PLANE_9PT(V,-1) PLANE_9PT(V,0) PLANE_9PT(V,1)
+
+#define VOLUME_7PT 0            // index of each 3D footprint in KernelInfo.volume
+#define VOLUME_27PT 1
+
+#define SHAPE_5PT 0             // index of each footprint in KernelInfo.shaped
+#define SHAPE_9PT 1
+#define SHAPE_13PT 2
+#define SHAPE_25PT 3
+#define SHAPE_GENERIC NUM_SHAPES
+
+// weights are loaded into locals once per row, then each point of the footprint is its own statement
+#define WEIGHT_LOAD(k,di,dj) const acc_t w##k = stencil.w[k];
+#define SCALAR_TERM(k,di,dj) s += w##k*Y[IDX(i+(di),j+(dj),c)];
+#define FOOTPRINT_OFFSET(k,di,dj) {di, dj},
+
+// result of a weighted sum, fast math multiplies by the reciprocal of the divisor
+#define WEIGHTED_RESULT(s) ((kernel_fast) ? (s)*stencil.recip : (s)/stencil.divisor)
+
+// each point of a 3D footprint is its own statement, y is row i of the middle plane
+#define VOLUME_TERM(dk,di,dj) s += y[j+(dk)*plane+(di)*c+(dj)];
+#define VOLUME_RESULT(s) ((kernel_fast) ? (s)*volume.recip : (s)/volume.divisor)
+
+/**
+ *  @brief Defines a scalar row kernel with a footprint unrolled by a FOOTPRINT_* macro
+ *  @param name function name
+ *  @param FOOTPRINT FOOTPRINT_* macro
+ */
+#define SCALAR_SHAPE_KERNEL(name, FOOTPRINT) \
+static void name(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){ \
+    FOOTPRINT(WEIGHT_LOAD) \
+    acc_t s = 0; \
+    for(long j = j0; j < j1; j++){ \
+        s = 0; \
+        FOOTPRINT(SCALAR_TERM) \
+        X[IDX(i,j,c)] = WEIGHTED_RESULT(s); \
+    } \
+}
+
+/**
+ *  @brief Defines a vector row kernel with a footprint unrolled by a FOOTPRINT_* macro, leftover columns are scalar
+ *  @param name function name
+ *  @param FOOTPRINT FOOTPRINT_* macro
+ *  @param ISA SSE2 | AVX2 | AVX512 (prefix of the vector macros)
+ *  @param feature target cpu feature
+ */
+#define VECTOR_SHAPE_KERNEL(name, FOOTPRINT, ISA, feature) \
+__attribute__((target(feature))) \
+static void name(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){ \
+    FOOTPRINT(WEIGHT_LOAD) \
+    FOOTPRINT(ISA##_WEIGHT) \
+    ISA##_VEC divisor = ISA##_SET1(stencil.divisor), recip = ISA##_SET1(stencil.recip), v; \
+    acc_t s = 0; \
+    long j = j0; \
+    for(; j+ISA##_LANES <= j1; j += ISA##_LANES){ \
+        v = ISA##_SET1(0); \
+        FOOTPRINT(ISA##_TERM) \
+        ISA##_STORE(&X[IDX(i,j,c)], (kernel_fast) ? ISA##_MUL(v, recip) : ISA##_DIV(v, divisor)); \
+    } \
+    for(; j < j1; j++){ \
+        s = 0; \
+        FOOTPRINT(SCALAR_TERM) \
+        X[IDX(i,j,c)] = WEIGHTED_RESULT(s); \
+    } \
+}
+
+/**
+ *  @brief Defines a scalar 3D row kernel with a footprint unrolled by a FOOTPRINT_* macro
+ *  @param name function name
+ *  @param FOOTPRINT FOOTPRINT_7PT | FOOTPRINT_27PT
+ */
+#define SCALAR_VOLUME_KERNEL(name, FOOTPRINT) \
+static void name(elem_t *X, elem_t *Y, long i, long c, long plane, long j0, long j1){ \
+    elem_t *y = &Y[IDX(i,0,c)]; \
+    acc_t s = 0; \
+    for(long j = j0; j < j1; j++){ \
+        s = 0; \
+        FOOTPRINT(VOLUME_TERM) \
+        X[IDX(i,j,c)] = VOLUME_RESULT(s); \
+    } \
+}
+
+/**
+ *  @brief Defines a vector 3D row kernel with a footprint unrolled by a FOOTPRINT_* macro, leftover columns are scalar
+ *  @param name function name
+ *  @param FOOTPRINT FOOTPRINT_7PT | FOOTPRINT_27PT
+ *  @param ISA SSE2 | AVX2 | AVX512 (prefix of the vector macros)
+ *  @param feature target cpu feature
+ */
+#define VECTOR_VOLUME_KERNEL(name, FOOTPRINT, ISA, feature) \
+__attribute__((target(feature))) \
+static void name(elem_t *X, elem_t *Y, long i, long c, long plane, long j0, long j1){ \
+    elem_t *y = &Y[IDX(i,0,c)]; \
+    ISA##_VEC divisor = ISA##_SET1(volume.divisor), recip = ISA##_SET1(volume.recip), v; \
+    acc_t s = 0; \
+    long j = j0; \
+    for(; j+ISA##_LANES <= j1; j += ISA##_LANES){ \
+        v = ISA##_SET1(0); \
+        FOOTPRINT(ISA##_VOLUME_TERM) \
+        ISA##_STORE(&X[IDX(i,j,c)], (kernel_fast) ? ISA##_MUL(v, recip) : ISA##_DIV(v, divisor)); \
+    } \
+    for(; j < j1; j++){ \
+        s = 0; \
+        FOOTPRINT(VOLUME_TERM) \
+        X[IDX(i,j,c)] = VOLUME_RESULT(s); \
+    } \
+}
+
+// builds that are not double precision say so in the kernel name
+#if defined(SINGLE_PRECISION) || defined(MIXED_PRECISION)
+#define PRECISION_TAG " (" PRECISION_NAME " precision)"
+#else
+#define PRECISION_TAG ""
+#endif
+
+#ifdef X86_KERNELS
+// vector arithmetic is done on acc_t lanes
+#ifdef SINGLE_PRECISION
+#define SSE2_VEC __m128
+#define SSE2_ADD _mm_add_ps
+#define SSE2_MUL _mm_mul_ps
+#define SSE2_DIV _mm_div_ps
+#define SSE2_SET1 _mm_set1_ps
+#define AVX2_VEC __m256
+#define AVX2_ADD _mm256_add_ps
+#define AVX2_MUL _mm256_mul_ps
+#define AVX2_DIV _mm256_div_ps
+#define AVX2_SET1 _mm256_set1_ps
+#define AVX512_VEC __m512
+#define AVX512_ADD _mm512_add_ps
+#define AVX512_MUL _mm512_mul_ps
+#define AVX512_DIV _mm512_div_ps
+#define AVX512_SET1 _mm512_set1_ps
+#else
+#define SSE2_VEC __m128d
+#define SSE2_ADD _mm_add_pd
+#define SSE2_MUL _mm_mul_pd
+#define SSE2_DIV _mm_div_pd
+#define SSE2_SET1 _mm_set1_pd
+#define AVX2_VEC __m256d
+#define AVX2_ADD _mm256_add_pd
+#define AVX2_MUL _mm256_mul_pd
+#define AVX2_DIV _mm256_div_pd
+#define AVX2_SET1 _mm256_set1_pd
+#define AVX512_VEC __m512d
+#define AVX512_ADD _mm512_add_pd
+#define AVX512_MUL _mm512_mul_pd
+#define AVX512_DIV _mm512_div_pd
+#define AVX512_SET1 _mm512_set1_pd
+#endif
+
+// loads and stores of elem_t, mixed precision widens floats on load and narrows on store
+#if defined(SINGLE_PRECISION)
+#define SSE2_LANES 4
+#define SSE2_LOAD(p) _mm_loadu_ps(p)
+#define SSE2_STORE(p,v) _mm_storeu_ps(p, v)
+#define AVX2_LANES 8
+#define AVX2_LOAD(p) _mm256_loadu_ps(p)
+#define AVX2_STORE(p,v) _mm256_storeu_ps(p, v)
+#define AVX512_LANES 16
+#define AVX512_LOAD(p) _mm512_loadu_ps(p)
+#define AVX512_STORE(p,v) _mm512_storeu_ps(p, v)
+#elif defined(MIXED_PRECISION)
+#define SSE2_LANES 2
+#define SSE2_LOAD(p) _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((__m128i const*)(p))))
+#define SSE2_STORE(p,v) _mm_storel_pi((__m64*)(p), _mm_cvtpd_ps(v))
+#define AVX2_LANES 4
+#define AVX2_LOAD(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+#define AVX2_STORE(p,v) _mm_storeu_ps(p, _mm256_cvtpd_ps(v))
+#define AVX512_LANES 8
+#define AVX512_LOAD(p) _mm512_cvtps_pd(_mm256_loadu_ps(p))
+#define AVX512_STORE(p,v) _mm256_storeu_ps(p, _mm512_cvtpd_ps(v))
+#else
+#define SSE2_LANES 2
+#define SSE2_LOAD(p) _mm_loadu_pd(p)
+#define SSE2_STORE(p,v) _mm_storeu_pd(p, v)
+#define AVX2_LANES 4
+#define AVX2_LOAD(p) _mm256_loadu_pd(p)
+#define AVX2_STORE(p,v) _mm256_storeu_pd(p, v)
+#define AVX512_LANES 8
+#define AVX512_LOAD(p) _mm512_loadu_pd(p)
+#define AVX512_STORE(p,v) _mm512_storeu_pd(p, v)
+#endif
+
+// weight vectors and weighted terms of the unrolled footprints, same order and rounding as SCALAR_TERM
+#define SSE2_WEIGHT(k,di,dj) const SSE2_VEC wv##k = SSE2_SET1(w##k);
+#define SSE2_TERM(k,di,dj) v = SSE2_ADD(v, SSE2_MUL(wv##k, SSE2_LOAD(&Y[IDX(i+(di),j+(dj),c)])));
+#define AVX2_WEIGHT(k,di,dj) const AVX2_VEC wv##k = AVX2_SET1(w##k);
+#define AVX2_TERM(k,di,dj) v = AVX2_ADD(v, AVX2_MUL(wv##k, AVX2_LOAD(&Y[IDX(i+(di),j+(dj),c)])));
+#define AVX512_WEIGHT(k,di,dj) const AVX512_VEC wv##k = AVX512_SET1(w##k);
+#define AVX512_TERM(k,di,dj) v = AVX512_ADD(v, AVX512_MUL(wv##k, AVX512_LOAD(&Y[IDX(i+(di),j+(dj),c)])));
+#define SSE2_VOLUME_TERM(dk,di,dj) v = SSE2_ADD(v, SSE2_LOAD(&y[j+(dk)*plane+(di)*c+(dj)]));
+#define AVX2_VOLUME_TERM(dk,di,dj) v = AVX2_ADD(v, AVX2_LOAD(&y[j+(dk)*plane+(di)*c+(dj)]));
+#define AVX512_VOLUME_TERM(dk,di,dj) v = AVX512_ADD(v, AVX512_LOAD(&y[j+(dk)*plane+(di)*c+(dj)]));
+#endif
+
+/**
+ *  @struct _stencilShape
+ *  @typedef StencilShape
+ *  @brief struct for the selected stencil, its nonzero weights in row major order, and the footprint it matches
+ */
+typedef struct _stencilShape{
+    char name[96];
+    int radius;
+    int shape;                  // SHAPE_* footprint with unrolled kernels | SHAPE_GENERIC
+    int classic;                // 1 = equal weight 9-pt, computed by the sum/9 kernels
+    int separable;              // 1 = weight[i][j] is col[i]*row[j]
+    int points;                 // # nonzero weights
+    int di[MAX_POINTS];         // row offset of each weight
+    int dj[MAX_POINTS];         // col offset of each weight
+    acc_t w[MAX_POINTS];
+    acc_t row[MAX_STENCIL_WIDTH];
+    acc_t col[MAX_STENCIL_WIDTH];
+    acc_t divisor;
+    acc_t recip;                // 1/divisor for fast math
+}StencilShape;
+
+/**
+ *  @struct _footprint
+ *  @typedef Footprint
+ *  @brief struct for a footprint with unrolled kernels and its built in equal weight stencil
+ */
+typedef struct _footprint{
+    char * name;
+    int radius;
+    int points;
+    int separable;              // 1 = built in stencil is separable (a full square)
+    int offsets[MAX_SHAPE_POINTS][2];
+}Footprint;
+
+static Footprint footprints[NUM_SHAPES] = {
+    {"5pt", 1, 5, 0, {FOOTPRINT_5PT(FOOTPRINT_OFFSET)}},
+    {"9pt", 1, 9, 1, {FOOTPRINT_9PT(FOOTPRINT_OFFSET)}},
+    {"13pt", 2, 13, 0, {FOOTPRINT_13PT(FOOTPRINT_OFFSET)}},
+    {"25pt", 2, 25, 1, {FOOTPRINT_25PT(FOOTPRINT_OFFSET)}}
+};
+
+// selected stencil, the equal weight 9-pt stencil until setStencil2D()
+static StencilShape stencil = {.name="9pt", .radius=1, .shape=SHAPE_9PT, .classic=1, .separable=1, .points=9, .divisor=9.0, .recip=ONE_NINTH};
+static int kernel_fast = 0;
+
+/**
+ *  @struct _volumeStencil
+ *  @typedef VolumeStencil
+ *  @brief struct for a 3D stencil, the equal weight average of the points of its footprint
+ */
+typedef struct _volumeStencil{
+    char * name;
+    int points;
+    acc_t divisor;              // # points
+    acc_t recip;                // 1/divisor for fast math
+}VolumeStencil;
+
+static VolumeStencil volumes[NUM_VOLUMES] = {
+    {"7pt", 7, 7.0, (acc_t)(1.0/7.0)},
+    {"27pt", 27, 27.0, (acc_t)(1.0/27.0)}
+};
+
+// selected 3D stencil, the 7-pt stencil until setStencil3D()
+static VolumeStencil volume = {"7pt", 7, 7.0, (acc_t)(1.0/7.0)};
+static int volume_shape = VOLUME_7PT;
+
+static void rowScalarStrict(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){
+    for(long j = j0; j < j1; j++) X[IDX(i,j,c)] = POINT_SUM(Y,i,j,c)/NINE;
+}
+
+static void rowScalarFast(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){
+    for(long j = j0; j < j1; j++) X[IDX(i,j,c)] = POINT_SUM(Y,i,j,c)*ONE_NINTH;
+}
+
+SCALAR_SHAPE_KERNEL(rowScalarShape5, FOOTPRINT_5PT)
+SCALAR_SHAPE_KERNEL(rowScalarShape9, FOOTPRINT_9PT)
+SCALAR_SHAPE_KERNEL(rowScalarShape13, FOOTPRINT_13PT)
+SCALAR_SHAPE_KERNEL(rowScalarShape25, FOOTPRINT_25PT)
+SCALAR_VOLUME_KERNEL(rowScalarVolume7, FOOTPRINT_7PT)
+SCALAR_VOLUME_KERNEL(rowScalarVolume27, FOOTPRINT_27PT)
+
+/**
+ *  @brief Computes columns j0..j1-1 of one row of any stencil by looping over its nonzero weights
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param i (long) row index
+ *  @param c (long) # columns
+ *  @param j0 (long) first column
+ *  @param j1 (long) last column + 1
+ */
+static void rowScalarGeneric(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){
+    long offset[MAX_POINTS];
+    elem_t *y = &Y[IDX(i,0,c)];
+    acc_t s = 0;
+    for(int p = 0; p < stencil.points; p++) offset[p] = stencil.di[p]*c + stencil.dj[p];
+    for(long j = j0; j < j1; j++){
+        s = 0;
+        for(int p = 0; p < stencil.points; p++) s += stencil.w[p]*y[j+offset[p]];
+        X[IDX(i,j,c)] = WEIGHTED_RESULT(s);
+    }
+}
+
+#ifdef X86_KERNELS
+__attribute__((target("sse2")))
+static void rowSSE2(elem_t *X, elem_t *Y, long i, long c, long j0, long j1, int fast){
+    elem_t *up = &Y[IDX(i-1,0,c)], *mid = &Y[IDX(i,0,c)], *dn = &Y[IDX(i+1,0,c)], *out = &X[IDX(i,0,c)];
+    SSE2_VEC nine = SSE2_SET1(NINE), recip = SSE2_SET1(ONE_NINTH);
+    long j = j0;
+    for(; j+SSE2_LANES <= j1; j += SSE2_LANES){
+        SSE2_VEC s;
+        VECTOR_SUM(s, SSE2_LOAD, SSE2_ADD, up, mid, dn, j)
+        SSE2_STORE(&out[j], (fast) ? SSE2_MUL(s, recip) : SSE2_DIV(s, nine));
+    }
+    for(; j < j1; j++) out[j] = (fast) ? POINT_SUM(Y,i,j,c)*ONE_NINTH : POINT_SUM(Y,i,j,c)/NINE;
+}
+
+__attribute__((target("avx2")))
+static void rowAVX2(elem_t *X, elem_t *Y, long i, long c, long j0, long j1, int fast){
+    elem_t *up = &Y[IDX(i-1,0,c)], *mid = &Y[IDX(i,0,c)], *dn = &Y[IDX(i+1,0,c)], *out = &X[IDX(i,0,c)];
+    AVX2_VEC nine = AVX2_SET1(NINE), recip = AVX2_SET1(ONE_NINTH);
+    long j = j0;
+    for(; j+AVX2_LANES <= j1; j += AVX2_LANES){
+        AVX2_VEC s;
+        VECTOR_SUM(s, AVX2_LOAD, AVX2_ADD, up, mid, dn, j)
+        AVX2_STORE(&out[j], (fast) ? AVX2_MUL(s, recip) : AVX2_DIV(s, nine));
+    }
+    for(; j < j1; j++) out[j] = (fast) ? POINT_SUM(Y,i,j,c)*ONE_NINTH : POINT_SUM(Y,i,j,c)/NINE;
+}
+
+__attribute__((target("avx512f")))
+static void rowAVX512(elem_t *X, elem_t *Y, long i, long c, long j0, long j1, int fast){
+    elem_t *up = &Y[IDX(i-1,0,c)], *mid = &Y[IDX(i,0,c)], *dn = &Y[IDX(i+1,0,c)], *out = &X[IDX(i,0,c)];
+    AVX512_VEC nine = AVX512_SET1(NINE), recip = AVX512_SET1(ONE_NINTH);
+    long j = j0;
+    for(; j+AVX512_LANES <= j1; j += AVX512_LANES){
+        AVX512_VEC s;
+        VECTOR_SUM(s, AVX512_LOAD, AVX512_ADD, up, mid, dn, j)
+        AVX512_STORE(&out[j], (fast) ? AVX512_MUL(s, recip) : AVX512_DIV(s, nine));
+    }
+    for(; j < j1; j++) out[j] = (fast) ? POINT_SUM(Y,i,j,c)*ONE_NINTH : POINT_SUM(Y,i,j,c)/NINE;
+}
+
+static void rowSSE2Strict(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){ rowSSE2(X, Y, i, c, j0, j1, 0); }
+static void rowSSE2Fast(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){ rowSSE2(X, Y, i, c, j0, j1, 1); }
+static void rowAVX2Strict(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){ rowAVX2(X, Y, i, c, j0, j1, 0); }
+static void rowAVX2Fast(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){ rowAVX2(X, Y, i, c, j0, j1, 1); }
+static void rowAVX512Strict(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){ rowAVX512(X, Y, i, c, j0, j1, 0); }
+static void rowAVX512Fast(elem_t *X, elem_t *Y, long i, long c, long j0, long j1){ rowAVX512(X, Y, i, c, j0, j1, 1); }
+
+VECTOR_SHAPE_KERNEL(rowSSE2Shape5, FOOTPRINT_5PT, SSE2, "sse2")
+VECTOR_SHAPE_KERNEL(rowSSE2Shape9, FOOTPRINT_9PT, SSE2, "sse2")
+VECTOR_SHAPE_KERNEL(rowSSE2Shape13, FOOTPRINT_13PT, SSE2, "sse2")
+VECTOR_SHAPE_KERNEL(rowSSE2Shape25, FOOTPRINT_25PT, SSE2, "sse2")
+VECTOR_SHAPE_KERNEL(rowAVX2Shape5, FOOTPRINT_5PT, AVX2, "avx2")
+VECTOR_SHAPE_KERNEL(rowAVX2Shape9, FOOTPRINT_9PT, AVX2, "avx2")
+VECTOR_SHAPE_KERNEL(rowAVX2Shape13, FOOTPRINT_13PT, AVX2, "avx2")
+VECTOR_SHAPE_KERNEL(rowAVX2Shape25, FOOTPRINT_25PT, AVX2, "avx2")
+VECTOR_SHAPE_KERNEL(rowAVX512Shape5, FOOTPRINT_5PT, AVX512, "avx512f")
+VECTOR_SHAPE_KERNEL(rowAVX512Shape9, FOOTPRINT_9PT, AVX512, "avx512f")
+VECTOR_SHAPE_KERNEL(rowAVX512Shape13, FOOTPRINT_13PT, AVX512, "avx512f")
+VECTOR_SHAPE_KERNEL(rowAVX512Shape25, FOOTPRINT_25PT, AVX512, "avx512f")
+VECTOR_VOLUME_KERNEL(rowSSE2Volume7, FOOTPRINT_7PT, SSE2, "sse2")
+VECTOR_VOLUME_KERNEL(rowSSE2Volume27, FOOTPRINT_27PT, SSE2, "sse2")
+VECTOR_VOLUME_KERNEL(rowAVX2Volume7, FOOTPRINT_7PT, AVX2, "avx2")
+VECTOR_VOLUME_KERNEL(rowAVX2Volume27, FOOTPRINT_27PT, AVX2, "avx2")
+VECTOR_VOLUME_KERNEL(rowAVX512Volume7, FOOTPRINT_7PT, AVX512, "avx512f")
+VECTOR_VOLUME_KERNEL(rowAVX512Volume27, FOOTPRINT_27PT, AVX512, "avx512f")
+#endif
+
+// kernels ordered from most to least preferred, "scalar" must be last
+static KernelInfo kernels[] = {
+#ifdef X86_KERNELS
+    {"avx512", "avx512f", rowAVX512Strict, rowAVX512Fast, {rowAVX512Shape5, rowAVX512Shape9, rowAVX512Shape13, rowAVX512Shape25}, 
+        {rowAVX512Volume7, rowAVX512Volume27}},
+    {"avx2", "avx2", rowAVX2Strict, rowAVX2Fast, {rowAVX2Shape5, rowAVX2Shape9, rowAVX2Shape13, rowAVX2Shape25}, 
+        {rowAVX2Volume7, rowAVX2Volume27}},
+    {"sse2", "sse2", rowSSE2Strict, rowSSE2Fast, {rowSSE2Shape5, rowSSE2Shape9, rowSSE2Shape13, rowSSE2Shape25}, 
+        {rowSSE2Volume7, rowSSE2Volume27}},
+#endif
+    {"scalar", NULL, rowScalarStrict, rowScalarFast, {rowScalarShape5, rowScalarShape9, rowScalarShape13, rowScalarShape25}, 
+        {rowScalarVolume7, rowScalarVolume27}}
+};
+#define NUM_KERNELS (sizeof(kernels)/sizeof(KernelInfo))
+
+/**
+ *  @struct _kernelType
+ *  @typedef KernelType
+ *  @brief struct for a stencil kernel type and its FLOP and byte (elem_t and acc_t loads/stores) counts per point
+ */
+typedef struct _kernelType{
+    char * name;
+    int flops;
+    int bytes;
+}KernelType;
+
+// box: 8 adds + 1 div, 9 loads + 1 store
+// separable: 2 adds for the row sum + 2 adds + 1 div, 3 loads + 1 store for the row sum + 3 loads + 1 store
+// (weighted stencils are counted by setStencil2D())
+static KernelType kernel_types[] = {
+    {"box", 9, 10*ELEM_SIZE},
+    {"separable", 5, 4*ELEM_SIZE + 4*ACC_SIZE}
+};
+
+static RowKernel row_kernel = rowScalarStrict;     // selected kernel, scalar box until setKernel2D()
+static int kernel_type = BOX_KERNEL;
+static char kernel_name[160] = "scalar box";
+static char kernel_strip_name[192] = "scalar box";
+static int strip_width = 0;     // columns per strip, 0 = full rows
+static RowKernel3D volume_kernel = rowScalarVolume7;   // selected 3D kernel, scalar 7-pt until setKernel3D()
+static char volume_name[96] = "scalar 7pt";
+static char volume_block_name[160] = "scalar 7pt";
+static int block_rows = 0;      // rows x cols of the 3D blocks, 0 = whole planes
+static int block_cols = 0;
+
+/**
+ *  @brief Checks if the cpu running this process supports a kernel
+ *  @param k (KernelInfo*) kernel to check
+ *  @return [val]: 1 = supported | 0 = not supported
+ */
+static int kernelSupported(KernelInfo * k){
+    if(k->cpu_feature == NULL) return 1;
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if(strcmp(k->cpu_feature, "avx512f") == 0) return __builtin_cpu_supports("avx512f");
+    if(strcmp(k->cpu_feature, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if(strcmp(k->cpu_feature, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    return 0;
+}
+
+/**
+ *  @brief Skips white space and comments (# to the end of the line) in a stencil file
+ *  @param fp (FILE*) stencil file
+ *  @return [val]: next character (left unread) | EOF
+ */
+static int skipComments(FILE * fp){
+    int ch = 0;
+    while((ch = fgetc(fp)) != EOF){
+        if(ch == '#') while((ch = fgetc(fp)) != EOF && ch != '\n');
+        else if(!isspace(ch)) return ungetc(ch, fp);
+    }
+    return EOF;
+}
+
+/**
+ *  @brief Reads n weights of a stencil file
+ *  @param fp (FILE*) stencil file
+ *  @param file (char*) stencil file name (for errors)
+ *  @param key (char*) keyword the weights follow (for errors)
+ *  @param w (acc_t*) weights
+ *  @param n (int) # weights
+ *  @return [arg] w (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+static int readWeights(FILE * fp, char * file, char * key, acc_t * w, int n){
+    double value = 0.0;
+    for(int k = 0; k < n; k++){
+        if(skipComments(fp) == EOF || fscanf(fp, "%lf", &value) != 1){
+            printf("Error [kernel_utils:readWeights()]: '%s' has %d of %d weights after '%s'\n", file, k, n, key);
+            return ERROR;
+        }
+        w[k] = (acc_t)value;
+    }
+    return SUCCESS;
+}
+
+/**
+ *  @brief Reads a stencil file into a full weight table
+ *  @param file (char*) stencil file
+ *  @param table (acc_t*) (2*radius+1)^2 weights (row major)
+ *  @param radius (int*) stencil radius
+ *  @param divisor (acc_t*) divisor (0 = not set)
+ *  @return [arg] table, radius, divisor, stencil.row/col/separable (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+static int readStencil(char * file, acc_t * table, int * radius, acc_t * divisor){
+    FILE * fp = NULL;
+    char key[64];
+    double value = 0.0;
+    int width = 0, has_weights = 0, has_row = 0, has_col = 0, ret = ERROR;
+
+    if((fp = fopen(file, "r")) == NULL){
+        printf("Error [kernel_utils:readStencil()]: unknown stencil '%s' [5pt|9pt|13pt|25pt|<stencil file>]\n", file);
+        return ERROR;
+    }
+    *radius = 0;
+    *divisor = 0;
+    while(skipComments(fp) != EOF && fscanf(fp, "%63s", key) == 1){
+        if(strcmp(key, "radius") == 0){
+            if(fscanf(fp, "%d", radius) != 1 || *radius < 1 || *radius > MAX_STENCIL_RADIUS){
+                printf("Error [kernel_utils:readStencil()]: '%s' radius must be 1..%d\n", file, MAX_STENCIL_RADIUS);
+                goto end;
+            }
+            width = 2*(*radius)+1;
+        }else if(strcmp(key, "divisor") == 0){
+            if(fscanf(fp, "%lf", &value) != 1 || value == 0.0){
+                printf("Error [kernel_utils:readStencil()]: '%s' divisor must be a nonzero number\n", file);
+                goto end;
+            }
+            *divisor = (acc_t)value;
+        }else if(width == 0 && (strcmp(key, "weights") == 0 || strcmp(key, "row") == 0 || strcmp(key, "col") == 0)){
+            printf("Error [kernel_utils:readStencil()]: '%s' needs a radius before '%s'\n", file, key);
+            goto end;
+        }else if(strcmp(key, "weights") == 0){
+            if(readWeights(fp, file, key, table, width*width) == ERROR) goto end;
+            has_weights = 1;
+        }else if(strcmp(key, "row") == 0){
+            if(readWeights(fp, file, key, stencil.row, width) == ERROR) goto end;
+            has_row = 1;
+        }else if(strcmp(key, "col") == 0){
+            if(readWeights(fp, file, key, stencil.col, width) == ERROR) goto end;
+            has_col = 1;
+        }else{
+            printf("Error [kernel_utils:readStencil()]: '%s' has unknown keyword '%s' [radius|weights|row|col|divisor]\n", file, key);
+            goto end;
+        }
+    }
+    // the weights are either a full table or the row and col factors of a separable stencil
+    if(width == 0 || has_weights == (has_row && has_col) || has_row != has_col){
+        printf("Error [kernel_utils:readStencil()]: '%s' needs a radius and either weights or row and col\n", file);
+        goto end;
+    }
+    stencil.separable = has_row;
+    for(int i = 0; has_row && i < width; i++){
+        for(int j = 0; j < width; j++) table[IDX(i,j,width)] = stencil.col[i]*stencil.row[j];
+    }
+    ret = SUCCESS;
+end:
+    fclose(fp);
+    return ret;
+}
+
+int setStencil2D(char * spec){
+    acc_t table[MAX_POINTS], sum = 0;
+    int radius = 0, width = 0, builtin = ERROR;
+
+    if(spec == NULL) spec = "9pt";
+    memset(&stencil, 0, sizeof(StencilShape));
+    memset(table, 0, sizeof(table));
+    // a built in stencil has a weight of 1 on each point of its footprint
+    for(int f = 0; f < NUM_SHAPES; f++) if(strcmp(spec, footprints[f].name) == 0) builtin = f;
+    if(builtin != ERROR){
+        Footprint * fp = &footprints[builtin];
+        radius = fp->radius;
+        width = 2*radius+1;
+        for(int p = 0; p < fp->points; p++) table[IDX(fp->offsets[p][0]+radius, fp->offsets[p][1]+radius, width)] = 1;
+        stencil.separable = fp->separable;
+        for(int k = 0; k < width; k++) stencil.row[k] = stencil.col[k] = 1;
+        snprintf(stencil.name, sizeof(stencil.name), "%s", spec);
+    }else{
+        if(readStencil(spec, table, &radius, &stencil.divisor) == ERROR) return ERROR;
+        width = 2*radius+1;
+    }
+    stencil.radius = radius;
+    // keep the nonzero weights in row major order
+    for(int i = 0; i < width; i++){
+        for(int j = 0; j < width; j++){
+            if(table[IDX(i,j,width)] == 0) continue;
+            stencil.di[stencil.points] = i-radius;
+            stencil.dj[stencil.points] = j-radius;
+            stencil.w[stencil.points++] = table[IDX(i,j,width)];
+            sum += table[IDX(i,j,width)];
+        }
+    }
+    if(stencil.divisor == 0 && sum == 0){
+        printf("Error [kernel_utils:setStencil2D()]: weights of '%s' add up to 0, set a divisor\n", spec);
+        return ERROR;
+    }
+    if(stencil.divisor == 0) stencil.divisor = sum;
+    stencil.recip = 1/stencil.divisor;
+    // find the footprint with unrolled kernels, the offsets of both are row major
+    stencil.shape = SHAPE_GENERIC;
+    for(int f = 0; f < NUM_SHAPES && stencil.shape == SHAPE_GENERIC; f++){
+        int match = (footprints[f].radius == radius && footprints[f].points == stencil.points);
+        for(int p = 0; match && p < stencil.points; p++){
+            match = (footprints[f].offsets[p][0] == stencil.di[p] && footprints[f].offsets[p][1] == stencil.dj[p]);
+        }
+        if(match) stencil.shape = f;
+    }
+    // equal weights over the 9-pt footprint divided by 9 are the original stencil
+    stencil.classic = (stencil.shape == SHAPE_9PT && stencil.divisor == 9);
+    for(int p = 0; stencil.classic && p < stencil.points; p++) stencil.classic = (stencil.w[p] == 1);
+    if(builtin == ERROR){
+        snprintf(stencil.name, sizeof(stencil.name), "%d-pt radius %d", stencil.points, radius);
+    }
+    // box: points multiplies + points-1 adds + 1 div, points loads + 1 store
+    // separable: width multiplies + width-1 adds for the row sum and again for the col sum + 1 div, width+1 loads/stores of each type
+    if(stencil.classic){
+        kernel_types[BOX_KERNEL] = (KernelType){"box", 9, 10*ELEM_SIZE};
+        kernel_types[SEPARABLE_KERNEL] = (KernelType){"separable", 5, 4*ELEM_SIZE + 4*ACC_SIZE};
+    }else{
+        kernel_types[BOX_KERNEL] = (KernelType){"box", 2*stencil.points, (stencil.points+1)*ELEM_SIZE};
+        kernel_types[SEPARABLE_KERNEL] = (KernelType){"separable", 4*width-1, (width+1)*(ELEM_SIZE+ACC_SIZE)};
+    }
+    return SUCCESS;
+}
+
+int stencilRadius2D(void){
+    return stencil.radius;
+}
+
+/**
+ *  @brief Finds the best row kernel isa this cpu supports, or checks the requested one
+ *  @param isa_name (char*) "auto" | "scalar" | "sse2" | "avx2" | "avx512" (NULL = "auto")
+ *  @param caller (char*) function name for error messages
+ *  @return [val]: kernel isa (KernelInfo*) | NULL if unknown or not supported
+ */
+static KernelInfo * findKernel(char * isa_name, char * caller){
+    int is_auto = (isa_name == NULL || strcmp(isa_name, "auto") == 0);
+    for(size_t k = 0; k < NUM_KERNELS; k++){
+        if(!is_auto && strcmp(isa_name, kernels[k].name) != 0) continue;
+        if(!kernelSupported(&kernels[k])){
+            if(is_auto) continue;   // try the next best kernel
+            printf("Error [kernel_utils:%s()]: cpu does not support '%s' kernel\n", caller, isa_name);
+            return NULL;
+        }
+        return &kernels[k];
+    }
+    printf("Error [kernel_utils:%s()]: unknown kernel '%s' [auto|avx512|avx2|sse2|scalar]\n", caller, isa_name);
+    return NULL;
+}
+
+int setKernel2D(char * isa_name, char * type_name, int fast_math){
+    KernelInfo * k = NULL;
+    // find the stencil kernel type
+    if(type_name == NULL || strcmp(type_name, "box") == 0) kernel_type = BOX_KERNEL;
+    else if(strcmp(type_name, "separable") == 0) kernel_type = SEPARABLE_KERNEL;
+    else{
+        printf("Error [kernel_utils:setKernel2D()]: unknown kernel type '%s' [box|separable]\n", type_name);
+        return ERROR;
+    }
+    if(kernel_type == SEPARABLE_KERNEL && !stencil.separable){
+        printf("Error [kernel_utils:setKernel2D()]: stencil '%s' is not separable (give its row and col weights)\n", stencil.name);
+        return ERROR;
+    }
+    kernel_fast = fast_math;
+    // find the best (or requested) row kernel isa
+    if((k = findKernel(isa_name, "setKernel2D")) == NULL) return ERROR;
+    // weighted stencils use the unrolled kernel of their footprint, or the generic scalar kernel
+    if(stencil.classic) row_kernel = (fast_math) ? k->fast : k->strict;
+    else row_kernel = (stencil.shape == SHAPE_GENERIC) ? rowScalarGeneric : k->shaped[stencil.shape];
+    snprintf(kernel_name, sizeof(kernel_name), "%s %s%s%s%s" PRECISION_TAG, 
+        (kernel_type == BOX_KERNEL && stencil.shape != SHAPE_GENERIC) ? k->name : "scalar", 
+        (stencil.classic) ? "" : stencil.name, (stencil.classic) ? "" : " ", kernel_types[kernel_type].name, (fast_math) ? " fast math" : "");
+    return SUCCESS;
+}
+
+int setStencil3D(char * spec){
+    if(spec == NULL) spec = "7pt";
+    for(int v = 0; v < NUM_VOLUMES; v++){
+        if(strcmp(spec, volumes[v].name) != 0) continue;
+        volume = volumes[v];
+        volume_shape = v;
+        return SUCCESS;
+    }
+    printf("Error [kernel_utils:setStencil3D()]: unknown 3D stencil '%s' [7pt|27pt]\n", spec);
+    return ERROR;
+}
+
+int setKernel3D(char * isa_name, int fast_math){
+    KernelInfo * k = NULL;
+    if((k = findKernel(isa_name, "setKernel3D")) == NULL) return ERROR;
+    kernel_fast = fast_math;
+    volume_kernel = k->volume[volume_shape];
+    snprintf(volume_name, sizeof(volume_name), "%s %s%s" PRECISION_TAG, k->name, volume.name, (fast_math) ? " fast math" : "");
+    return SUCCESS;
+}
+
+long cacheSize(int level){
+    char path[256], type[32];
+    long size = ERROR, value = 0;
+    int cache_level = 0;
+    FILE * fp = NULL;
+    // check each cache index for a data or unified cache at this level
+    for(int idx = 0; size == ERROR; idx++){
+        snprintf(path, sizeof(path), "%s/index%d/level", CACHE_INFO_PATH, idx);
+        if((fp = fopen(path, "r")) == NULL) break;      // no more caches
+        if(fscanf(fp, "%d", &cache_level) != 1) cache_level = 0;
+        fclose(fp);
+        snprintf(path, sizeof(path), "%s/index%d/type", CACHE_INFO_PATH, idx);
+        if((fp = fopen(path, "r")) == NULL) continue;
+        if(fscanf(fp, "%31s", type) != 1) type[0] = '\0';
+        fclose(fp);
+        if(cache_level != level || strcmp(type, "Instruction") == 0) continue;
+        snprintf(path, sizeof(path), "%s/index%d/size", CACHE_INFO_PATH, idx);
+        if((fp = fopen(path, "r")) == NULL) continue;
+        // size is in K or M, e.g., 1024K
+        if(fscanf(fp, "%ld%31s", &value, type) >= 1){
+            size = (type[0] == 'M') ? value*1024*1024 : (type[0] == 'K') ? value*1024 : value;
+        }
+        fclose(fp);
+    }
+    return size;
+}
+
+int setStripWidth2D(char * width_arg){
+    long l2_size = 0;
+    if(width_arg == NULL){
+        strip_width = 0;
+    }else if(strcmp(width_arg, "auto") == 0){
+        if((l2_size = cacheSize(2)) == ERROR){
+            printf("Warning [kernel_utils:setStripWidth2D()]: no L2 info in '%s', using %dKB\n", CACHE_INFO_PATH, DEFAULT_L2_SIZE/1024);
+            l2_size = DEFAULT_L2_SIZE;
+        }
+        // strip rows only fill half of L2, leaving room for the other matrix and row sums
+        strip_width = (int)(l2_size/(2*STRIP_ROWS(stencil.radius)*ELEM_SIZE));
+    }else if((strip_width = parseInt(width_arg, 1, SKIP_ARG, "strip_width")) == ERROR){
+        strip_width = 0;
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int setBlock3D(char * shape, int m, int n){
+    long l2_size = 0, budget = 0;
+    block_rows = block_cols = 0;
+    if(shape != NULL && strcmp(shape, "off") == 0) return SUCCESS;
+    if(shape != NULL && strcmp(shape, "auto") != 0){
+        if(parseTileShape(shape, "--block", &block_rows, &block_cols) == SUCCESS) return SUCCESS;
+        block_rows = block_cols = 0;
+        return ERROR;
+    }
+    if((l2_size = cacheSize(2)) == ERROR){
+        printf("Warning [kernel_utils:setBlock3D()]: no L2 info in '%s', using %dKB\n", CACHE_INFO_PATH, DEFAULT_L2_SIZE/1024);
+        l2_size = DEFAULT_L2_SIZE;
+    }
+    // blocks only fill half of L2, budget is the elements of one plane of a block (with its outer rows and cols)
+    budget = l2_size/(2*BLOCK_PLANES*ELEM_SIZE);
+    if(budget/n-2 >= MIN_BLOCK_ROWS){
+        // whole rows keep the row kernels on long runs of columns
+        block_rows = (int)(budget/n-2);
+        block_cols = n-2;
+    }else block_rows = block_cols = MAX((int)sqrt((double)budget)-2, MIN_BLOCK_ROWS);
+    // a block of the whole plane is the same as no blocks
+    if(block_rows >= m-2 && block_cols >= n-2) block_rows = block_cols = 0;
+    return SUCCESS;
+}
+
+char * kernelName3D(void){
+    if(block_rows == 0) return volume_name;
+    snprintf(volume_block_name, sizeof(volume_block_name), "%s (blocks of %dx%d)", volume_name, block_rows, block_cols);
+    return volume_block_name;
+}
+
+int kernelAvailable(char * isa_name){
+    for(size_t k = 0; k < NUM_KERNELS; k++){
+        if(strcmp(isa_name, kernels[k].name) == 0) return kernelSupported(&kernels[k]);
+    }
+    return 0;
+}
+
+void kernelCounts2D(int * flops, int * bytes){
+    *flops = kernel_types[kernel_type].flops;
+    *bytes = kernel_types[kernel_type].bytes;
+}
+
+void kernelCounts3D(int * flops, int * bytes){
+    // points-1 adds + 1 div, points loads + 1 store
+    *flops = volume.points;
+    *bytes = (volume.points+1)*ELEM_SIZE;
+}
+
+char * kernelName2D(void){
+    if(strip_width == 0) return kernel_name;
+    snprintf(kernel_strip_name, sizeof(kernel_strip_name), "%s (strips of %d columns)", kernel_name, strip_width);
+    return kernel_strip_name;
+}
+
+int mallocRowSums(RowSums ** rs, int levels, int n){
+    *rs = NULL;
+    if(kernel_type == BOX_KERNEL) return SUCCESS;   // box kernel has no row sums
+    if(malloc1D((void*)rs, levels*sizeof(RowSums), "rs") == ERROR) return ERROR;
+    for(int t = 0; t < levels; t++){
+        if(malloc1D((void*)&(*rs)[t].sums, MATRIX_COUNT(2*stencil.radius+1, n)*ACC_SIZE, "rs.sums") == ERROR){
+            freeRowSums(*rs, t);
+            *rs = NULL;
+            return ERROR;
+        }
+    }
+    resetRowSums(*rs, levels);
+    return SUCCESS;
+}
+
+void freeRowSums(RowSums * rs, int levels){
+    if(rs == NULL) return;
+    for(int t = 0; t < levels; t++) free(rs[t].sums);
+    free(rs);
+}
+
+void resetRowSums(RowSums * rs, int levels){
+    if(rs == NULL) return;
+    for(int t = 0; t < levels; t++){
+        for(int r = 0; r < MAX_STENCIL_WIDTH; r++) rs[t].row[r] = -1;
+    }
+}
+
+/**
+ *  @brief Computes columns j0..j1-1 of one row of a weighted separable stencil from the weighted row sums of rows i-radius..i+radius
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param i (long) row index
+ *  @param c (long) # columns
+ *  @param j0 (long) first column
+ *  @param j1 (long) last column + 1
+ *  @param rs (RowSums*) rolling row sums of Y for the same columns, only missing rows are summed
+ */
+static void rowSeparableWeighted(elem_t *X, elem_t *Y, long i, long c, long j0, long j1, RowSums * rs){
+    long r = stencil.radius, w = 2*r+1;
+    elem_t *out = &X[IDX(i,0,c)];
+    acc_t s = 0;
+    for(long ri = i-r; ri <= i+r; ri++){
+        acc_t *h = &rs->sums[IDX(ri%w,0,c)];
+        elem_t *y = &Y[IDX(ri,0,c)];
+        if(rs->row[ri%w] == ri) continue;   // already summed for an earlier row
+        for(long j = j0; j < j1; j++){
+            s = 0;
+            for(long d = -r; d <= r; d++) s += stencil.row[d+r]*y[j+d];
+            h[j] = s;
+        }
+        rs->row[ri%w] = ri;
+    }
+    for(long j = j0; j < j1; j++){
+        s = 0;
+        for(long d = -r; d <= r; d++) s += stencil.col[d+r]*rs->sums[IDX((i+d)%w,j,c)];
+        out[j] = WEIGHTED_RESULT(s);
+    }
+}
+
+/**
+ *  @brief Computes columns j0..j1-1 of one row of the 9-pt stencil from the 3-pt row sums of rows i-1..i+1
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param i (long) row index
+ *  @param c (long) # columns
+ *  @param j0 (long) first column
+ *  @param j1 (long) last column + 1
+ *  @param rs (RowSums*) rolling row sums of Y for the same columns, only missing rows are summed
+ */
+static void rowSeparable(elem_t *X, elem_t *Y, long i, long c, long j0, long j1, RowSums * rs){
+    acc_t *up = NULL, *mid = NULL, *dn = NULL;
+    elem_t *out = &X[IDX(i,0,c)];
+    if(!stencil.classic){
+        rowSeparableWeighted(X, Y, i, c, j0, j1, rs);
+        return;
+    }
+    for(long r = i-1; r <= i+1; r++){
+        acc_t *h = &rs->sums[IDX(r%3,0,c)];
+        elem_t *y = &Y[IDX(r,0,c)];
+        if(rs->row[r%3] == r) continue;     // already summed for the last row
+        for(long j = j0; j < j1; j++) h[j] = (acc_t)y[j-1] + y[j] + y[j+1];
+        rs->row[r%3] = r;
+    }
+    up = &rs->sums[IDX((i-1)%3,0,c)]; mid = &rs->sums[IDX(i%3,0,c)]; dn = &rs->sums[IDX((i+1)%3,0,c)];
+    if(kernel_fast) for(long j = j0; j < j1; j++) out[j] = (up[j] + mid[j] + dn[j])*ONE_NINTH;
+    else for(long j = j0; j < j1; j++) out[j] = (up[j] + mid[j] + dn[j])/NINE;
+}
+
+void stencil2D(elem_t *X, elem_t *Y, int ri, int n){
+    row_kernel(X, Y, (long)ri, (long)n, stencil.radius, (long)n-stencil.radius);
+}
+
+void stencilRow2D(elem_t *X, elem_t *Y, int ri, int n, RowSums * rs){
+    if(rs != NULL) rowSeparable(X, Y, (long)ri, (long)n, stencil.radius, (long)n-stencil.radius, rs);
+    else row_kernel(X, Y, (long)ri, (long)n, stencil.radius, (long)n-stencil.radius);
+}
+
+void stencilTile2D(elem_t *X, elem_t *Y, int r0, int r1, int j0, int j1, int n, RowSums * rs){
+    resetRowSums(rs, 1);   // row sums are only valid for this tile's columns
+    for(int i = r0; i <= r1; i++){
+        if(rs != NULL) rowSeparable(X, Y, (long)i, (long)n, (long)j0, (long)j1, rs);
+        else row_kernel(X, Y, (long)i, (long)n, (long)j0, (long)j1);
+    }
+}
+
+/**
+ *  @brief Gets the change of columns j0..j1-1 of row i of X from the same row of Y (the iteration before it)
+ *  @param X (elem_t*) Matrix just written
+ *  @param Y (elem_t*) Matrix X was computed from
+ *  @param i (long) row index
+ *  @param c (long) # columns
+ *  @param j0 (long) first column
+ *  @param j1 (long) last column + 1
+ *  @param norm (int) RESIDUAL_MAX (max |X-Y|) | RESIDUAL_L2 (sum of (X-Y)^2)
+ *  @return [val]: partial residual of the row
+ */
+static acc_t rowResidual(elem_t *X, elem_t *Y, long i, long c, long j0, long j1, int norm){
+    elem_t *x = &X[IDX(i,0,c)], *y = &Y[IDX(i,0,c)];
+    acc_t r = 0, d = 0;
+    if(norm == RESIDUAL_MAX){
+        for(long j = j0; j < j1; j++){
+            d = (acc_t)x[j] - y[j];
+            d = (d < 0) ? -d : d;
+            r = MAX(r, d);
+        }
+    }else for(long j = j0; j < j1; j++){
+        d = (acc_t)x[j] - y[j];
+        r += d*d;
+    }
+    return r;
+}
+
+acc_t residualTile2D(elem_t *X, elem_t *Y, int r0, int r1, int j0, int j1, int n, RowSums * rs, int norm){
+    acc_t r = 0, row = 0;
+    resetRowSums(rs, 1);   // row sums are only valid for this tile's columns
+    for(int i = r0; i <= r1; i++){
+        if(rs != NULL) rowSeparable(X, Y, (long)i, (long)n, (long)j0, (long)j1, rs);
+        else row_kernel(X, Y, (long)i, (long)n, (long)j0, (long)j1);
+        // both rows were just read or written, so the change is taken while they are in L1
+        row = rowResidual(X, Y, (long)i, (long)n, (long)j0, (long)j1, norm);
+        r = RESIDUAL_SUM(r, row, norm);
+    }
+    return r;
+}
+
+acc_t residualSweep2D(elem_t *X, elem_t *Y, int lo, int hi, int n, RowSums * rs, int norm){
+    acc_t r = 0, strip = 0;
+    int rad = stencil.radius;
+    if(strip_width == 0 || strip_width >= n-2*rad) return residualTile2D(X, Y, lo, hi, rad, n-rad, n, rs, norm);
+    // same column strips as a single step timeBlock2D()
+    for(int j0 = rad; j0 < n-rad; j0 += strip_width){
+        strip = residualTile2D(X, Y, lo, hi, j0, MIN(j0+strip_width, n-rad), n, rs, norm);
+        r = RESIDUAL_SUM(r, strip, norm);
+    }
+    return r;
+}
+
+int parseTileShape(char * shape, char * opt_name, int * tile_rows, int * tile_cols){
+    char extra = '\0';
+    if(sscanf(shape, "%dx%d%c", tile_rows, tile_cols, &extra) != 2 || *tile_rows < 1 || *tile_cols < 1){
+        printf("Error [kernel_utils:parseTileShape()]: %s '%s' must be <rows>x<cols>, e.g., 64x1024\n", opt_name, shape);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int mallocActiveTiles(ActiveTiles * at, int lo, int hi, int n, int tile_rows, int tile_cols, int edges){
+    long tiles = 0;
+    memset(at, 0, sizeof(ActiveTiles));
+    // a tile's neighborhood only covers its inputs if the tile is at least as large as the stencil radius
+    if(tile_rows < stencil.radius || tile_cols < stencil.radius){
+        printf("Error [kernel_utils:mallocActiveTiles()]: tiles[%dx%d] must be at least %dx%d for stencil radius %d\n", 
+            tile_rows, tile_cols, stencil.radius, stencil.radius, stencil.radius);
+        return ERROR;
+    }
+    at->lo = lo;
+    at->rows = MAX(0, hi-lo+1);
+    at->n = n;
+    at->tile_rows = tile_rows;
+    at->tile_cols = tile_cols;
+    at->tiles_r = (at->rows+tile_rows-1)/tile_rows;
+    at->tiles_c = (n-2*stencil.radius+tile_cols-1)/tile_cols;
+    at->edges = edges;
+    tiles = MATRIX_COUNT(at->tiles_r, at->tiles_c);
+    if(malloc1D((void*)&at->changed[0], MAX(1, tiles), "at->changed[0]") == ERROR) return ERROR;
+    if(malloc1D((void*)&at->changed[1], MAX(1, tiles), "at->changed[1]") == ERROR){
+        free(at->changed[0]);
+        return ERROR;
+    }
+    // nothing is known before the first iteration
+    memset(at->changed[0], 1, tiles);
+    memset(at->changed[1], 1, tiles);
+    return SUCCESS;
+}
+
+void freeActiveTiles(ActiveTiles * at){
+    free(at->changed[0]);
+    free(at->changed[1]);
+}
+
+int activeEdges2D(elem_t *X, elem_t *Y, int m, int n, int sides){
+    int found = 0, r = stencil.radius;
+    long c = (long)n;
+    if((sides & ACTIVE_TOP) && memcmp(X, Y, MATRIX_SIZE(r, n)) != 0) found |= ACTIVE_TOP;
+    if((sides & ACTIVE_BOTTOM) && memcmp(&X[IDX((long)m-r,0,c)], &Y[IDX((long)m-r,0,c)], MATRIX_SIZE(r, n)) != 0) found |= ACTIVE_BOTTOM;
+    for(long i = 0; i < m; i++){
+        if((sides & ACTIVE_LEFT) && memcmp(&X[IDX(i,0,c)], &Y[IDX(i,0,c)], MATRIX_SIZE(1, r)) != 0) found |= ACTIVE_LEFT;
+        if((sides & ACTIVE_RIGHT) && memcmp(&X[IDX(i,c-r,c)], &Y[IDX(i,c-r,c)], MATRIX_SIZE(1, r)) != 0) found |= ACTIVE_RIGHT;
+    }
+    return found;
+}
+
+acc_t activeTile2D(ActiveTiles * at, elem_t *X, elem_t *Y, int tile, int k, RowSums * rs, int checking, int norm, long * computed){
+    unsigned char * last = at->changed[k%2], * next = at->changed[(k+1)%2];
+    int tr = tile/at->tiles_c, tc = tile%at->tiles_c, active = 0, changed = 0;
+    acc_t r = 0, row = 0;
+    long n = (long)at->n, rad = stencil.radius, end = at->lo+at->rows;
+    long r0 = at->lo + (long)tr*at->tile_rows, r1 = MIN(r0+at->tile_rows, end);
+    long j0 = rad + (long)tc*at->tile_cols, j1 = MIN(j0+at->tile_cols, n-rad);
+
+    // tiles within the stencil radius of rows/cols that change from outside are always computed (a partial
+    // last tile can leave the tile before it within the radius)
+    active = ((at->edges & ACTIVE_TOP) && r0-rad < at->lo) || ((at->edges & ACTIVE_BOTTOM) && r1+rad > end)
+        || ((at->edges & ACTIVE_LEFT) && j0-rad < rad) || ((at->edges & ACTIVE_RIGHT) && j1+rad > n-rad);
+    for(int i = MAX(0, tr-1); !active && i <= MIN(at->tiles_r-1, tr+1); i++){
+        for(int j = MAX(0, tc-1); j <= MIN(at->tiles_c-1, tc+1); j++) active |= last[IDX(i,j,at->tiles_c)];
+    }
+    // no input changed, so the last iteration's values are already in X (it did not change either)
+    if(!active){
+        next[tile] = 0;
+        return 0;
+    }
+    resetRowSums(rs, 1);   // row sums are only valid for this tile's columns
+    for(long i = r0; i < r1; i++){
+        // X still holds the iteration before Y, compare the new row to Y before it is replaced
+        if(rs != NULL) rowSeparable(X, Y, i, n, j0, j1, rs);
+        else row_kernel(X, Y, i, n, j0, j1);
+        if(!changed) changed = memcmp(&X[IDX(i,j0,n)], &Y[IDX(i,j0,n)], (size_t)MATRIX_SIZE(1, j1-j0)) != 0;
+        if(checking){
+            row = rowResidual(X, Y, i, n, j0, j1, norm);
+            r = RESIDUAL_SUM(r, row, norm);
+        }
+    }
+    next[tile] = (unsigned char)changed;
+    computed[0]++;
+    computed[1] += (r1-r0)*(j1-j0);
+    return r;
+}
+
+acc_t activeSweep2D(ActiveTiles * at, elem_t *X, elem_t *Y, int t0, int t1, int k, RowSums * rs, int checking, int norm, long * computed){
+    acc_t r = 0, tile = 0;
+    for(int t = t0; t < t1; t++){
+        tile = activeTile2D(at, X, Y, t, k, rs, checking, norm, computed);
+        r = RESIDUAL_SUM(r, tile, norm);
+    }
+    return r;
+}
+
+void printActiveStats(long computed, long total, int tile_rows, int tile_cols){
+    printf("------------------------------------------------------\n");
+    printf("[Active Tiles] computed %ld of %ld tiles[%dx%d] (%.1f%% skipped)\n", computed, total, tile_rows, tile_cols,
+        (total > 0) ? 100.0*(total-computed)/total : 0.0);
+}
+
+void printKernelStats(long points, double compute_time){
+    KernelType * kt = &kernel_types[kernel_type], * box = &kernel_types[BOX_KERNEL];
+    printf("------------------------------------------------------\n");
+    printf("[Kernel] %s: %d FLOP/pt, %d B/pt (box: %d FLOP/pt, %d B/pt, saved %.0f%% FLOP, %.0f%% B)\n", 
+        kernel_name, kt->flops, kt->bytes, box->flops, box->bytes, 
+        100.0*(box->flops-kt->flops)/box->flops, 100.0*(box->bytes-kt->bytes)/box->bytes);
+    if(compute_time > 0.0){
+        printf("[Kernel Rate] = %g GFLOP/s, %g GB/s (%ld points)\n", 
+            kt->flops*(double)points/compute_time*1e-9, kt->bytes*(double)points/compute_time*1e-9, points);
+    }
+}
+
+void printKernelStats3D(long points, double compute_time){
+    int flops = 0, bytes = 0;
+    kernelCounts3D(&flops, &bytes);
+    printf("------------------------------------------------------\n");
+    printf("[Kernel] %s: %d FLOP/pt, %d B/pt\n", volume_name, flops, bytes);
+    if(compute_time > 0.0){
+        printf("[Kernel Rate] = %g GFLOP/s, %g GB/s (%ld points)\n", 
+            flops*(double)points/compute_time*1e-9, bytes*(double)points/compute_time*1e-9, points);
+    }
+}
+
+void sweep3D(elem_t *X, elem_t *Y, int k0, int k1, int m, int n){
+    long c = (long)n, plane = MATRIX_COUNT(m, n);
+    int tile_r = (block_rows > 0) ? block_rows : m-2, tile_c = (block_cols > 0) ? block_cols : n-2;
+    // each block streams down the planes, planes k-1..k of the block are still in cache from plane k-1
+    for(int i0 = 1; i0 < m-1; i0 += tile_r){
+        for(int j0 = 1; j0 < n-1; j0 += tile_c){
+            int i1 = MIN(i0+tile_r, m-1), j1 = MIN(j0+tile_c, n-1);
+            for(long k = k0; k <= k1; k++){
+                for(long i = i0; i < i1; i++) volume_kernel(X, Y, k*m+i, c, plane, j0, j1);
+            }
+        }
+    }
+}
+
+void timeBlock2D(elem_t *X, elem_t *Y, int lo, int hi, int steps, int shrink_lo, int shrink_hi, int n, RowSums * rs){
+    int first = lo, last = hi, r = stencil.radius;
+    // single steps are swept a column strip at a time so the rows of a strip stay in L2
+    if(steps == 1 && strip_width > 0 && strip_width < n-2*r){
+        for(int j0 = r; j0 < n-r; j0 += strip_width){
+            stencilTile2D(X, Y, lo, hi, j0, MIN(j0+strip_width, n-r), n, rs);
+        }
+        return;
+    }
+    resetRowSums(rs, steps);   // row sums from the last sweep are out of date
+    // front p moves down one row at a time, step t trails the front by t*radius rows so
+    // rows i-radius..i+radius of step t-1 are done and row i of step t-2 is no longer needed
+    for(int p = lo; p <= hi+(steps-1)*r; p++){
+        for(int t = 0; t < steps; t++){
+            int i = p - t*r;
+            first = (shrink_lo) ? lo+t*r : lo;  // trapezoid sides shrink if rows outside are unknown
+            last = (shrink_hi) ? hi-t*r : hi;
+            if(i < first || i > last) continue;
+            if(t % 2 == 0) stencilRow2D(X, Y, i, n, (rs) ? &rs[t] : NULL);      // odd steps write X
+            else stencilRow2D(Y, X, i, n, (rs) ? &rs[t] : NULL);                 // even steps write Y
+        }
+    }
+}
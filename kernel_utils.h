@@ -0,0 +1,409 @@
+/**
+ *  @file kernel_utils.h
+ *  @author Leslie Horace
+ *  @brief Header file for stencil kernels, stencil descriptions, and runtime kernel selection in kernel_utils.c
+ *  @version 1.0
+ *
+ */
+#include "utilities.h"
+
+#ifndef KERNEL_UTILS_
+#define KERNEL_UTILS_
+
+#define ONE_NINTH ((acc_t)(1.0/9.0))    // reciprocal used by fast math kernels
+#define FAST_MATH_ULP 1         // max ULP difference of fast math kernels from strict kernels
+
+#define STRIP_ROWS(r) (2*(r)+2)  // rows of a strip that should fit in L2 (2r+1 input + 1 output)
+#define DEFAULT_L2_SIZE (256*1024)  // L2 size used if sysfs has no cache info
+#define CACHE_INFO_PATH "/sys/devices/system/cpu/cpu0/cache"
+
+#define BOX_KERNEL 0            // weighted sum of the whole footprint for every point
+#define SEPARABLE_KERNEL 1      // weighted row sums reused by 2*radius+1 output rows
+
+#define MAX_STENCIL_RADIUS 4    // largest radius of a stencil file
+#define MAX_STENCIL_WIDTH (2*MAX_STENCIL_RADIUS+1)
+#define NUM_SHAPES 4            // footprints with unrolled kernels: 5-pt, 9-pt, 13-pt, 25-pt
+#define NUM_VOLUMES 2           // 3D stencils: 7-pt, 27-pt
+#define BLOCK_PLANES 4          // planes of a 3D block that should fit in L2 (3 input + 1 output)
+#define MIN_BLOCK_ROWS 8        // fewest rows of a 3D block before its columns are blocked too
+
+#define ACTIVE_TOP 1            // sides of an active tile region whose outside rows/cols can change every iteration
+#define ACTIVE_BOTTOM 2
+#define ACTIVE_LEFT 4
+#define ACTIVE_RIGHT 8
+#define ACTIVE_SIDES (ACTIVE_TOP | ACTIVE_BOTTOM | ACTIVE_LEFT | ACTIVE_RIGHT)
+
+/**
+ *  @typedef RowKernel
+ *  @brief function pointer for a kernel computing columns j0..j1-1 of one row of the selected stencil
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param i (long) row index
+ *  @param c (long) # columns
+ *  @param j0 (long) first column (>= radius)
+ *  @param j1 (long) last column + 1 (<= c-radius)
+ */
+typedef void (*RowKernel)(elem_t *X, elem_t *Y, long i, long c, long j0, long j1);
+
+/**
+ *  @typedef RowKernel3D
+ *  @brief function pointer for a kernel computing columns j0..j1-1 of one row of a plane of the selected 3D stencil,
+ *         a volume is a matrix of planes*rows rows
+ *  @param X (elem_t*) Volume being modified
+ *  @param Y (elem_t*) Volume for computations
+ *  @param i (long) row index (plane*rows + row)
+ *  @param c (long) # columns
+ *  @param plane (long) # elements per plane (rows*c)
+ *  @param j0 (long) first column (>= 1)
+ *  @param j1 (long) last column + 1 (<= c-1)
+ */
+typedef void (*RowKernel3D)(elem_t *X, elem_t *Y, long i, long c, long plane, long j0, long j1);
+
+/**
+ *  @struct _kernelInfo
+ *  @typedef KernelInfo
+ *  @brief struct for a row kernel, its ISA name, its CPU feature name, and its unrolled kernels for each footprint
+ */
+typedef struct _kernelInfo{
+    char * name;
+    char * cpu_feature;
+    RowKernel strict;           // equal weight 9-pt
+    RowKernel fast;
+    RowKernel shaped[NUM_SHAPES];   // weighted 5-pt, 9-pt, 13-pt, 25-pt (strict or fast by the selected kernel)
+    RowKernel3D volume[NUM_VOLUMES];    // 3D 7-pt, 27-pt (strict or fast by the selected kernel)
+}KernelInfo;
+
+/**
+ *  @struct _rowSums
+ *  @typedef RowSums (private)
+ *  @brief rolling buffer of weighted horizontal sums for 2*radius+1 rows, row r is kept in slot r%(2*radius+1)
+ */
+typedef struct _rowSums{
+    acc_t * sums;
+    long row[MAX_STENCIL_WIDTH];
+}RowSums;
+
+/**
+ *  @struct _activeTiles
+ *  @typedef ActiveTiles (shared)
+ *  @brief struct for a grid of tiles over rows lo..lo+rows-1 and the interior columns, a tile is only computed if a tile
+ *         in its 3x3 neighborhood changed in the last iteration, otherwise both matrices already hold its values
+ *         (tiles are at least as large as the stencil radius)
+ */
+typedef struct _activeTiles{
+    unsigned char * changed[2];     // tiles changed by the iteration before even/odd iterations
+    int lo;                 // first row
+    int rows;               // # rows
+    int n;                  // # columns of the matrix (tiles cover columns radius..n-radius-1)
+    int tile_rows;
+    int tile_cols;
+    int tiles_r;            // # tile rows
+    int tiles_c;            // # tile columns
+    int edges;              // ACTIVE_* sides whose tiles are always computed
+}ActiveTiles;
+
+/**
+ *  @brief Selects the stencil computed by every kernel, call before setKernel2D()
+ *  @param spec (char*) "5pt" | "9pt" | "13pt" | "25pt" | stencil file (NULL = "9pt"), a stencil file has
+ *         "radius <r>", then "weights" and (2r+1)^2 weights (row major) or "row" and "col" and 2r+1 weights each
+ *         (separable), and an optional "divisor <d>" (default: sum of the weights), # starts a comment
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int setStencil2D(char * spec);
+
+/**
+ *  @brief Gets the radius of the selected stencil, the outer radius rows and cols of a matrix are its boundary
+ *  @return [val]: stencil radius (1 for the 9-pt stencil)
+ */
+int stencilRadius2D(void);
+
+/**
+ *  @brief Selects the kernels used by stencil2D() and stencilRow2D(), call once before any stencil iterations
+ *  @param isa_name (char*) "auto" | "scalar" | "sse2" | "avx2" | "avx512" (NULL = "auto")
+ *  @param type_name (char*) "box" | "separable" (NULL = "box", separable needs a separable stencil)
+ *  @param fast_math (int) 1 = multiply by 1/divisor (within FAST_MATH_ULP for the 9-pt stencil), 0 = divide by the divisor (exact)
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int setKernel2D(char * isa_name, char * type_name, int fast_math);
+
+/**
+ *  @brief Sets the column strip width for single step sweeps so strips of rows stay in L2, call after setStencil2D()
+ *  @param width_arg (char*) "auto" (from L2 size in sysfs) | # columns | NULL (no strips)
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int setStripWidth2D(char * width_arg);
+
+/**
+ *  @brief Gets the size of a data or unified cpu cache from sysfs
+ *  @param level (int) cache level
+ *  @return [val]: cache size in bytes | ERROR (-1) if not found
+ */
+long cacheSize(int level);
+
+/**
+ *  @brief Gets the name of the selected kernel
+ *  @return [val]: kernel name (char*)
+ */
+char * kernelName2D(void);
+
+/**
+ *  @brief Checks if a row kernel isa is known and supported by this cpu, without printing errors
+ *  @param isa_name (char*) "scalar" | "sse2" | "avx2" | "avx512"
+ *  @return [val]: supported (1) | not supported (0)
+ */
+int kernelAvailable(char * isa_name);
+
+/**
+ *  @brief Gets the FLOP and byte counts per point of the selected kernel (as printed by printKernelStats())
+ *  @param flops (int*) FLOP per point
+ *  @param bytes (int*) bytes loaded and stored per point
+ *  @return [arg] flops (addr), bytes (addr)
+ */
+void kernelCounts2D(int * flops, int * bytes);
+
+/**
+ *  @brief Selects the 3D stencil computed by sweep3D(), the equal weight sum of the footprint divided by its # points,
+ *         call before setKernel3D()
+ *  @param spec (char*) "7pt" (center and 6 face neighbors) | "27pt" (3x3x3 box) (NULL = "7pt")
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int setStencil3D(char * spec);
+
+/**
+ *  @brief Selects the row kernel used by sweep3D(), call once before any stencil iterations
+ *  @param isa_name (char*) "auto" | "scalar" | "sse2" | "avx2" | "avx512" (NULL = "auto")
+ *  @param fast_math (int) 1 = multiply by 1/points, 0 = divide by the # points (exact, bit-identical for every ISA)
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int setKernel3D(char * isa_name, int fast_math);
+
+/**
+ *  @brief Sets the rows x cols of the blocks sweep3D() streams along the planes, so the 3 input planes and
+ *         the output plane of a block stay in L2 while every plane of the block is computed (2.5D blocking)
+ *  @param shape (char*) "auto" (from L2 size in sysfs) | "off" (whole planes) | "<rows>x<cols>" (NULL = "auto")
+ *  @param m (int) # rows of each plane (with the boundary or ghost rows)
+ *  @param n (int) # columns
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int setBlock3D(char * shape, int m, int n);
+
+/**
+ *  @brief Gets the name of the selected 3D kernel and its blocks
+ *  @return [val]: kernel name (char*)
+ */
+char * kernelName3D(void);
+
+/**
+ *  @brief Gets the FLOP and byte counts per point of the selected 3D kernel (as printed by printKernelStats3D())
+ *  @param flops (int*) FLOP per point
+ *  @param bytes (int*) bytes loaded and stored per point
+ *  @return [arg] flops (addr), bytes (addr)
+ */
+void kernelCounts3D(int * flops, int * bytes);
+
+/**
+ *  @brief Allocates row sum buffers for each time step of a sweep, none are needed by the box kernel
+ *  @param rs (RowSums**) row sum buffers to allocate
+ *  @param levels (int) # buffers (time steps per sweep)
+ *  @param n (int) # columns
+ *  @return [arg] rs (addr) | NULL (box kernel); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int mallocRowSums(RowSums ** rs, int levels, int n);
+
+/**
+ *  @brief Deallocates row sum buffers from mallocRowSums()
+ *  @param rs (RowSums*) row sum buffers
+ *  @param levels (int) # buffers
+ */
+void freeRowSums(RowSums * rs, int levels);
+
+/**
+ *  @brief Marks all rows in the row sum buffers as not computed
+ *  @param rs (RowSums*) row sum buffers (NULL = box kernel)
+ *  @param levels (int) # buffers
+ */
+void resetRowSums(RowSums * rs, int levels);
+
+/**
+ *  @brief Performs one row of the selected stencil kernel
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param ri (int) row index
+ *  @param n (int) # columns
+ *  @param rs (RowSums*) row sums of Y for the separable kernel (NULL = box kernel)
+ */
+void stencilRow2D(elem_t *X, elem_t *Y, int ri, int n, RowSums * rs);
+
+/**
+ *  @brief Performs the selected stencil kernel on a tile of rows r0..r1 and columns j0..j1-1
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param r0 (int) first row
+ *  @param r1 (int) last row
+ *  @param j0 (int) first column (>= radius)
+ *  @param j1 (int) last column + 1 (<= n-radius)
+ *  @param n (int) # columns
+ *  @param rs (RowSums*) row sums of Y for the separable kernel (NULL = box kernel)
+ */
+void stencilTile2D(elem_t *X, elem_t *Y, int r0, int r1, int j0, int j1, int n, RowSums * rs);
+
+/**
+ *  @brief Performs the selected stencil kernel on a tile like stencilTile2D() and gets the change of each row from Y right after it is computed
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations (the iteration before X)
+ *  @param r0 (int) first row
+ *  @param r1 (int) last row
+ *  @param j0 (int) first column (>= radius)
+ *  @param j1 (int) last column + 1 (<= n-radius)
+ *  @param n (int) # columns
+ *  @param rs (RowSums*) row sums of Y for the separable kernel (NULL = box kernel)
+ *  @param norm (int) RESIDUAL_MAX | RESIDUAL_L2
+ *  @return [val]: partial residual of the tile (max |X-Y| or sum of (X-Y)^2), combine tiles with RESIDUAL_SUM()
+ */
+acc_t residualTile2D(elem_t *X, elem_t *Y, int r0, int r1, int j0, int j1, int n, RowSums * rs, int norm);
+
+/**
+ *  @brief Performs a single step sweep of rows lo..hi like timeBlock2D() (in column strips if set) and gets its residual
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations (the iteration before X)
+ *  @param lo (int) first row of the sweep
+ *  @param hi (int) last row of the sweep
+ *  @param n (int) # columns
+ *  @param rs (RowSums*) row sums of Y for the separable kernel (NULL = box kernel)
+ *  @param norm (int) RESIDUAL_MAX | RESIDUAL_L2
+ *  @return [val]: partial residual of rows lo..hi, combine sweeps with RESIDUAL_SUM()
+ */
+acc_t residualSweep2D(elem_t *X, elem_t *Y, int lo, int hi, int n, RowSums * rs, int norm);
+
+/**
+ *  @brief Parses a "<rows>x<cols>" tile shape
+ *  @param shape (char*) tile shape, e.g., "64x1024"
+ *  @param opt_name (char*) option the shape belongs to (for errors)
+ *  @param tile_rows (int*) rows per tile
+ *  @param tile_cols (int*) columns per tile
+ *  @return [arg] tile_rows (addr), tile_cols (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int parseTileShape(char * shape, char * opt_name, int * tile_rows, int * tile_cols);
+
+/**
+ *  @brief Allocates the changed tile maps for rows lo..hi, every tile is computed in the first iteration,
+ *         tiles smaller than the stencil radius are an error
+ *  @param at (ActiveTiles*) active tiles to allocate
+ *  @param lo (int) first row
+ *  @param hi (int) last row
+ *  @param n (int) # columns of the matrix
+ *  @param tile_rows (int) rows per tile
+ *  @param tile_cols (int) columns per tile
+ *  @param edges (int) ACTIVE_* sides whose outside rows/cols can change (ghost rows/cols or alternating boundaries)
+ *  @return [arg] at (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int mallocActiveTiles(ActiveTiles * at, int lo, int hi, int n, int tile_rows, int tile_cols, int edges);
+
+/**
+ *  @brief Deallocates the changed tile maps from mallocActiveTiles()
+ *  @param at (ActiveTiles*) active tiles
+ */
+void freeActiveTiles(ActiveTiles * at);
+
+/**
+ *  @brief Finds the boundary sides (radius rows/cols wide) of an m x n matrix that differ between X and Y, tiles next to them see
+ *         different values every iteration (the stencil alternates between the two boundaries)
+ *  @param X (elem_t*) Matrix
+ *  @param Y (elem_t*) Other matrix
+ *  @param m (int) # rows
+ *  @param n (int) # columns
+ *  @param sides (int) ACTIVE_* sides to compare
+ *  @return [val]: ACTIVE_* sides of sides that differ
+ */
+int activeEdges2D(elem_t *X, elem_t *Y, int m, int n, int sides);
+
+/**
+ *  @brief Computes one tile if a tile in its 3x3 neighborhood changed in the last iteration and records if it changed
+ *  @param at (ActiveTiles*) active tiles
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param tile (int) tile index (row major)
+ *  @param k (int) # iterations done since mallocActiveTiles() (selects the changed map)
+ *  @param rs (RowSums*) row sums of Y for the separable kernel (NULL = box kernel)
+ *  @param checking (int) 1 = get the residual of the tile (0 if skipped)
+ *  @param norm (int) RESIDUAL_MAX | RESIDUAL_L2
+ *  @param computed (long*) # tiles and # points computed, incremented if the tile is computed
+ *  @return [arg] computed (addr); [val]: partial residual of the tile (0 if not checking)
+ */
+acc_t activeTile2D(ActiveTiles * at, elem_t *X, elem_t *Y, int tile, int k, RowSums * rs, int checking, int norm, long * computed);
+
+/**
+ *  @brief Computes the active tiles t0..t1-1 of one iteration with activeTile2D()
+ *  @param at (ActiveTiles*) active tiles
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param t0 (int) first tile
+ *  @param t1 (int) last tile + 1
+ *  @param k (int) # iterations done since mallocActiveTiles()
+ *  @param rs (RowSums*) row sums of Y for the separable kernel (NULL = box kernel)
+ *  @param checking (int) 1 = get the residual of the tiles
+ *  @param norm (int) RESIDUAL_MAX | RESIDUAL_L2
+ *  @param computed (long*) # tiles and # points computed
+ *  @return [arg] computed (addr); [val]: partial residual of the tiles (0 if not checking)
+ */
+acc_t activeSweep2D(ActiveTiles * at, elem_t *X, elem_t *Y, int t0, int t1, int k, RowSums * rs, int checking, int norm, long * computed);
+
+/**
+ *  @brief Prints how many tiles were computed and skipped
+ *  @param computed (long) # tiles computed (all iterations)
+ *  @param total (long) # tiles of every iteration
+ *  @param tile_rows (int) rows per tile
+ *  @param tile_cols (int) columns per tile
+ */
+void printActiveStats(long computed, long total, int tile_rows, int tile_cols);
+
+/**
+ *  @brief prints the FLOP and byte counts per point of the selected kernel and the achieved rates
+ *  @param points (long) # points computed (all iterations)
+ *  @param compute_time (double) computation time
+ */
+void printKernelStats(long points, double compute_time);
+
+/**
+ *  @brief prints the FLOP and byte counts per point of the selected 3D kernel and the achieved rates
+ *  @param points (long) # points computed (all iterations)
+ *  @param compute_time (double) computation time
+ */
+void printKernelStats3D(long points, double compute_time);
+
+/**
+ *  @brief Performs one iteration of the selected 3D stencil on planes k0..k1, rows 1..m-2, and cols 1..n-2 of each,
+ *         one block (setBlock3D()) at a time with every plane of a block computed before the next block
+ *  @param X (elem_t*) Volume being modified
+ *  @param Y (elem_t*) Volume for computations
+ *  @param k0 (int) first plane
+ *  @param k1 (int) last plane
+ *  @param m (int) # rows of each plane
+ *  @param n (int) # columns
+ */
+void sweep3D(elem_t *X, elem_t *Y, int k0, int k1, int m, int n);
+
+/**
+ *  @brief Algorithm to perform one row of the selected stencil
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param ri (int) row index
+ *  @param n (int) # columns
+ */
+void stencil2D(elem_t *X, elem_t *Y, int ri, int n);
+
+/**
+ *  @brief Performs a temporally blocked (wavefront) sweep of several stencil iterations on rows lo..hi
+ *  @param X (elem_t*) Matrix written on odd steps (1, 3, ...)
+ *  @param Y (elem_t*) Matrix written on even steps (2, 4, ...)
+ *  @param lo (int) first row of the sweep
+ *  @param hi (int) last row of the sweep
+ *  @param steps (int) # iterations to advance
+ *  @param shrink_lo (int) 1 if lo moves down radius rows per step (no valid rows above lo)
+ *  @param shrink_hi (int) 1 if hi moves up radius rows per step (no valid rows below hi)
+ *  @param n (int) # columns
+ *  @param rs (RowSums*) row sum buffer for each step (NULL = box kernel)
+ */
+void timeBlock2D(elem_t *X, elem_t *Y, int lo, int hi, int steps, int shrink_lo, int shrink_hi, int n, RowSums * rs);
+
+#endif /* KERNEL_UTILS_ */
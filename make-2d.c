@@ -19,7 +19,7 @@ int main(int argn, char **argv) {
     if((m = parseInt(argv[1], 3, SKIP_ARG, "num_rows")) == ERROR) goto end;
     if((n = parseInt(argv[2], 3, SKIP_ARG, "num_cols")) == ERROR) goto end;
 
-    double *A;
+    elem_t *A;
     char * initfile = argv[3];
     
     // allocate space for A
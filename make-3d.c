@@ -0,0 +1,35 @@
+/**
+ *  @file make-3d.c
+ *  @author Leslie Horace
+ *  @brief Main program to create a volume and write it to a file
+ *  @version 1.0
+ *
+ */
+#include "utilities.h"
+
+int main(int argn, char **argv) {
+    int ret = EXIT_FAILURE;
+    // check if all args were entered
+    if (argn != 5) {
+        printf("Usage: %s <num_planes> <num_rows> <num_cols> <output data file>\n", argv[0]);
+        goto end;
+    }
+    int p = 0, m = 0, n = 0;
+    // check if <num_planes> <num_rows> <num_cols> are valid
+    if((p = parseInt(argv[1], 3, SKIP_ARG, "num_planes")) == ERROR) goto end;
+    if((m = parseInt(argv[2], 3, SKIP_ARG, "num_rows")) == ERROR) goto end;
+    if((n = parseInt(argv[3], 3, SKIP_ARG, "num_cols")) == ERROR) goto end;
+
+    elem_t *A;
+    char * initfile = argv[4];
+
+    // allocate space for A
+    if(malloc1D((void*)&A, VOLUME_SIZE(p,m,n), "A") == ERROR) goto end;
+    init3D(A, p, m, n);    // initialize A
+    if(write3D(A, p, m, n, initfile) == ERROR) goto end;    // write A to output file
+    printVolumeFileInfo(initfile, p, m, n);     // display info and deallocate mem
+    ret = EXIT_SUCCESS;
+    free(A);
+end:
+    exit(ret);
+}
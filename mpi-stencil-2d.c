@@ -7,78 +7,383 @@
  */
 
 #include "mpi_utils.h"
-#include "utilities.h"
+#include "kernel_utils.h"
+#include "writer_utils.h"
 
-int mpiStencilLoop(ProcessData * pd, MatrixPointer * mp, StencilData * sd, ConditionBools cb, char * stacked_file){
-    int ret = 0, next_a = 0, next_b = 0, a1 = 0, a2 = 0, b1 = 0, b2 = 0, w_count = 0, m_count = MATRIX_COUNT(pd->rows, pd->cols);
-    double start_compute = 0.0, end_compute = 0.0;
-    FILE * fp = NULL;
+/**
+ *  @brief Computes a thread's share of the rows in the team's current sweep
+ *  @param tm (TeamMember*) team member
+ */
+void teamShare(TeamMember * tm){
+    ThreadTeam * team = tm->team;
+    ActiveTiles * at = team->at;
+    int rows = team->hi-team->lo+1, p = team->num_threads;
+    double start = 0.0, end = 0.0;
+    tm->residual = 0;
+    if(at != NULL) rows = at->tiles_r;      // threads share tile rows of the whole block
+    if(BLOCK_SIZE(tm->id, p, rows) < 1) return;    // more threads than rows
+    GET_TIME(start);
+    if(at != NULL){
+        tm->residual = activeSweep2D(at, team->X, team->Y, BLOCK_LOW(tm->id, p, rows)*at->tiles_c, (BLOCK_HIGH(tm->id, p, rows)+1)*at->tiles_c,
+            team->k, tm->rs, team->checking, team->norm, tm->active_computed);
+    }else if(team->checking) tm->residual = residualSweep2D(team->X, team->Y, team->lo+BLOCK_LOW(tm->id, p, rows), team->lo+BLOCK_HIGH(tm->id, p, rows), team->width, tm->rs, team->norm);
+    else timeBlock2D(team->X, team->Y, team->lo+BLOCK_LOW(tm->id, p, rows), team->lo+BLOCK_HIGH(tm->id, p, rows), 1, 0, 0, team->width, tm->rs);
+    GET_TIME(end);
+    tm->thread_compute += end-start;
+}
 
-    // open all stacked file for writing and write initial matrix state
-    if(cb.is_root && cb.write_state){
-        if ((fp = fopen(stacked_file, "wb")) == NULL){
-            printf("Error: cannot open/write to '%s'\n", stacked_file);
-            goto stop_all; 
+/**
+ *  @brief Thread function for members 1..num_threads-1, computes a share of each sweep until the team stops
+ *  @param tm_ptr (void*) team member
+ */
+void * teamWorker(void * tm_ptr){
+    TeamMember * tm = tm_ptr;
+    int ret = 0;
+    for(;;){
+        // wait for the main thread to set the next sweep
+        ret = pthread_barrier_wait(&tm->team->barrier);
+        if(handleBarrier(ret, "Error [mpi-stencil-2d:teamWorker:pthread_barrier_wait()]") == ERROR || tm->team->stop) break;
+        teamShare(tm);
+        ret = pthread_barrier_wait(&tm->team->barrier);
+        if(handleBarrier(ret, "Error [mpi-stencil-2d:teamWorker:pthread_barrier_wait()]") == ERROR) break;
+    }
+    return NULL;
+}
+
+/**
+ *  @brief Computes one iteration of rows lo..hi with every thread of the team, called by the main thread
+ *  @param team (ThreadTeam*) thread team from startTeam()
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param lo (int) first row
+ *  @param hi (int) last row
+ *  @return [val]: residual of rows lo..hi combined from every thread's share (0 if team->checking is 0)
+ */
+acc_t teamSweep2D(ThreadTeam * team, elem_t *X, elem_t *Y, int lo, int hi){
+    acc_t residual = 0;
+    if(hi < lo) return 0;
+    team->X = X; team->Y = Y; team->lo = lo; team->hi = hi;
+    if(team->num_threads > 1) handleBarrier(pthread_barrier_wait(&team->barrier), "Error [mpi-stencil-2d:teamSweep2D:pthread_barrier_wait()]");
+    teamShare(&team->members[0]);
+    if(team->num_threads > 1) handleBarrier(pthread_barrier_wait(&team->barrier), "Error [mpi-stencil-2d:teamSweep2D:pthread_barrier_wait()]");
+    for(int t = 0; t < team->num_threads; t++) residual = RESIDUAL_SUM(residual, team->members[t].residual, team->norm);
+    return residual;
+}
+
+/**
+ *  @brief Allocates the team members and starts num_threads-1 worker threads
+ *  @param team (ThreadTeam*) thread team to start
+ *  @param num_threads (int) # threads including the main thread
+ *  @param width (int) # columns of the block
+ *  @return [arg] team (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int startTeam(ThreadTeam * team, int num_threads, int width){
+    int ret = 0, t = 0;
+
+    memset(team, 0, sizeof(ThreadTeam));
+    team->num_threads = num_threads;
+    team->width = width;
+    if(malloc1D((void*)&team->members, num_threads*sizeof(TeamMember), "team->members") == ERROR) return ERROR;
+    if(malloc1D((void*)&team->threads, num_threads*sizeof(pthread_t), "team->threads") == ERROR) goto end_members;
+    // allocate each thread's row sums (separable kernel only)
+    for(t = 0; t < num_threads; t++){
+        team->members[t] = (TeamMember){.team=team, .rs=NULL, .thread_compute=0.0, .residual=0, .active_computed={0, 0}, .id=t};
+        if(mallocRowSums(&team->members[t].rs, 1, width) == ERROR) goto end_sums;
+    }
+    ret = pthread_barrier_init(&team->barrier, NULL, num_threads);
+    if(handleBarrier(ret, "Error [mpi-stencil-2d:startTeam:pthread_barrier_init()]") == ERROR) goto end_sums;
+    for(int w = 1; w < num_threads; w++){
+        // created threads wait at the barrier for good, the caller aborts
+        if((ret = pthread_create(&team->threads[w], NULL, teamWorker, (void*)&team->members[w])) != SUCCESS){
+            errno = ret;
+            perror("Error [mpi-stencil-2d:startTeam:pthread_create()]");
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+
+end_sums:
+    while(t-- > 0) freeRowSums(team->members[t].rs, 1);
+    free(team->threads);
+end_members:
+    free(team->members);
+    return ERROR;
+}
+
+/**
+ *  @brief Stops and joins the worker threads and deallocates the team
+ *  @param team (ThreadTeam*) thread team from startTeam()
+ */
+void stopTeam(ThreadTeam * team){
+    int ret = 0;
+    if(team->num_threads > 1){
+        team->stop = 1;
+        handleBarrier(pthread_barrier_wait(&team->barrier), "Error [mpi-stencil-2d:stopTeam:pthread_barrier_wait()]");
+        for(int w = 1; w < team->num_threads; w++){
+            if((ret = pthread_join(team->threads[w], NULL)) != SUCCESS){
+                errno = ret;
+                perror("Error [mpi-stencil-2d:stopTeam:pthread_join()]");
+            }
         }
-        w_count = fwrite(mp->A, DOUBLE_SIZE, m_count, fp);
-        if(handleIOError(fp, w_count, m_count, "[mpiStencilLoop:fwrite()]") == ERROR) goto stop_write;
+    }
+    pthread_barrier_destroy(&team->barrier);
+    for(int t = 0; t < team->num_threads; t++) freeRowSums(team->members[t].rs, 1);
+    free(team->threads);
+    free(team->members);
+}
+
+/**
+ *  @brief Starts or finishes a checkpoint of the latest iteration (mp->C) as the root decides, so time based checkpoints
+ *         start on the same iteration everywhere, row blocks write their own rows with MPI-IO, otherwise the root
+ *         copies (or gathers) the matrix for its checkpoint writer thread
+ *  @param pd (ProcessData*) local struct for process data
+ *  @param mp (MatrixPointer*) local struct for the matrices
+ *  @param cb (ConditionBools) local struct for conditions
+ *  @param gd (GridData*) local struct for grid data (NULL = row blocks)
+ *  @param bc (BandCheckpoint*) row block checkpoint (NULL = root checkpoint writer)
+ *  @param cp (Checkpointer*) root checkpoint writer (used by the root if bc is NULL)
+ *  @param iteration (int) iteration in mp->C
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int mpiCheckpoint(ProcessData * pd, MatrixPointer * mp, ConditionBools cb, GridData * gd, BandCheckpoint * bc, Checkpointer * cp, int iteration){
+    int action = CKPT_NONE, ret = 0;
+
+    if(cb.is_root) action = (bc != NULL) ? claimBandCheckpoint(bc, iteration, pd->rank) : claimCheckpoint(cp, iteration);
+    if(cb.is_parallel){
+        ret = MPI_Bcast(&action, 1, MPI_INT, pd->num_p-1, MPI_COMM_WORLD);
+        if(handleMpiError(pd->rank, ret, "[mpi-stencil-2d:mpiCheckpoint:MPI_Bcast()]") != MPI_SUCCESS) return ERROR;
+    }
+    // a checkpoint the root could not write stops every process
+    if(action == ERROR) return ERROR;
+    if(bc != NULL){
+        if(action == CKPT_START) return startBandCheckpoint(bc, mp->C, pd, iteration);
+        if(action == CKPT_FINISH) return finishBandCheckpoint(bc, pd);
+        return SUCCESS;
+    }
+    if(action != CKPT_START) return SUCCESS;
+    if(gd != NULL && gatherGrid(mp->C, mp->A, pd, gd) == ERROR) return ERROR;
+    if(cb.is_root){
+        memcpy(cp->X, (gd != NULL) ? mp->A : mp->C, MATRIX_SIZE(pd->rows, pd->cols));
+        queueCheckpoint(cp);
+    }
+    return SUCCESS;
+}
+
+int mpiStencilLoop(ProcessData * pd, MatrixPointer * mp, StencilData * sd, ConditionBools cb, GridData * gd, SharedData * sm, ThreadTeam * team, FileData * fd){
+    int ret = 0, next_a = 0, next_b = 0, a1 = 0, a2 = 0, b1 = 0, b2 = 0, r = stencilRadius2D(), count = pd->halo*pd->cols;
+    double start_compute = 0.0, end_compute = 0.0, start_comm = 0.0;
+    StackedWriter sw;
+    FrameData fr;
+    BandCheckpoint bc;
+    Checkpointer cp;
+    RowSums * rs = team->members[0].rs;     // main thread computes the first and last rows alone with --overlap
+    // row blocks write their own rows of each iteration, otherwise the root writes (compresses or samples) what it gathers
+    int frames = cb.write_state && cb.is_parallel && gd == NULL && fd->compress_workers == 0 && !IS_SAMPLED(fd->sample);
+    int writing = cb.is_root && cb.write_state && !frames, recorded = 0;
+    // row blocks write their own rows of a checkpoint, otherwise the root writes the whole matrix
+    int banded = fd->ckpt.file != NULL && cb.is_parallel && gd == NULL, checkpointing = fd->ckpt.file != NULL && (banded || cb.is_root);
+    MPI_Request halo[2*HALO_REQUESTS];   // persistent halo requests bound to mp->B (first half) and mp->C (second half)
+    // with --overlap the halo rows sent (and the rows between them for thin blocks) are computed before the interior rows
+    int last = pd->block_size-1-r, top = MIN(2*r-1, last), bottom = MAX(pd->block_size-2*r, top+1), overlap = cb.overlap && cb.is_parallel, k = 0;
+    acc_t residual = 0, edges = 0, total = 0;
+
+    for(int r = 0; r < 2*HALO_REQUESTS; r++) halo[r] = MPI_REQUEST_NULL;
+    // the blocks swap every iteration, so each block gets its own requests
+    if(overlap){
+        if(initHaloRequests(pd, mp->B, cb.is_root, &halo[0]) == ERROR) goto stop_sums;
+        if(initHaloRequests(pd, mp->C, cb.is_root, &halo[HALO_REQUESTS]) == ERROR) goto stop_sums;
+    }
+    // open all stacked file for writing and write initial matrix state
+    if(frames){
+        if((ret = openFrames2D(&fr, mp->B, mp->C, pd, sd->iterations, fd->allfile)) == ERROR) goto stop_sums;
+        if((ret = writeFrame2D(&fr, 0, 0, pd->rank)) == ERROR) goto stop_write;
+    }else if(writing){
+        if((ret = openStackedWriter(&sw, fd, pd->rows, pd->cols, sd->iterations)) == ERROR) goto stop_sums;
+        if((ret = pushSnapshot(&sw, mp->A)) == ERROR) goto stop_write;
     }
     if(cb.is_root && cb.print_state) print2D(mp->A, pd->rows, pd->cols);
+    // mp->B is the block read from infile, it has the boundary rows
+    if(banded && (ret = openBandCheckpoint(&bc, &fd->ckpt, mp->B, pd, sd->start)) == ERROR) goto stop_write;
+    else if(checkpointing && !banded && (ret = openCheckpointer(&cp, &fd->ckpt, pd->rows, pd->cols, sd->start)) == ERROR) goto stop_write;
 
+    team->norm = sd->res.norm;
     // perform stencil iterations
-    for(int k = 0; k < sd->iterations; k++){
-        start_compute=MPI_Wtime();
-        for(int i= 1; i < pd->block_size-1; i++){
-            stencil2D(mp->B, mp->C, i, pd->cols); 
+    for(k = 0; k < sd->iterations; k++){
+        // mp->B was written to the stacked file 2 iterations ago (or as the initial matrix)
+        if(frames && (ret = waitFrame2D(&fr, k%2, pd->rank)) == ERROR) goto stop_ckpt;
+        // the thread team gets the residual of this block's rows on checked iterations
+        team->checking = residualDue(&sd->res, sd->start+k+1);
+        team->k = k;
+        if(overlap){
+            MPI_Request * req = &halo[(k%2)*HALO_REQUESTS];
+            start_compute=MPI_Wtime();
+            // compute the first and last halo rows, send them while the interior rows are computed
+            if(team->checking){
+                edges = residualSweep2D(mp->B, mp->C, r, top, pd->cols, rs, sd->res.norm);
+                residual = (bottom <= last) ? residualSweep2D(mp->B, mp->C, bottom, last, pd->cols, rs, sd->res.norm) : 0;
+                edges = RESIDUAL_SUM(edges, residual, sd->res.norm);
+            }else{
+                timeBlock2D(mp->B, mp->C, r, top, 1, 0, 0, pd->cols, rs);
+                if(bottom <= last) timeBlock2D(mp->B, mp->C, bottom, last, 1, 0, 0, pd->cols, rs);
+            }
+            ret = MPI_Startall(HALO_REQUESTS, req);
+            if(handleMpiError(pd->rank, ret, "[mpi-stencil-2d:mpiStencilLoop:MPI_Startall()]") == ERROR) goto stop_ckpt;
+            residual = teamSweep2D(team, mp->B, mp->C, top+1, bottom-1);
+            residual = RESIDUAL_SUM(residual, edges, sd->res.norm);
+            end_compute=MPI_Wtime()-start_compute;
+            sd->compute_time+=end_compute;
+            start_comm=MPI_Wtime();
+            ret = MPI_Waitall(HALO_REQUESTS, req, MPI_STATUSES_IGNORE);
+            if(handleMpiError(pd->rank, ret, "[mpi-stencil-2d:mpiStencilLoop:MPI_Waitall()]") == ERROR) goto stop_ckpt;
+        }else{
+            start_compute=MPI_Wtime();
+            residual = teamSweep2D(team, mp->B, mp->C, r, last);
+            // sum compute time for each process
+            end_compute=MPI_Wtime()-start_compute;
+            sd->compute_time+=end_compute;
+            start_comm=MPI_Wtime();
         }
-        // sum compute time for each process
-        end_compute=MPI_Wtime()-start_compute;
-        sd->compute_time+=end_compute;
 
-        if(cb.is_parallel){
+        // iterations skipped by --every are not gathered for the writer
+        recorded = cb.write_state && !frames && IS_RECORDED(fd->sample, k+1);
+        if(cb.is_parallel && gd != NULL){
+            // exchange ghost cols, rows, and corners with the 8 surrounding tiles
+            if(exchangeGrid(mp->B, pd, gd) == ERROR) goto stop_ckpt;
+            if((cb.print_state || recorded) && gatherGrid(mp->B, mp->A, pd, gd) == ERROR) goto stop_ckpt;
+        }else if(cb.is_parallel){
+            // ghost rows of blocks on this node are read in place once the processes above and below are done
+            if(sm != NULL){
+                if(exchangeShared2D(mp->B, pd, sm) == ERROR) goto stop_ckpt;
+            }else if(!overlap){
                 // set up border exchange locations
-                a1 = (IS_EVEN(pd->rank)) ? BOT_SOURCE(pd->block_size, pd->cols) : TOP_SOURCE(pd->cols);
-                a2 = (IS_EVEN(pd->rank)) ? BOT_TARGET(pd->block_size, pd->cols) : TOP_TARGET;
-                b1 = (IS_EVEN(pd->rank)) ? TOP_SOURCE(pd->cols) : BOT_SOURCE(pd->block_size, pd->cols); 
-                b2 = (IS_EVEN(pd->rank)) ? TOP_TARGET : BOT_TARGET(pd->block_size, pd->cols);
+                a1 = (IS_EVEN(pd->rank)) ? BOT_SOURCE(pd->block_size, pd->halo, pd->cols) : TOP_SOURCE(pd->halo, pd->cols);
+                a2 = (IS_EVEN(pd->rank)) ? BOT_TARGET(pd->block_size, pd->halo, pd->cols) : TOP_TARGET;
+                b1 = (IS_EVEN(pd->rank)) ? TOP_SOURCE(pd->halo, pd->cols) : BOT_SOURCE(pd->block_size, pd->halo, pd->cols); 
+                b2 = (IS_EVEN(pd->rank)) ? TOP_TARGET : BOT_TARGET(pd->block_size, pd->halo, pd->cols);
                 // find up neighboring ranks for each process
                 next_a = (IS_EVEN(pd->rank) ? RIGHT(pd->rank, cb.is_root) : LEFT(pd->rank));
                 next_b = (IS_EVEN(pd->rank) ? LEFT(pd->rank) : RIGHT(pd->rank, cb.is_root));
 
                 // even exchange right, odd exchange left
-                ret = MPI_Sendrecv(&mp->B[a1], pd->cols, MPI_DOUBLE, next_a, 99, 
-                                    &mp->B[a2], pd->cols, MPI_DOUBLE, next_a, 99, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                if(handleMpiError(pd->rank, ret, "[MPI_Sendrecv(a)]") == ERROR) goto stop_write;
+                ret = MPI_Sendrecv(&mp->B[a1], count, MPI_ELEM, next_a, 99, 
+                                    &mp->B[a2], count, MPI_ELEM, next_a, 99, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                if(handleMpiError(pd->rank, ret, "[MPI_Sendrecv(a)]") == ERROR) goto stop_ckpt;
 
                 // even exchange left, odd exchange right
-                ret = MPI_Sendrecv(&mp->B[b1], pd->cols, MPI_DOUBLE, next_b, 99, 
-                                    &mp->B[b2], pd->cols, MPI_DOUBLE, next_b, 99, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                if(handleMpiError(pd->rank, ret, "[MPI_Sendrecv(b)]") == ERROR) goto stop_write; 
-
-            // gather if printing state or writing to all stacked file
-            if(cb.print_state || cb.write_state){
-                ret = MPI_Gatherv(&mp->B[pd->cols], MATRIX_COUNT(pd->block_size-2,pd->cols), MPI_DOUBLE, 
-                                    &mp->A[pd->cols], mp->sub_count, mp->sub_offset, MPI_DOUBLE, pd->num_p-1, MPI_COMM_WORLD);
-                if(handleMpiError(pd->rank, ret, "[mpi-stencil-2d:mpiStencilLoop:MPI_Gatherv()]") == ERROR) goto stop_write;
+                ret = MPI_Sendrecv(&mp->B[b1], count, MPI_ELEM, next_b, 99, 
+                                    &mp->B[b2], count, MPI_ELEM, next_b, 99, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                if(handleMpiError(pd->rank, ret, "[MPI_Sendrecv(b)]") == ERROR) goto stop_ckpt; 
             }
-        }
 
-        // write each matrix state to all file
-        if(cb.is_root && cb.write_state){
-            w_count = fwrite((cb.is_parallel) ? (mp->A) : (mp->B), DOUBLE_SIZE, m_count, fp);
-            if(handleIOError(fp, w_count, m_count, "[mpiStencilLoop:fwrite()]") == ERROR) goto stop_write;
+            // gather if printing state or recording it for the writer, the stacked file is written while the next iterations are computed
+            if(frames && (ret = writeFrame2D(&fr, k%2, k+1, pd->rank)) == ERROR) goto stop_ckpt;
+            if(cb.print_state || recorded){
+                ret = MPI_Gatherv(&mp->B[TOP_SOURCE(pd->halo, pd->cols)], MATRIX_COUNT(pd->block_size-2*pd->halo,pd->cols), MPI_ELEM, 
+                                    &mp->A[TOP_SOURCE(pd->halo, pd->cols)], mp->sub_count, mp->sub_offset, MPI_ELEM, pd->num_p-1, MPI_COMM_WORLD);
+                if(handleMpiError(pd->rank, ret, "[mpi-stencil-2d:mpiStencilLoop:MPI_Gatherv()]") == ERROR) goto stop_ckpt;
+            }
         }
 
+        // queue each matrix state for the writer thread (skipped ones are only counted)
+        if(writing && (ret = pushSnapshot(&sw, (cb.is_parallel) ? (mp->A) : (mp->B))) == ERROR) goto stop_ckpt;
+
+        sd->comm_time+=MPI_Wtime()-start_comm;
+
         // print each matrix state if debug level = 2
         if(cb.is_root && cb.print_state) print2D(mp->A, pd->rows, pd->cols);
         // swap sub matrix pointers
         swap2D(&mp->B, &mp->C); 
+
+        // every process gets the same residual, so all of them stop on the same iteration (mp->C is the outfile)
+        if(team->checking){
+            start_comm=MPI_Wtime();
+            ret = MPI_Allreduce(&residual, &total, 1, MPI_ACC, (sd->res.norm == RESIDUAL_MAX) ? MPI_MAX : MPI_SUM, MPI_COMM_WORLD);
+            if(handleMpiError(pd->rank, ret, "[mpi-stencil-2d:mpiStencilLoop:MPI_Allreduce()]") == ERROR) goto stop_ckpt;
+            sd->comm_time+=MPI_Wtime()-start_comm;
+            if(residualConverged(&sd->res, residualNorm(&sd->res, total), sd->start+k+1)) break;
+        }
+
+        // checkpoint the latest iteration while the next ones are computed, the last iteration is the outfile
+        start_comm=MPI_Wtime();
+        if(fd->ckpt.file != NULL && k+1 < sd->iterations && (ret = mpiCheckpoint(pd, mp, cb, gd, (banded) ? &bc : NULL, &cp, sd->start+k+1)) == ERROR) goto stop_ckpt;
+        sd->comm_time+=MPI_Wtime()-start_comm;
     } 
 
     ret = SUCCESS;
 
+stop_ckpt:
+    // wait for a pending checkpoint to be written
+    if(checkpointing){
+        int ckpt_ret = (banded) ? closeBandCheckpoint(&bc, pd) : closeCheckpointer(&cp);
+        if(ckpt_ret == ERROR) ret = ERROR;
+        else if(ret == SUCCESS && cb.is_root && cb.debug_on){
+            printCheckpointInfo(fd->ckpt.file, (banded) ? bc.saved : cp.saved, (banded) ? bc.saved_iteration : cp.saved_iteration);
+        }
+    }
 stop_write:
-    if(cb.is_root && cb.write_state) fclose(fp);
+    // drop the frames of iterations skipped after convergence
+    if(frames && ret == SUCCESS && sd->res.converged && truncateFrames2D(&fr, pd, k+1) == ERROR) ret = ERROR;
+    if(frames && closeFrames2D(&fr, pd->rank) == ERROR) ret = ERROR;
+    if(writing && closeWriter(&sw) == ERROR) ret = ERROR;
+stop_sums:
+    freeHaloRequests(halo, 2*HALO_REQUESTS);
+    return ret;
+}
+
+int mpiDeepHaloLoop(ProcessData * pd, MatrixPointer * mp, StencilData * sd, ConditionBools cb, ThreadTeam * team){
+    int ret = ERROR, steps = 0, depth = sd->time_block, r = stencilRadius2D(), n = pd->block_size-2*r, ghost = depth*r;
+    int is_first = EQUAL(pd->rank, 0), is_last = cb.is_root;
+    long view = MATRIX_COUNT(ghost-r, pd->cols);
+    double start_compute = 0.0, start_comm = 0.0;
+    elem_t * deep_b = NULL, * deep_c = NULL, * x = NULL, * y = NULL;
+    RowSums * rs = NULL;
+    // sweep the owned rows plus every ghost row that can be recomputed, the global boundary (radius rows) stays fixed
+    int lo = (is_first) ? ghost : r, hi = (is_last) ? ghost+n-1 : 2*ghost+n-1-r;
+
+    if(mallocRowSums(&rs, depth, pd->cols) == ERROR) goto stop_all;
+    // blocks with depth*radius ghost rows on each side, the radius ghost row blocks sit at row ghost-radius
+    if(malloc1D((void*)&deep_b, MATRIX_SIZE(n+2*ghost, pd->cols), "deep_b") == ERROR) goto stop_sums;
+    if(malloc1D((void*)&deep_c, MATRIX_SIZE(n+2*ghost, pd->cols), "deep_c") == ERROR) goto stop_b;
+    init2D(deep_b, n+2*ghost, pd->cols);
+    init2D(deep_c, n+2*ghost, pd->cols);
+    memcpy(&deep_b[view], mp->B, MATRIX_SIZE(pd->block_size, pd->cols));
+    memcpy(&deep_c[view], mp->C, MATRIX_SIZE(pd->block_size, pd->cols));
+    x = deep_b; y = deep_c;
+    // boundary cols of the ghost rows are never computed, fill the ghost rows of mp->B from the neighbors' input rows
+    if(cb.is_parallel && exchangeDeepHalo2D(x, pd, ghost, is_last) == ERROR) goto stop_c;
+
+    // perform stencil iterations depth at a time, each sweep shrinks into the ghost rows by radius rows per step
+    for(int k = 0; k < sd->iterations; k += steps){
+        steps = MIN(depth, sd->iterations-k);
+        // ghost rows of mp->C are still the initial matrix before the first sweep
+        start_comm = MPI_Wtime();
+        if(k > 0 && cb.is_parallel && exchangeDeepHalo2D(y, pd, ghost, is_last) == ERROR) goto stop_c;
+        sd->comm_time += MPI_Wtime()-start_comm;
+        start_compute = MPI_Wtime();
+        if(team->num_threads > 1){
+            // a thread team sweeps each step of the trapezoid, threads would need triangle fills for a wavefront
+            for(int t = 0; t < steps; t++){
+                if(t % 2 == 0) teamSweep2D(team, x, y, lo + t*r*!is_first, hi - t*r*!is_last);
+                else teamSweep2D(team, y, x, lo + t*r*!is_first, hi - t*r*!is_last);
+            }
+        }else timeBlock2D(x, y, lo, hi, steps, !is_first, !is_last, pd->cols, rs);
+        sd->compute_time += MPI_Wtime()-start_compute;
+        // latest state is in x after an odd # of steps, keep it in y like the single step loop
+        if(steps % 2) swap2D(&x, &y);
+    }
+
+    // copy the blocks back and swap as the single step loop would have after every iteration
+    memcpy(mp->B, &deep_b[view], MATRIX_SIZE(pd->block_size, pd->cols));
+    memcpy(mp->C, &deep_c[view], MATRIX_SIZE(pd->block_size, pd->cols));
+    if(sd->iterations % 2) swap2D(&mp->B, &mp->C);
+    ret = SUCCESS;
+
+stop_c:
+    free(deep_c);
+stop_b:
+    free(deep_b);
+stop_sums:
+    freeRowSums(rs, depth);
 stop_all:
     return ret;
 }
@@ -86,38 +391,114 @@ stop_all:
 
 int main (int argc, char **argv) {
     double start_overall = 0, end_overall = 0, max_compute = 0;
-    int ret = EXIT_FAILURE;
+    // per level times: process compute, process communication, slowest thread compute, -(fastest thread compute)
+    double level_times[4] = {0.0, 0.0, 0.0, 0.0}, max_times[4] = {0.0, 0.0, 0.0, 0.0};
+    // active tiles computed, tiles of every iteration, and points computed, summed over all processes
+    long tile_counts[3] = {0, 0, 0}, sum_counts[3] = {0, 0, 0};
+    int ret = EXIT_FAILURE, loop_ret = ERROR, provided = MPI_THREAD_SINGLE;
     // local process structs 
-    ProcessData pd = {0, 0, 0, 0, 0};
-    StencilData sd = {0, 0, 0.0};
+    ProcessData pd = {0, 0, 0, 0, 0, 0, 0};
+    StencilData sd = {.iterations=0, .start=0, .debug_level=0, .time_block=1, .compute_time=0.0, .comm_time=0.0};
     MatrixPointer mp = {NULL, NULL, NULL, NULL, NULL};
 
-    MPI_Init(&argc, &argv);
+    ThreadTeam team;
+
+    // only the main thread of each process calls MPI, its thread team just computes
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &pd.rank);
     MPI_Comm_size(MPI_COMM_WORLD, &pd.num_p);
     // set up error handler to return error msgs before aborting
     MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
     
+    // remove optional args on every process so only positional args remain
+    char * simd = NULL, * kernel = NULL, * strip = NULL, * stencil = NULL;
+    int radius = 1, deep = 0;
+    int fast_math = popOption(&argc, argv, "--fast-math", NULL);
+    int use_mmap = popOption(&argc, argv, "--mmap", NULL);
+    int use_mpi_io = popOption(&argc, argv, "--mpi-io", NULL);
+    int overlap = popOption(&argc, argv, "--overlap", NULL);
+    int shared_mem = popOption(&argc, argv, "--shared-mem", NULL);
+    elem_t * final = NULL, * band = NULL;
+    char * grid = NULL;
+    GridData gd, * gdp = NULL;
+    SharedData sm, * smp = NULL;
+    if(popOption(&argc, argv, "--grid", &grid) == ERROR) terminate(ret);
+    if((sd.time_block = parseIntOption(&argc, argv, "--halo-depth", 1, SKIP_ARG, 1)) == ERROR) terminate(ret);
+    int num_threads = parseIntOption(&argc, argv, "--threads", 1, SKIP_ARG, 1);
+    if(num_threads == ERROR) terminate(ret);
+    int compress_workers = parseIntOption(&argc, argv, "--compress", 1, SKIP_ARG, 0);
+    if(compress_workers == ERROR) terminate(ret);
+    SampleData sample;
+    if(parseSampleOptions(&argc, argv, &sample) == ERROR) terminate(ret);
+    CheckpointData ckpt;
+    if(parseCheckpointOptions(&argc, argv, &ckpt) == ERROR) terminate(ret);
+    if(parseResidualOptions(&argc, argv, &sd.res) == ERROR) terminate(ret);
+    if(popOption(&argc, argv, "--simd", &simd) == ERROR) terminate(ret);
+    if(popOption(&argc, argv, "--kernel", &kernel) == ERROR) terminate(ret);
+    if(popOption(&argc, argv, "--strip", &strip) == ERROR) terminate(ret);
+    if(popOption(&argc, argv, "--stencil", &stencil) == ERROR) terminate(ret);
+    char * active = NULL;
+    int tile_rows = 0, tile_cols = 0;
+    ActiveTiles at = {.changed={NULL, NULL}};
+    if(popOption(&argc, argv, "--active-tiles", &active) == ERROR) terminate(ret);
+    if(active != NULL && parseTileShape(active, "--active-tiles", &tile_rows, &tile_cols) == ERROR) terminate(ret);
 
-    FileData fd = {argv[2], argv[3], (argc == 6) ? argv[5] : NULL};
-    ConditionBools cb = {EQUAL(pd.num_p-1, pd.rank), NOT_EQUAL(pd.num_p, 1), NOT_EQUAL(fd.allfile, NULL), 0, 0};
+    // a restart reads the checkpoint as infile on every process and writes no stacked file
+    FileData fd = {.initfile=(ckpt.restart) ? ckpt.file : argv[2], .finalfile=argv[3], .allfile=(argc == 6 && !ckpt.restart) ? argv[5] : NULL,
+        .write_buffers=WRITER_BUFFERS, .direct_io=0, .compress_workers=compress_workers, .sample=sample, .ckpt=ckpt};
+    ConditionBools cb = {EQUAL(pd.num_p-1, pd.rank), NOT_EQUAL(pd.num_p, 1), NOT_EQUAL(fd.allfile, NULL), 0, 0, overlap};
 
     if(cb.is_root) start_overall = MPI_Wtime();
 
     if(argc < 5 || argc > 6){
         if(!pd.rank){
-            printf("Usage: mpirun -np <num processes> %s <num_iterations> <infile> <outfile> <debug_level[0-2]> <all_stacked_file(optional)>\n", argv[0]);
+            printf("Usage: mpirun -np <num processes> %s <num_iterations> <infile> <outfile> <debug_level[0-2]> <all_stacked_file(optional)> [--simd <auto|avx512|avx2|sse2|scalar>] [--kernel <box|separable>] [--fast-math] [--strip <auto|cols>] [--mmap] [--mpi-io] [--overlap] [--grid <auto|RxC>] [--halo-depth <k>] [--threads <n>] [--shared-mem] [--compress <workers>] [--every <n>] [--roi <rows>x<cols>+<row>+<col>] [--pool <k>] [--checkpoint <file>] [--checkpoint-every <n>] [--checkpoint-secs <t>] [--restart] [--tolerance <tol>] [--residual <max|l2>] [--check-every <k>] [--active-tiles <rows>x<cols>] [--stencil <5pt|9pt|13pt|25pt|file>]\n", argv[0]);
             FLUSH_OUTPUT
         } terminate(ret);
     }
+    // each process reads the stencil, then selects the best row kernel for its own cpu (or the requested one)
+    if(setStencil2D(stencil) == ERROR) abortComm(pd.rank, NULL, ret);
+    if(setKernel2D(simd, kernel, fast_math) == ERROR) abortComm(pd.rank, NULL, ret);
+    // blocks and tiles have radius ghost rows (and cols) on each side
+    radius = pd.halo = stencilRadius2D();
+    if(setStripWidth2D(strip) == ERROR) abortComm(pd.rank, NULL, ret);
+    if(ckpt.restart && argc == 6 && cb.is_root) printf("Warning [mpi-stencil-2d:main]: all stacked file '%s' ignored with --restart\n", argv[5]);
+    if(num_threads > 1 && provided < MPI_THREAD_FUNNELED){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --threads ignored, MPI library does not support MPI_THREAD_FUNNELED\n");
+        num_threads = 1;
+    }
+    if(use_mpi_io && use_mmap){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --mmap ignored with --mpi-io\n");
+        use_mmap = 0;
+    }
+    // tiles are read, written, and exchanged by the root scatter/gather and blocking halo exchange
+    if(grid != NULL && cb.is_parallel && (use_mpi_io || overlap)){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --mpi-io and --overlap ignored with --grid\n");
+        use_mpi_io = cb.overlap = 0;
+    }
 
+    // every process reads its own row block with MPI-IO, nothing is scattered
+    if(use_mpi_io && mpiReadBlock2D(&mp.B, &pd, fd.initfile) == ERROR) abortComm(pd.rank, NULL, ret);
     
     // parse initial data and read in matrix
     if(cb.is_root){
         if((sd.debug_level = parseInt(argv[4],0,2,"debug_level[0-2]")) == ERROR) abortComm(pd.rank, NULL, ret);
         if((sd.iterations = parseInt(argv[1],1,SKIP_ARG,"num_iterations")) == ERROR) abortComm(pd.rank, NULL, ret);
-        if(read2D(&mp.A, &pd.rows, &pd.cols, fd.initfile) == ERROR) abortComm(pd.rank, NULL, ret);
-        if(pd.num_p > pd.rows-2) abortComm(pd.rank, "[mpi-stencil-2d:main]: <num_processes> > block_size", ret);
+        // only the iterations after the checkpoint are computed (shared with the other processes below)
+        if(fd.ckpt.restart && setRestart(&sd, &fd) == ERROR) abortComm(pd.rank, NULL, ret);
+        // with MPI-IO the root only needs the whole matrix to gather each iteration for printing, compressing, or sampling
+        if(use_mpi_io){
+            if(cb.is_parallel && (sd.debug_level == 2 || (cb.write_state && (fd.compress_workers > 0 || IS_SAMPLED(fd.sample))))
+                && read2D(&mp.A, &pd.rows, &pd.cols, fd.initfile) == ERROR) abortComm(pd.rank, NULL, ret);
+        // map infile copy-on-write as the scatter source, or read it in
+        }else if(use_mmap){
+            if(mapRead2D(&mp.A, &pd.rows, &pd.cols, fd.initfile) == ERROR) abortComm(pd.rank, NULL, ret);
+        }else if(read2D(&mp.A, &pd.rows, &pd.cols, fd.initfile) == ERROR) abortComm(pd.rank, NULL, ret);
+        if(MIN(pd.rows, pd.cols) <= 2*radius) abortComm(pd.rank, "[mpi-stencil-2d:main]: matrix has no interior for the stencil radius", ret);
+        if(grid == NULL && pd.num_p > pd.rows-2*radius) abortComm(pd.rank, "[mpi-stencil-2d:main]: <num_processes> > block_size", ret);
+        // each block sends radius of its own rows
+        if(grid == NULL && cb.is_parallel && (pd.rows-2*radius)/pd.num_p < radius) abortComm(pd.rank, "[mpi-stencil-2d:main]: rows per block < stencil radius", ret);
+        if(cb.write_state && setSampleOrder(&fd.sample, pd.rows, pd.cols) == ERROR) abortComm(pd.rank, NULL, ret);
         if(malloc1D((void*)&mp.sub_offset, pd.num_p*INT_SIZE, "sub_offset") == ERROR)  goto clean_a;
         if(malloc1D((void*)&mp.sub_count, pd.num_p*INT_SIZE, "sub_count") == ERROR) goto clean_b;
     }
@@ -126,44 +507,187 @@ int main (int argc, char **argv) {
     if(cb.is_parallel){
         // set all data for scattering and share static data with all p
         setScatterData(&pd, &mp, &sd, cb);
-        // malloc sub matrix for stencil loop
-        if(malloc1D((void*)&mp.B, MATRIX_SIZE(pd.block_size,pd.cols),"mp.B") == ERROR) goto clean_c;
-        // scatter parent matrix to all sub matrices
-        ret = MPI_Scatterv(mp.A, mp.sub_count, mp.sub_offset, MPI_DOUBLE, mp.B, MATRIX_COUNT(pd.block_size, pd.cols), MPI_DOUBLE, pd.num_p-1, MPI_COMM_WORLD);
-        if(handleMpiError(pd.rank, ret, "mpi-stencil-2d:main:MPI_Scatterv()") == ERROR) goto clean_all;
+        if(grid != NULL){
+            // split into a 2D grid of tiles, each with radius ghost rows/cols on every side, a grid that does not fit stops every process
+            if(setGridData(&pd, &gd, grid, pd.rows, pd.cols, 1, cb.is_root) == ERROR) terminate(ret);
+            gdp = &gd;
+            if(malloc1D((void*)&mp.B, MATRIX_SIZE(pd.block_size,gd.size[1]),"mp.B") == ERROR) goto clean_c;
+            if(scatterGrid(mp.A, mp.B, &pd, &gd) == ERROR) goto clean_all;
+        }else if(!use_mpi_io){
+            // malloc sub matrix for stencil loop
+            if(malloc1D((void*)&mp.B, MATRIX_SIZE(pd.block_size,pd.cols),"mp.B") == ERROR) goto clean_c;
+            // scatter parent matrix to all sub matrices
+            ret = MPI_Scatterv(mp.A, mp.sub_count, mp.sub_offset, MPI_ELEM, mp.B, MATRIX_COUNT(pd.block_size, pd.cols), MPI_ELEM, pd.num_p-1, MPI_COMM_WORLD);
+            if(handleMpiError(pd.rank, ret, "mpi-stencil-2d:main:MPI_Scatterv()") == ERROR) goto clean_all;
+        }
+    }else if(use_mpi_io){
+        mp.A = mp.B;    // the only block is the whole matrix
     }else {
         pd.block_size = pd.rows;  
         mp.B = mp.A;
     }
+    band = mp.B;    // block read from infile, its first and last ghost rows are never written
+    // every process needs the root's (checked) region to agree on what is gathered for the stacked file
+    if(cb.write_state) setSampleOrder(&fd.sample, pd.rows, pd.cols);
     
     // check is debugging is turned on
     cb.print_state = EQUAL(sd.debug_level, 2);
     cb.debug_on = NOT_EQUAL(sd.debug_level, 0);
 
+    // deep ghost rows only work for row blocks whose iterations are not gathered, checkpointed, or checked
+    if(sd.time_block > 1 && (gdp != NULL || cb.print_state || cb.write_state || fd.ckpt.file != NULL || sd.res.tolerance > 0.0)){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --halo-depth ignored with --grid, debug_level 2, an all stacked file, --checkpoint, or --tolerance\n");
+        sd.time_block = 1;
+    }
+    // each block sends depth*radius of its own rows, so no block can be thinner than that
+    if(sd.time_block*radius > (pd.rows-2*radius)/pd.num_p){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --halo-depth %d reduced to %d (rows per block)\n", sd.time_block, ((pd.rows-2*radius)/pd.num_p)/radius);
+        sd.time_block = ((pd.rows-2*radius)/pd.num_p)/radius;
+    }
+    deep = (sd.time_block > 1);
+    if(deep && cb.overlap){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --overlap ignored with --halo-depth\n");
+        cb.overlap = 0;
+    }
+    // skipped tiles are only known one iteration at a time, and the tiles next to ghost rows are always computed
+    if(active != NULL && sd.time_block > 1){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --halo-depth ignored with --active-tiles\n");
+        sd.time_block = 1;
+    }
+    if(active != NULL && cb.overlap){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --overlap ignored with --active-tiles\n");
+        cb.overlap = 0;
+    }
+    if(active != NULL && strip != NULL){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --strip ignored with --active-tiles\n");
+        setStripWidth2D(strip = NULL);
+    }
+    // shared windows hold the radius ghost row blocks of the row decomposition
+    if(shared_mem && (gdp != NULL || deep)){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --shared-mem ignored with --grid or --halo-depth\n");
+        shared_mem = 0;
+    }
+    if(shared_mem && cb.overlap){
+        if(cb.is_root) printf("Warning [mpi-stencil-2d:main]: --overlap ignored with --shared-mem\n");
+        cb.overlap = 0;
+    }
+
     // copy and initialize matrix for stencil computations 
-    if(malloc1D((void*)&mp.C, MATRIX_SIZE(pd.block_size,pd.cols),"mp.C") == ERROR) goto clean_d;
-    init2D(mp.C, pd.block_size, pd.cols); 
+    if(gdp != NULL){
+        if(malloc1D((void*)&mp.C, MATRIX_SIZE(pd.block_size,gd.size[1]),"mp.C") == ERROR) goto clean_d;
+        initGrid2D(mp.C, &pd, &gd);
+    }else{
+        if(malloc1D((void*)&mp.C, MATRIX_SIZE(pd.block_size,pd.cols),"mp.C") == ERROR) goto clean_d;
+        init2D(mp.C, pd.block_size, pd.cols); 
+    }
+    // a restart continues from the checkpoint read into mp.B (with its ghost rows and cols)
+    if(fd.ckpt.restart) memcpy(mp.C, mp.B, MATRIX_SIZE(pd.block_size, (gdp != NULL) ? gd.size[1] : pd.cols));
+    if(shared_mem && cb.is_parallel){
+        // move both blocks into this node's shared windows, where ghost rows are the rows of the blocks next to them
+        elem_t * blocks[2] = {mp.B, mp.C};
+        if(setSharedData(&pd, &sm, &mp.B, &mp.C, cb.is_root) == ERROR) abortComm(pd.rank, NULL, ret);
+        smp = &sm;
+        free(blocks[0]);
+        free(blocks[1]);
+        band = mp.B;
+    }
+
+    // start each process's thread team, the main thread is member 0
+    if(startTeam(&team, num_threads, (gdp != NULL) ? gd.size[1] : pd.cols) == ERROR) abortComm(pd.rank, NULL, ret);
+    // each process tracks the tiles of its own block, tiles next to ghost rows/cols (or boundaries that differ) are always computed
+    if(active != NULL){
+        int width = (gdp != NULL) ? gd.size[1] : pd.cols, ghosts = 0;
+        if(gdp != NULL){
+            ghosts = ((gd.prev[0] != MPI_PROC_NULL) ? ACTIVE_TOP : 0) | ((gd.next[0] != MPI_PROC_NULL) ? ACTIVE_BOTTOM : 0)
+                | ((gd.prev[1] != MPI_PROC_NULL) ? ACTIVE_LEFT : 0) | ((gd.next[1] != MPI_PROC_NULL) ? ACTIVE_RIGHT : 0);
+        }else if(cb.is_parallel) ghosts = ((pd.rank > 0) ? ACTIVE_TOP : 0) | ((!cb.is_root) ? ACTIVE_BOTTOM : 0);
+        ghosts |= activeEdges2D(mp.B, mp.C, pd.block_size, width, ACTIVE_SIDES & ~ghosts);
+        if(mallocActiveTiles(&at, radius, pd.block_size-1-radius, width, tile_rows, tile_cols, ghosts) == ERROR) abortComm(pd.rank, NULL, ret);
+        team.at = &at;
+    }
 
     // perform stencil iterations 
-    if(cb.is_root && cb.debug_on) printf("Running %d stencil iterations with %d processes...\n", sd.iterations, pd.num_p);
-    if(mpiStencilLoop(&pd, &mp, &sd, cb, fd.allfile) == ERROR) goto clean_all;
+    if(cb.is_root && cb.debug_on && fd.ckpt.restart) printf("Restarting from iteration %d of '%s'\n", sd.start, fd.ckpt.file);
+    if(cb.is_root && cb.debug_on) printf("Running %d stencil iterations with %d processes%s%s and %s kernel...\n", 
+        sd.iterations, pd.num_p, (num_threads > 1) ? " of multiple threads" : "", (gdp != NULL) ? " in a 2D grid" : "", kernelName2D());
+    if(cb.is_root && cb.debug_on && num_threads > 1) printf("Threads per process: %d\n", num_threads);
+    if(cb.is_root && cb.debug_on && gdp != NULL) printf("Process grid: %dx%d tiles\n", gd.dims[0], gd.dims[1]);
+    if(cb.is_root && cb.debug_on && smp != NULL){
+        int node_size = 0;
+        MPI_Comm_size(sm.node_comm, &node_size);
+        printf("Shared memory halos: %d processes on the root's node\n", node_size);
+    }
+    if(cb.is_root && cb.debug_on && deep) printf("Halo depth: %d rows (exchanged every %d iterations)\n", sd.time_block*radius, sd.time_block);
+    if(deep) loop_ret = mpiDeepHaloLoop(&pd, &mp, &sd, cb, &team);
+    else loop_ret = mpiStencilLoop(&pd, &mp, &sd, cb, gdp, smp, &team, &fd);
+    level_times[0] = sd.compute_time;
+    level_times[1] = sd.comm_time;
+    level_times[2] = level_times[3] = -team.members[0].thread_compute;
+    for(int t = 0; t < team.num_threads; t++){
+        level_times[2] = MAX(level_times[2], team.members[t].thread_compute);
+        level_times[3] = MAX(level_times[3], -team.members[t].thread_compute);
+        tile_counts[0] += team.members[t].active_computed[0];
+        tile_counts[2] += team.members[t].active_computed[1];
+    }
+    tile_counts[1] = MATRIX_COUNT(at.tiles_r, at.tiles_c);
+    stopTeam(&team);
+    freeActiveTiles(&at);
+    if(loop_ret == ERROR) goto clean_all;
+    // the iterations after convergence were never computed
+    if(sd.res.converged) sd.iterations = sd.res.converged-sd.start;
 
+    if(use_mpi_io){
+        // first and last blocks write the boundary rows from infile (as gathered), every process writes its own rows
+        if(cb.is_parallel && pd.rank == 0) memcpy(mp.C, band, MATRIX_SIZE(radius, pd.cols));
+        if(cb.is_parallel && pd.rank == pd.num_p-1) memcpy(&mp.C[BOT_TARGET((long)pd.block_size, radius, (long)pd.cols)], &band[BOT_TARGET((long)pd.block_size, radius, (long)pd.cols)], MATRIX_SIZE(radius, pd.cols));
+        if(mpiWriteBlock2D(mp.C, &pd, fd.finalfile) == ERROR) abortComm(pd.rank, NULL, ret);
+    }
+    // final matrix is gathered into parent matrix, or in place into the mapped outfile
+    final = mp.A;
+    if(cb.is_root && use_mmap){
+        if(mapCreate2D(&final, pd.rows, pd.cols, fd.finalfile) == ERROR) abortComm(pd.rank, NULL, ret);
+        if(cb.is_parallel){
+            memcpy(final, mp.A, MATRIX_SIZE(radius, pd.cols));   // first and last radius rows are not gathered
+            memcpy(&final[BOT_TARGET((long)pd.rows, radius, (long)pd.cols)], &mp.A[BOT_TARGET((long)pd.rows, radius, (long)pd.cols)], MATRIX_SIZE(radius, pd.cols));
+        }else memcpy(final, mp.C, MATRIX_SIZE(pd.rows, pd.cols));
+    }
     if(cb.is_parallel){
         // gather all sub matrices into parent matrix
-        ret = MPI_Gatherv(&mp.C[pd.cols], MATRIX_COUNT(pd.block_size-2,pd.cols), MPI_DOUBLE, &mp.A[pd.cols], mp.sub_count, mp.sub_offset, MPI_DOUBLE, pd.num_p-1, MPI_COMM_WORLD);
-        if(handleMpiError(pd.rank, ret, "mpi-stencil-2d:main:MPI_Gatherv()") == ERROR) goto clean_all;
+        if(gdp != NULL){
+            if(gatherGrid(mp.C, final, &pd, &gd) == ERROR) goto clean_all;
+        }else if(!use_mpi_io){
+            ret = MPI_Gatherv(&mp.C[TOP_SOURCE(radius, pd.cols)], MATRIX_COUNT(pd.block_size-2*radius,pd.cols), MPI_ELEM, &final[TOP_SOURCE(radius, pd.cols)], mp.sub_count, mp.sub_offset, MPI_ELEM, pd.num_p-1, MPI_COMM_WORLD);
+            if(handleMpiError(pd.rank, ret, "mpi-stencil-2d:main:MPI_Gatherv()") == ERROR) goto clean_all;
+        }
         // process with the maximum compute is the overall compute time
-        ret = MPI_Reduce(&sd.compute_time, &max_compute, 1, MPI_DOUBLE, MPI_MAX, pd.num_p-1, MPI_COMM_WORLD);
+        ret = MPI_Reduce(level_times, max_times, 4, MPI_DOUBLE, MPI_MAX, pd.num_p-1, MPI_COMM_WORLD);
         if(handleMpiError(pd.rank, ret, "mpi-stencil-2d:mpiStencilLoop:MPI_Reduce()") == ERROR) abortComm(pd.rank, NULL, ret);
-    }else  max_compute = sd.compute_time;  
+        if(active != NULL){
+            ret = MPI_Reduce(tile_counts, sum_counts, 3, MPI_LONG, MPI_SUM, pd.num_p-1, MPI_COMM_WORLD);
+            if(handleMpiError(pd.rank, ret, "mpi-stencil-2d:main:MPI_Reduce(tile_counts)") == ERROR) abortComm(pd.rank, NULL, ret);
+        }
+    }else{
+        memcpy(max_times, level_times, sizeof(level_times));
+        memcpy(sum_counts, tile_counts, sizeof(tile_counts));
+    }
+    max_compute = max_times[0];
 
     // write out the final matrix state, file info, and timing analysis
     if(cb.is_root){
-        if(write2D((pd.num_p == 1) ? (mp.C) : (mp.A), pd.rows, pd.cols, fd.finalfile) == ERROR) goto clean_all;
+        if(use_mmap){
+            if(unmap2D(final, pd.rows, pd.cols) == ERROR) goto clean_all;
+            final = NULL;
+        }else if(!use_mpi_io && write2D((pd.num_p == 1) ? (mp.C) : (mp.A), pd.rows, pd.cols, fd.finalfile) == ERROR) goto clean_all;
         end_overall = MPI_Wtime();
         if(cb.debug_on){
             printDataFileInfo(fd.finalfile, pd.rows, pd.cols, 0);
-            if(fd.allfile != NULL) printStackedFileInfo(fd.allfile, pd.rows, pd.cols, sd.iterations);
+            if(fd.allfile != NULL) printStackedOutputInfo(&fd, pd.rows, pd.cols, sd.iterations);
+            if(sd.res.tolerance > 0.0) printResidualInfo(&sd.res);
+            if(active != NULL) printActiveStats(sum_counts[0], sum_counts[1]*sd.iterations, tile_rows, tile_cols);
+            // skipped tiles are not counted in the kernel rate
+            printKernelStats((active != NULL) ? sum_counts[2] : MATRIX_COUNT(pd.rows-2*radius, pd.cols-2*radius)*sd.iterations, max_compute);
+            printf("[Process Level] compute = %g sec, communication = %g sec (slowest of %d processes)\n", max_times[0], max_times[1], pd.num_p);
+            printf("[Thread Level] compute = %g - %g sec (fastest - slowest of %d threads per process)\n", -max_times[3], max_times[2], num_threads);
             FLUSH_OUTPUT
         }
         printTimes(end_overall-start_overall, max_compute);
@@ -173,14 +697,19 @@ int main (int argc, char **argv) {
     ret = EXIT_SUCCESS;
 
 clean_all:
-    free(mp.C);
+    if(use_mmap && cb.is_root && final != mp.A) unmap2D(final, pd.rows, pd.cols);
+    // a single process's mapped infile is whichever block it was swapped into
+    if(smp == NULL && (cb.is_parallel || !use_mmap || mp.C != mp.A)) free(mp.C);
 clean_d:
-    free(mp.B);
+    if(smp != NULL) freeSharedData(&sm);     // both blocks are in the window
+    else if(cb.is_parallel || !use_mmap || mp.B != mp.A) free(mp.B);
 clean_c:
+    if(gdp != NULL) freeGridData(&gd);
     if(cb.is_root) free(mp.sub_count);
 clean_b:
     if(cb.is_root) free(mp.sub_offset);
 clean_a:
-    if(cb.is_parallel) free(mp.A);
+    if(use_mmap && cb.is_root) unmap2D(mp.A, pd.rows, pd.cols);
+    else if(cb.is_parallel) free(mp.A);
     terminate(ret);
 }
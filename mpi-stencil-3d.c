@@ -0,0 +1,133 @@
+/**
+ * @file mpi-stencil-3d.c
+ * @author Leslie Horace
+ * @brief Main program for performing 3D stencil operations with MPI (7-pt by default)
+ * @version 1.0
+ */
+#include "kernel_utils.h"
+#include "mpi_utils.h"
+
+/**
+ *  @brief Performs the stencil iterations on this process's block, ghost planes and rows are exchanged before each one
+ *  @param pd (ProcessData*) local struct for process data
+ *  @param mp (MatrixPointer*) local blocks, mp->C holds the latest iteration
+ *  @param sd (StencilData*) local struct for stencil data
+ *  @param gd (GridData*) local struct for grid data
+ *  @return [val]: ERROR (-1) | SUCCESS (0); [args]: mp->B, mp->C, sd->compute_time, sd->comm_time
+ */
+int mpiStencilLoop3D(ProcessData * pd, MatrixPointer * mp, StencilData * sd, GridData * gd){
+    double start_time = 0.0, end_time = 0.0;
+    for(int k = 0; k < sd->iterations; k++){
+        start_time = MPI_Wtime();
+        if(exchangeGrid(mp->C, pd, gd) == ERROR) return ERROR;
+        end_time = MPI_Wtime();
+        sd->comm_time += (end_time-start_time);
+        sweep3D(mp->B, mp->C, 1, pd->block_size-2, gd->size[1], pd->cols);
+        start_time = MPI_Wtime();
+        sd->compute_time += (start_time-end_time);
+        // swap blocks for next iteration, mp->C is the latest
+        swap2D(&mp->B, &mp->C);
+    }
+    return SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    double start_overall = 0.0, end_overall = 0.0, level_times[2] = {0.0, 0.0}, max_times[2] = {0.0, 0.0};
+    int ret = EXIT_FAILURE, share_data[5] = {0, 0, 0, 0, 0};
+    // local process structs
+    ProcessData pd = {0, 0, 0, 0, 0, 0, 1};
+    StencilData sd = {.iterations=0, .start=0, .debug_level=0, .time_block=1, .compute_time=0.0, .comm_time=0.0};
+    MatrixPointer mp = {NULL, NULL, NULL, NULL, NULL};
+    GridData gd;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &pd.rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &pd.num_p);
+    // set up error handler to return error msgs before aborting
+    MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
+    int is_root = EQUAL(pd.num_p-1, pd.rank);
+    if(is_root) start_overall = MPI_Wtime();
+
+    // remove optional args on every process so only positional args remain
+    char * simd = NULL, * stencil = NULL, * block = NULL, * grid = NULL;
+    int fast_math = popOption(&argc, argv, "--fast-math", NULL);
+    if(popOption(&argc, argv, "--simd", &simd) == ERROR) terminate(ret);
+    if(popOption(&argc, argv, "--stencil", &stencil) == ERROR) terminate(ret);
+    if(popOption(&argc, argv, "--block", &block) == ERROR) terminate(ret);
+    if(popOption(&argc, argv, "--grid", &grid) == ERROR) terminate(ret);
+
+    if(argc != 5){
+        if(is_root){
+            printf("Usage: mpirun -np <num processes> %s <num_iterations> <infile> <outfile> <debug_level[0-1]> [--grid <auto|PxR>] [--stencil <7pt|27pt>] [--simd <auto|avx512|avx2|sse2|scalar>] [--fast-math] [--block <auto|off|rows>x<cols>]\n", argv[0]);
+            FLUSH_OUTPUT
+        }
+        terminate(ret);
+    }
+    // select the stencil, then the best row kernel for this cpu (or the requested one)
+    if(setStencil3D(stencil) == ERROR) abortComm(pd.rank, NULL, ret);
+    if(setKernel3D(simd, fast_math) == ERROR) abortComm(pd.rank, NULL, ret);
+
+    char * infile = argv[2], * outfile = argv[3];
+    // the root reads the whole volume and shares its order
+    if(is_root){
+        if((sd.debug_level = parseInt(argv[4],0,1,"debug_level[0-1]")) == ERROR) abortComm(pd.rank, NULL, ret);
+        if((sd.iterations = parseInt(argv[1],1,SKIP_ARG,"num_iterations")) == ERROR) abortComm(pd.rank, NULL, ret);
+        if(read3D(&mp.A, &pd.planes, &pd.rows, &pd.cols, infile) == ERROR) abortComm(pd.rank, NULL, ret);
+        if(MIN(pd.planes, MIN(pd.rows, pd.cols)) < 3) abortComm(pd.rank, "[mpi-stencil-3d:main]: volume has no interior", ret);
+        share_data[0] = pd.planes; share_data[1] = pd.rows; share_data[2] = pd.cols; share_data[3] = sd.iterations; share_data[4] = sd.debug_level;
+    }
+    ret = MPI_Bcast(share_data, 5, MPI_INT, pd.num_p-1, MPI_COMM_WORLD);
+    if(handleMpiError(pd.rank, ret, "mpi-stencil-3d:main:MPI_Bcast()") != MPI_SUCCESS) abortComm(pd.rank, NULL, EXIT_FAILURE);
+    ret = EXIT_FAILURE;
+    pd.planes = share_data[0]; pd.rows = share_data[1]; pd.cols = share_data[2]; sd.iterations = share_data[3]; sd.debug_level = share_data[4];
+
+    // split into slabs of planes (or a grid of pencils), each block with a ghost plane/row on every side, a grid that does not fit stops every process
+    if(setGridData(&pd, &gd, grid, pd.planes, pd.rows, pd.cols, is_root) == ERROR) terminate(ret);
+    if(malloc1D((void*)&mp.B, VOLUME_SIZE(pd.block_size, gd.size[1], pd.cols), "mp.B") == ERROR) goto clean_a;
+    if(malloc1D((void*)&mp.C, VOLUME_SIZE(pd.block_size, gd.size[1], pd.cols), "mp.C") == ERROR) goto clean_b;
+    if(scatterGrid(mp.A, mp.C, &pd, &gd) == ERROR) goto clean_all;
+    // both blocks hold the boundary planes and rows, which are never written
+    memcpy(mp.B, mp.C, VOLUME_SIZE(pd.block_size, gd.size[1], pd.cols));
+    // size the blocks streamed through the planes to the cache (or the requested shape)
+    if(setBlock3D(block, gd.size[1], pd.cols) == ERROR) abortComm(pd.rank, NULL, ret);
+
+    if(is_root && sd.debug_level > 0){
+        printf("Running %d 3D stencil iterations with %d processes and %s kernel...\n", sd.iterations, pd.num_p, kernelName3D());
+        printf("Process grid: %dx%d %s\n", gd.dims[0], gd.dims[1], (gd.dims[1] == 1) ? "slabs" : "pencils");
+        FLUSH_OUTPUT
+    }
+    if(mpiStencilLoop3D(&pd, &mp, &sd, &gd) == ERROR) abortComm(pd.rank, NULL, ret);
+    // gather all blocks into the root's volume
+    if(gatherGrid(mp.C, mp.A, &pd, &gd) == ERROR) goto clean_all;
+    // process with the maximum compute is the overall compute time
+    level_times[0] = sd.compute_time;
+    level_times[1] = sd.comm_time;
+    ret = MPI_Reduce(level_times, max_times, 2, MPI_DOUBLE, MPI_MAX, pd.num_p-1, MPI_COMM_WORLD);
+    if(handleMpiError(pd.rank, ret, "mpi-stencil-3d:main:MPI_Reduce()") != MPI_SUCCESS) abortComm(pd.rank, NULL, EXIT_FAILURE);
+    ret = EXIT_FAILURE;
+
+    // write out the final volume state, file info, and timing analysis
+    if(is_root){
+        if(write3D(mp.A, pd.planes, pd.rows, pd.cols, outfile) == ERROR) goto clean_all;
+        end_overall = MPI_Wtime();
+        if(sd.debug_level > 0){
+            printVolumeFileInfo(outfile, pd.planes, pd.rows, pd.cols);
+            printKernelStats3D(VOLUME_COUNT(pd.planes-2, pd.rows-2, pd.cols-2)*sd.iterations, max_times[0]);
+            printf("[Process Level] compute = %g sec, communication = %g sec (slowest of %d processes)\n", max_times[0], max_times[1], pd.num_p);
+            FLUSH_OUTPUT
+        }
+        printTimes(end_overall-start_overall, max_times[0]);
+        FLUSH_OUTPUT
+    }
+
+    ret = EXIT_SUCCESS;
+
+clean_all:
+    free(mp.C);
+clean_b:
+    free(mp.B);
+clean_a:
+    freeGridData(&gd);
+    if(is_root) free(mp.A);
+    terminate(ret);
+}
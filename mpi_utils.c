@@ -32,23 +32,25 @@ int handleMpiError(int rank, int err_code, char * location){
 }
 
 int setScatterData(ProcessData * pd, MatrixPointer * mp, StencilData * sd, ConditionBools cb){
-   int share_data[4], ret = ERROR;
+   int share_data[5], ret = ERROR;
    if(cb.is_root){
       // set up offsets and displacesmments for scatter
       for(int i = 0; i < pd->num_p; i++){
-         mp->sub_offset[i] = MATRIX_COUNT(BLOCK_LOW(i, pd->num_p, pd->rows-2), pd->cols);
-         mp->sub_count[i] = MATRIX_COUNT(BLOCK_SIZE(i, pd->num_p, pd->rows-2)+2, pd->cols);
+         mp->sub_offset[i] = MATRIX_COUNT(BLOCK_LOW(i, pd->num_p, pd->rows-2*pd->halo), pd->cols);
+         mp->sub_count[i] = MATRIX_COUNT(BLOCK_SIZE(i, pd->num_p, pd->rows-2*pd->halo)+2*pd->halo, pd->cols);
       }
       // data to share with other processes
       share_data[0] = pd->rows; share_data[1]= pd->cols; share_data[2] = sd->iterations, share_data[3] = sd->debug_level;
+      share_data[4] = sd->start;
    }
    // send data to other processes 
-   ret = MPI_Bcast(&share_data, 4, MPI_INT, pd->num_p-1, MPI_COMM_WORLD);
+   ret = MPI_Bcast(&share_data, 5, MPI_INT, pd->num_p-1, MPI_COMM_WORLD);
 
    if(handleMpiError(pd->rank, ret, "mpi-stencil-2d:main:MPI_Bcast(pd->rows)") != ERROR){
       // save data to lcoal struct and local block size
       pd->rows = share_data[0]; pd->cols = share_data[1]; sd->iterations = share_data[2]; sd->debug_level = share_data[3];
-      pd->block_size = BLOCK_SIZE(pd->rank, pd->num_p, pd->rows-2)+2;
+      sd->start = share_data[4];
+      pd->block_size = BLOCK_SIZE(pd->rank, pd->num_p, pd->rows-2*pd->halo)+2*pd->halo;
    }
    return ret;
 }
@@ -57,3 +59,583 @@ int setScatterData(ProcessData * pd, MatrixPointer * mp, StencilData * sd, Condi
 
 
 
+
+
+int mpiReadBlock2D(elem_t ** X, ProcessData * pd, char * infile){
+   MPI_File fh;
+   MPI_Datatype row_type;
+   int meta[3] = {0, 0, 0}, type = 0, first = 0, ret = ERROR;
+
+   if(handleMpiError(pd->rank, MPI_File_open(MPI_COMM_WORLD, infile, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh),
+         "mpi_utils:mpiReadBlock2D:MPI_File_open()") != MPI_SUCCESS) return ERROR;
+   // every process reads the matrix order metadata, tagged metadata is one int longer
+   if(handleMpiError(pd->rank, MPI_File_read_at_all(fh, 0, meta, 3, MPI_INT, MPI_STATUS_IGNORE),
+         "mpi_utils:mpiReadBlock2D:MPI_File_read_at_all()") != MPI_SUCCESS) goto end_open;
+   if(decodeHeader2D(meta, &pd->rows, &pd->cols, &type) == ERROR) goto end_open;
+   // blocks are read as they are, so the file must hold elem_t
+   if(type != ELEM_TYPE){
+      if(pd->rank == pd->num_p-1) printf("Error [mpi_utils:mpiReadBlock2D]: '%s' holds %s elements, this build uses %s\n", infile, ELEM_NAME(type), ELEM_NAME(ELEM_TYPE));
+      goto end_open;
+   }
+   if(MIN(pd->rows, pd->cols) <= 2*pd->halo || pd->num_p > pd->rows-2*pd->halo){
+      if(pd->rank == pd->num_p-1) printf("Error [mpi_utils:mpiReadBlock2D]: %dx%d matrix cannot be split into %d blocks\n", pd->rows, pd->cols, pd->num_p);
+      goto end_open;
+   }
+   // each block is its rows plus halo ghost rows above and below
+   first = BLOCK_LOW(pd->rank, pd->num_p, pd->rows-2*pd->halo);
+   pd->block_size = BLOCK_SIZE(pd->rank, pd->num_p, pd->rows-2*pd->halo)+2*pd->halo;
+   // other processes would wait in the collective read, so abort
+   if(malloc1D((void*)X, MATRIX_SIZE(pd->block_size, pd->cols), "block") == ERROR) abortComm(pd->rank, NULL, EXIT_FAILURE);
+
+   // read whole rows so counts fit in an int for any matrix
+   MPI_Type_contiguous(pd->cols, MPI_ELEM, &row_type);
+   MPI_Type_commit(&row_type);
+   if(handleMpiError(pd->rank, MPI_File_read_at_all(fh, (MPI_Offset)(HEADER_SIZE(ELEM_TYPE) + MATRIX_SIZE(first, pd->cols)), *X, pd->block_size, row_type, MPI_STATUS_IGNORE),
+         "mpi_utils:mpiReadBlock2D:MPI_File_read_at_all()") == MPI_SUCCESS) ret = SUCCESS;
+   MPI_Type_free(&row_type);
+
+end_open:
+   MPI_File_close(&fh);
+   return ret;
+}
+
+int mpiWriteBlock2D(elem_t * X, ProcessData * pd, char * outfile){
+   MPI_File fh;
+   MPI_Datatype row_type;
+   int meta[3], meta_count = encodeHeader2D(meta, pd->rows, pd->cols), ret = ERROR, header_ret = MPI_SUCCESS;
+   // interior rows of the block, plus the matrix boundary rows for the first and last block
+   int lo = (pd->rank == 0) ? 0 : pd->halo, hi = (pd->rank == pd->num_p-1) ? pd->block_size-1 : pd->block_size-1-pd->halo;
+   int first = BLOCK_LOW(pd->rank, pd->num_p, pd->rows-2*pd->halo) + lo;
+
+   if(handleMpiError(pd->rank, MPI_File_open(MPI_COMM_WORLD, outfile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh),
+         "mpi_utils:mpiWriteBlock2D:MPI_File_open()") != MPI_SUCCESS) return ERROR;
+   // drop anything left from an older, larger file
+   if(handleMpiError(pd->rank, MPI_File_set_size(fh, (MPI_Offset)DATAFILE_SIZE(pd->rows, pd->cols)),
+         "mpi_utils:mpiWriteBlock2D:MPI_File_set_size()") != MPI_SUCCESS) goto end_open;
+   // rank 0 writes the metadata, an error is only returned after the collective write
+   if(pd->rank == 0) header_ret = handleMpiError(pd->rank, MPI_File_write_at(fh, 0, meta, meta_count, MPI_INT, MPI_STATUS_IGNORE),
+         "mpi_utils:mpiWriteBlock2D:MPI_File_write_at()");
+
+   MPI_Type_contiguous(pd->cols, MPI_ELEM, &row_type);
+   MPI_Type_commit(&row_type);
+   if(handleMpiError(pd->rank, MPI_File_write_at_all(fh, (MPI_Offset)(HEADER_SIZE(ELEM_TYPE) + MATRIX_SIZE(first, pd->cols)), &X[IDX((long)lo, 0, (long)pd->cols)], hi-lo+1, row_type, MPI_STATUS_IGNORE),
+         "mpi_utils:mpiWriteBlock2D:MPI_File_write_at_all()") == MPI_SUCCESS && header_ret == MPI_SUCCESS) ret = SUCCESS;
+   MPI_Type_free(&row_type);
+
+end_open:
+   if(MPI_File_close(&fh) != MPI_SUCCESS) ret = ERROR;
+   return ret;
+}
+
+int initHaloRequests(ProcessData * pd, elem_t * X, int is_last, MPI_Request * req){
+   int up = LEFT(pd->rank), down = RIGHT(pd->rank, is_last), count = pd->halo*pd->cols, ret = MPI_SUCCESS;
+
+   for(int r = 0; r < HALO_REQUESTS; r++) req[r] = MPI_REQUEST_NULL;
+   // first halo rows go up and last halo rows go down, ghost rows come from the same neighbors
+   ret = MPI_Recv_init(&X[TOP_TARGET], count, MPI_ELEM, up, HALO_DOWN_TAG, MPI_COMM_WORLD, &req[0]);
+   if(ret == MPI_SUCCESS) ret = MPI_Recv_init(&X[BOT_TARGET(pd->block_size, pd->halo, pd->cols)], count, MPI_ELEM, down, HALO_UP_TAG, MPI_COMM_WORLD, &req[1]);
+   if(ret == MPI_SUCCESS) ret = MPI_Send_init(&X[TOP_SOURCE(pd->halo, pd->cols)], count, MPI_ELEM, up, HALO_UP_TAG, MPI_COMM_WORLD, &req[2]);
+   if(ret == MPI_SUCCESS) ret = MPI_Send_init(&X[BOT_SOURCE(pd->block_size, pd->halo, pd->cols)], count, MPI_ELEM, down, HALO_DOWN_TAG, MPI_COMM_WORLD, &req[3]);
+   if(handleMpiError(pd->rank, ret, "mpi_utils:initHaloRequests()") != MPI_SUCCESS){
+      freeHaloRequests(req, HALO_REQUESTS);
+      return ERROR;
+   }
+   return SUCCESS;
+}
+
+void freeHaloRequests(MPI_Request * req, int count){
+   for(int r = 0; r < count; r++){
+      if(req[r] != MPI_REQUEST_NULL) MPI_Request_free(&req[r]);
+   }
+}
+
+int exchangeDeepHalo2D(elem_t * X, ProcessData * pd, int depth, int is_last){
+   int up = LEFT(pd->rank), down = RIGHT(pd->rank, is_last), ret = MPI_SUCCESS;
+   long c = (long)pd->cols, n = (long)pd->block_size-2*pd->halo, d = (long)depth;
+
+   // first depth owned rows go up into the bottom ghost rows of the block above, last depth rows go down
+   ret = MPI_Sendrecv(&X[IDX(d, 0, c)], depth*pd->cols, MPI_ELEM, up, HALO_UP_TAG,
+                      &X[IDX(d+n, 0, c)], depth*pd->cols, MPI_ELEM, down, HALO_UP_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   if(ret == MPI_SUCCESS) ret = MPI_Sendrecv(&X[IDX(n, 0, c)], depth*pd->cols, MPI_ELEM, down, HALO_DOWN_TAG,
+                      &X[0], depth*pd->cols, MPI_ELEM, up, HALO_DOWN_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   return (handleMpiError(pd->rank, ret, "mpi_utils:exchangeDeepHalo2D:MPI_Sendrecv()") != MPI_SUCCESS) ? ERROR : SUCCESS;
+}
+
+// gets the global first ghost and the size (with h ghosts on each side) of the block at grid coords c, the inner dim is never split
+static void gridBlock(GridData * gd, int h, int * c, int * start, int * size){
+   for(int d = 0; d < 2; d++){
+      start[d] = BLOCK_LOW(c[d], gd->dims[d], gd->extent[d]-2*h);
+      size[d] = BLOCK_SIZE(c[d], gd->dims[d], gd->extent[d]-2*h)+2*h;
+   }
+   start[2] = 0;
+   size[2] = gd->inner;
+}
+
+// gets the part of a block gathered by the root, interior slices plus the boundary of edge blocks along dims[1]
+static void gridRegion(GridData * gd, int h, int * c, int * size, int * start, int * sub){
+   int first = (c[1] == 0), last = (c[1] == gd->dims[1]-1);
+   start[0] = h;
+   start[1] = (first) ? 0 : h;
+   start[2] = 0;
+   sub[0] = size[0]-2*h;
+   sub[1] = size[1]-2*h + (first + last)*h;
+   sub[2] = size[2];
+}
+
+int setGridData(ProcessData * pd, GridData * gd, char * shape, int extent0, int extent1, int inner, int is_root){
+   int periods[2] = {0, 0}, start[3], size[3], rstart[3], sub[3], global[3] = {extent0, extent1, inner}, c[2], h = pd->halo, ret = MPI_SUCCESS;
+   MPI_Datatype point;
+   char extra = '\0';
+
+   gd->comm = MPI_COMM_NULL;
+   gd->face = gd->slice = gd->region = MPI_DATATYPE_NULL;
+   gd->root_regions = NULL;
+   gd->dims[0] = gd->dims[1] = 0;
+   gd->extent[0] = extent0;
+   gd->extent[1] = extent1;
+   gd->inner = inner;
+   // pick the grid shape, whole slices of dims[0] by default, MPI_Dims_create puts the larger factor first
+   if(shape == NULL){
+      gd->dims[0] = pd->num_p;
+      gd->dims[1] = 1;
+   }else if(strcmp(shape, "auto") == 0){
+      MPI_Dims_create(pd->num_p, 2, gd->dims);
+      if(extent1 > extent0){
+         int tmp = gd->dims[0]; gd->dims[0] = gd->dims[1]; gd->dims[1] = tmp;
+      }
+   }else if(sscanf(shape, "%dx%d%c", &gd->dims[0], &gd->dims[1], &extra) != 2 || gd->dims[0] < 1 || gd->dims[1] < 1 
+         || gd->dims[0]*gd->dims[1] != pd->num_p){
+      if(is_root) printf("Error [mpi_utils:setGridData]: --grid '%s' must be auto or <p>x<q> with p*q = %d processes\n", shape, pd->num_p);
+      FLUSH_OUTPUT
+      return ERROR;
+   }
+   // every block sends halo of its own slices along each dim
+   if(MIN(extent0, extent1) <= 2*h || (extent0-2*h)/gd->dims[0] < h || (extent1-2*h)/gd->dims[1] < h){
+      if(is_root) printf("Error [mpi_utils:setGridData]: %dx%d process grid does not fit %dx%d interior points with %d ghosts\n", gd->dims[0], gd->dims[1], extent0-2*h, extent1-2*h, h);
+      FLUSH_OUTPUT
+      return ERROR;
+   }
+   // keep ranks so the root is still the last process
+   ret = MPI_Cart_create(MPI_COMM_WORLD, 2, gd->dims, periods, 0, &gd->comm);
+   if(handleMpiError(pd->rank, ret, "mpi_utils:setGridData:MPI_Cart_create()") != MPI_SUCCESS) return ERROR;
+   MPI_Comm_set_errhandler(gd->comm, MPI_ERRORS_RETURN);
+   MPI_Cart_coords(gd->comm, pd->rank, 2, gd->coords);
+   MPI_Cart_shift(gd->comm, 0, 1, &gd->prev[0], &gd->next[0]);
+   MPI_Cart_shift(gd->comm, 1, 1, &gd->prev[1], &gd->next[1]);
+
+   gridBlock(gd, h, gd->coords, start, size);
+   gd->low[0] = start[0];
+   gd->low[1] = start[1];
+   gd->size[0] = pd->block_size = size[0];
+   gd->size[1] = size[1];
+
+   // a face is halo points of each interior slice, slices are size[1] points apart (byte stride so it cannot overflow)
+   MPI_Type_contiguous(inner, MPI_ELEM, &point);
+   MPI_Type_create_hvector(size[0]-2*h, h, (MPI_Aint)MATRIX_SIZE(size[1], inner), point, &gd->face);
+   MPI_Type_commit(&gd->face);
+   MPI_Type_contiguous(size[1], point, &gd->slice);
+   MPI_Type_commit(&gd->slice);
+   MPI_Type_free(&point);
+   gridRegion(gd, h, gd->coords, size, rstart, sub);
+   MPI_Type_create_subarray(3, size, sub, rstart, MPI_ORDER_C, MPI_ELEM, &gd->region);
+   MPI_Type_commit(&gd->region);
+   if(!is_root) return SUCCESS;
+
+   // the root receives each process's region straight into the whole matrix (or volume), other processes would wait in the scatter, so abort
+   if(malloc1D((void*)&gd->root_regions, pd->num_p*sizeof(MPI_Datatype), "root_regions") == ERROR) abortComm(pd->rank, NULL, EXIT_FAILURE);
+   for(int r = 0; r < pd->num_p; r++){
+      MPI_Cart_coords(gd->comm, r, 2, c);
+      gridBlock(gd, h, c, start, size);
+      gridRegion(gd, h, c, size, rstart, sub);
+      rstart[0] += start[0]; rstart[1] += start[1];
+      MPI_Type_create_subarray(3, global, sub, rstart, MPI_ORDER_C, MPI_ELEM, &gd->root_regions[r]);
+      MPI_Type_commit(&gd->root_regions[r]);
+   }
+   return SUCCESS;
+}
+
+void freeGridData(GridData * gd){
+   if(gd->root_regions != NULL){
+      int num_p = 0;
+      MPI_Comm_size(gd->comm, &num_p);
+      for(int r = 0; r < num_p; r++) MPI_Type_free(&gd->root_regions[r]);
+      free(gd->root_regions);
+   }
+   if(gd->region != MPI_DATATYPE_NULL) MPI_Type_free(&gd->region);
+   if(gd->slice != MPI_DATATYPE_NULL) MPI_Type_free(&gd->slice);
+   if(gd->face != MPI_DATATYPE_NULL) MPI_Type_free(&gd->face);
+   if(gd->comm != MPI_COMM_NULL) MPI_Comm_free(&gd->comm);
+}
+
+void initGrid2D(elem_t * X, ProcessData * pd, GridData * gd){
+   long r = (long)gd->size[0], c = (long)gd->size[1];
+   for(long i = 0; i < r; i++){
+      for(long j = 0; j < c; j++){
+         long g = gd->low[1] + j;   // global col, first and last are 1 like init2D()
+         X[IDX(i,j,c)] = (g == 0 || g == pd->cols-1) ? 1 : 0;
+      }
+   }
+}
+
+int scatterGrid(elem_t * A, elem_t * X, ProcessData * pd, GridData * gd){
+   int root = pd->num_p-1, start[3], size[3], c[2], global[3] = {gd->extent[0], gd->extent[1], gd->inner}, ret = MPI_SUCCESS;
+   MPI_Request * req = NULL;
+   MPI_Datatype * blocks = NULL;
+
+   // the root sends each block as a subarray of the whole matrix (or volume), to itself too
+   if(pd->rank == root){
+      if(malloc1D((void*)&req, pd->num_p*sizeof(MPI_Request), "req") == ERROR) return ERROR;
+      if(malloc1D((void*)&blocks, pd->num_p*sizeof(MPI_Datatype), "blocks") == ERROR){ free(req); return ERROR; }
+      for(int r = 0; r < pd->num_p; r++){
+         MPI_Cart_coords(gd->comm, r, 2, c);
+         gridBlock(gd, pd->halo, c, start, size);
+         MPI_Type_create_subarray(3, global, size, start, MPI_ORDER_C, MPI_ELEM, &blocks[r]);
+         MPI_Type_commit(&blocks[r]);
+         if(ret == MPI_SUCCESS) ret = MPI_Isend(A, 1, blocks[r], r, 0, gd->comm, &req[r]);
+         else req[r] = MPI_REQUEST_NULL;
+      }
+   }
+   // receive whole slices so counts fit in an int for any block
+   if(ret == MPI_SUCCESS) ret = MPI_Recv(X, gd->size[0], gd->slice, root, 0, gd->comm, MPI_STATUS_IGNORE);
+   if(pd->rank == root){
+      MPI_Waitall(pd->num_p, req, MPI_STATUSES_IGNORE);
+      for(int r = 0; r < pd->num_p; r++) MPI_Type_free(&blocks[r]);
+      free(blocks);
+      free(req);
+   }
+   return (handleMpiError(pd->rank, ret, "mpi_utils:scatterGrid()") == MPI_SUCCESS) ? SUCCESS : ERROR;
+}
+
+int gatherGrid(elem_t * X, elem_t * A, ProcessData * pd, GridData * gd){
+   int root = pd->num_p-1, ret = MPI_SUCCESS;
+   MPI_Request req = MPI_REQUEST_NULL;
+
+   ret = MPI_Isend(X, 1, gd->region, root, 1, gd->comm, &req);
+   if(pd->rank == root){
+      for(int r = 0; r < pd->num_p && ret == MPI_SUCCESS; r++){
+         ret = MPI_Recv(A, 1, gd->root_regions[r], r, 1, gd->comm, MPI_STATUS_IGNORE);
+      }
+   }
+   if(ret == MPI_SUCCESS) ret = MPI_Wait(&req, MPI_STATUS_IGNORE);
+   return (handleMpiError(pd->rank, ret, "mpi_utils:gatherGrid()") == MPI_SUCCESS) ? SUCCESS : ERROR;
+}
+
+int exchangeGrid(elem_t * X, ProcessData * pd, GridData * gd){
+   long m = (long)gd->size[0], w = (long)gd->size[1], n = (long)gd->inner, h = (long)pd->halo, s = w*n;
+   int ret = MPI_SUCCESS;
+
+   // first/last halo interior points of every interior slice go to the previous/next block along dims[1]
+   ret = MPI_Sendrecv(&X[h*s+h*n], 1, gd->face, gd->prev[1], HALO_LEFT_TAG, 
+                        &X[h*s+(w-h)*n], 1, gd->face, gd->next[1], HALO_LEFT_TAG, gd->comm, MPI_STATUS_IGNORE);
+   if(ret == MPI_SUCCESS) ret = MPI_Sendrecv(&X[h*s+(w-2*h)*n], 1, gd->face, gd->next[1], HALO_RIGHT_TAG, 
+                        &X[h*s], 1, gd->face, gd->prev[1], HALO_RIGHT_TAG, gd->comm, MPI_STATUS_IGNORE);
+   // whole first/last halo slices go along dims[0] after the faces, so their ghosts carry the corners (or edges)
+   if(ret == MPI_SUCCESS) ret = MPI_Sendrecv(&X[h*s], pd->halo, gd->slice, gd->prev[0], HALO_UP_TAG, 
+                        &X[(m-h)*s], pd->halo, gd->slice, gd->next[0], HALO_UP_TAG, gd->comm, MPI_STATUS_IGNORE);
+   if(ret == MPI_SUCCESS) ret = MPI_Sendrecv(&X[(m-2*h)*s], pd->halo, gd->slice, gd->next[0], HALO_DOWN_TAG, 
+                        &X[0], pd->halo, gd->slice, gd->prev[0], HALO_DOWN_TAG, gd->comm, MPI_STATUS_IGNORE);
+   return (handleMpiError(pd->rank, ret, "mpi_utils:exchangeGrid()") == MPI_SUCCESS) ? SUCCESS : ERROR;
+}
+
+// builds a datatype of the interior rows of block X, with the boundary row first (first block) or last (last block)
+static void frameRows(MPI_Datatype * type, MPI_Datatype row_type, elem_t * X, elem_t * edge, ProcessData * pd){
+   int len[3], count = 0;
+   MPI_Aint disp[3];
+
+   if(pd->rank == 0){
+      MPI_Get_address(edge, &disp[count]);
+      len[count++] = pd->halo;
+   }
+   MPI_Get_address(&X[MATRIX_COUNT(pd->halo, pd->cols)], &disp[count]);
+   len[count++] = pd->block_size-2*pd->halo;
+   if(pd->rank == pd->num_p-1){
+      MPI_Get_address(edge, &disp[count]);
+      len[count++] = pd->halo;
+   }
+   MPI_Type_create_hindexed(count, len, disp, row_type, type);
+   MPI_Type_commit(type);
+}
+
+int openFrames2D(FrameData * fr, elem_t * X, elem_t * Y, ProcessData * pd, int iterations, char * stacked_file){
+   MPI_Datatype row_type;
+   long c = (long)pd->cols;
+   int is_first = (pd->rank == 0), is_last = (pd->rank == pd->num_p-1);
+
+   fr->req[0] = fr->req[1] = MPI_REQUEST_NULL;
+   fr->rows[0] = fr->rows[1] = MPI_DATATYPE_NULL;
+   fr->edge = NULL;
+   fr->frame_size = (MPI_Offset)MATRIX_SIZE(pd->rows, pd->cols);
+   fr->first = (MPI_Offset)MATRIX_SIZE(BLOCK_LOW(pd->rank, pd->num_p, pd->rows-2*pd->halo) + (is_first ? 0 : pd->halo), pd->cols);
+
+   if(handleMpiError(pd->rank, MPI_File_open(MPI_COMM_WORLD, stacked_file, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fr->fh),
+         "mpi_utils:openFrames2D:MPI_File_open()") != MPI_SUCCESS) return ERROR;
+   // drop anything left from an older, larger file
+   if(handleMpiError(pd->rank, MPI_File_set_size(fr->fh, (MPI_Offset)RAWFILE_SIZE(pd->rows, pd->cols, iterations)),
+         "mpi_utils:openFrames2D:MPI_File_set_size()") != MPI_SUCCESS){
+      MPI_File_close(&fr->fh);
+      return ERROR;
+   }
+   // keep the boundary rows from infile, the same ghost rows of the other block hold the init rows
+   if(is_first || is_last){
+      if(malloc1D((void*)&fr->edge, MATRIX_SIZE(pd->halo, pd->cols), "fr->edge") == ERROR) abortComm(pd->rank, NULL, EXIT_FAILURE);
+      memcpy(fr->edge, (is_first) ? X : &X[BOT_TARGET((long)pd->block_size, pd->halo, c)], MATRIX_SIZE(pd->halo, pd->cols));
+   }
+   MPI_Type_contiguous(pd->cols, MPI_ELEM, &row_type);
+   frameRows(&fr->rows[0], row_type, X, fr->edge, pd);
+   frameRows(&fr->rows[1], row_type, Y, fr->edge, pd);
+   MPI_Type_free(&row_type);
+   return SUCCESS;
+}
+
+int writeFrame2D(FrameData * fr, int block, int frame, int rank){
+   return (handleMpiError(rank, MPI_File_iwrite_at_all(fr->fh, (MPI_Offset)frame*fr->frame_size + fr->first, MPI_BOTTOM, 1, fr->rows[block], &fr->req[block]),
+         "mpi_utils:writeFrame2D:MPI_File_iwrite_at_all()") == MPI_SUCCESS) ? SUCCESS : ERROR;
+}
+
+int waitFrame2D(FrameData * fr, int block, int rank){
+   return (handleMpiError(rank, MPI_Wait(&fr->req[block], MPI_STATUS_IGNORE),
+         "mpi_utils:waitFrame2D:MPI_Wait()") == MPI_SUCCESS) ? SUCCESS : ERROR;
+}
+
+int closeFrames2D(FrameData * fr, int rank){
+   int ret = SUCCESS;
+
+   for(int b = 0; b < 2; b++){
+      if(waitFrame2D(fr, b, rank) == ERROR) ret = ERROR;
+      if(fr->rows[b] != MPI_DATATYPE_NULL) MPI_Type_free(&fr->rows[b]);
+   }
+   if(handleMpiError(rank, MPI_File_close(&fr->fh), "mpi_utils:closeFrames2D:MPI_File_close()") != MPI_SUCCESS) ret = ERROR;
+   free(fr->edge);
+   return ret;
+}
+
+int truncateFrames2D(FrameData * fr, ProcessData * pd, int iterations){
+   for(int b = 0; b < 2; b++){
+      if(waitFrame2D(fr, b, pd->rank) == ERROR) return ERROR;
+   }
+   return (handleMpiError(pd->rank, MPI_File_set_size(fr->fh, (MPI_Offset)RAWFILE_SIZE(pd->rows, pd->cols, iterations)),
+         "mpi_utils:truncateFrames2D:MPI_File_set_size()") == MPI_SUCCESS) ? SUCCESS : ERROR;
+}
+
+int openBandCheckpoint(BandCheckpoint * bc, CheckpointData * cd, elem_t * X, ProcessData * pd, int start){
+   int is_first = (pd->rank == 0), is_last = (pd->rank == pd->num_p-1);
+
+   memset(bc, 0, sizeof(BandCheckpoint));
+   bc->cd = cd;
+   bc->req = MPI_REQUEST_NULL;
+   bc->last = start;
+   bc->last_time = MPI_Wtime();
+   // interior rows of the block, plus the matrix boundary rows for the first and last block
+   bc->lo = (is_first) ? 0 : pd->halo;
+   bc->count = pd->block_size-2*pd->halo + (is_first + is_last)*pd->halo;
+   bc->first = (MPI_Offset)(HEADER_SIZE(ELEM_TYPE) + MATRIX_SIZE(BLOCK_LOW(pd->rank, pd->num_p, pd->rows-2*pd->halo) + bc->lo, pd->cols));
+   if(malloc1D((void*)&bc->tmpfile, strlen(cd->file)+5, "bc->tmpfile") == ERROR) return ERROR;
+   sprintf(bc->tmpfile, "%s.tmp", cd->file);
+   if(malloc1D((void*)&bc->rows, MATRIX_SIZE(bc->count, pd->cols), "bc->rows") == ERROR) goto end_tmp;
+   // keep the boundary rows from infile, the same ghost rows of the other block hold the init rows
+   if(is_first || is_last){
+      if(malloc1D((void*)&bc->edge, MATRIX_SIZE(pd->halo, pd->cols), "bc->edge") == ERROR) goto end_rows;
+      memcpy(bc->edge, (is_first) ? X : &X[BOT_TARGET((long)pd->block_size, pd->halo, (long)pd->cols)], MATRIX_SIZE(pd->halo, pd->cols));
+   }
+   MPI_Type_contiguous(pd->cols, MPI_ELEM, &bc->row_type);
+   MPI_Type_commit(&bc->row_type);
+   return SUCCESS;
+
+end_rows:
+   free(bc->rows);
+end_tmp:
+   free(bc->tmpfile);
+   return ERROR;
+}
+
+int claimBandCheckpoint(BandCheckpoint * bc, int iteration, int rank){
+   int done = 0;
+
+   // a checkpoint is finished once the root's rows are written, the other processes wait for theirs
+   if(bc->pending){
+      if(handleMpiError(rank, MPI_Test(&bc->req, &done, MPI_STATUS_IGNORE), "mpi_utils:claimBandCheckpoint:MPI_Test()") != MPI_SUCCESS) return ERROR;
+      return (done) ? CKPT_FINISH : CKPT_NONE;
+   }
+   return (checkpointDue(bc->cd, iteration, bc->last, bc->last_time)) ? CKPT_START : CKPT_NONE;
+}
+
+int startBandCheckpoint(BandCheckpoint * bc, elem_t * X, ProcessData * pd, int iteration){
+   CheckpointTrailer trailer;
+   long c = (long)pd->cols;
+   int meta[3], meta_count = encodeCheckpoint2D(meta, &trailer, pd->rows, pd->cols, iteration), ret = MPI_SUCCESS;
+
+   bc->iteration = bc->last = iteration;
+   bc->last_time = MPI_Wtime();
+   memcpy(bc->rows, &X[IDX((long)bc->lo, 0, c)], MATRIX_SIZE(bc->count, pd->cols));
+   if(pd->rank == 0) memcpy(bc->rows, bc->edge, MATRIX_SIZE(pd->halo, pd->cols));
+   if(pd->rank == pd->num_p-1) memcpy(&bc->rows[BOT_TARGET((long)bc->count, pd->halo, c)], bc->edge, MATRIX_SIZE(pd->halo, pd->cols));
+
+   if(handleMpiError(pd->rank, MPI_File_open(MPI_COMM_WORLD, bc->tmpfile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &bc->fh),
+         "mpi_utils:startBandCheckpoint:MPI_File_open()") != MPI_SUCCESS) return ERROR;
+   // drop anything left from an older, larger file
+   ret = MPI_File_set_size(bc->fh, (MPI_Offset)CKPT_SIZE(pd->rows, pd->cols));
+   // the root writes the metadata and trailer, they are small enough to write before the rows
+   if(ret == MPI_SUCCESS && pd->rank == pd->num_p-1){
+      ret = MPI_File_write_at(bc->fh, 0, meta, meta_count, MPI_INT, MPI_STATUS_IGNORE);
+      if(ret == MPI_SUCCESS) ret = MPI_File_write_at(bc->fh, (MPI_Offset)DATAFILE_SIZE(pd->rows, pd->cols), &trailer, sizeof(CheckpointTrailer), MPI_BYTE, MPI_STATUS_IGNORE);
+   }
+   if(ret == MPI_SUCCESS) ret = MPI_File_iwrite_at_all(bc->fh, bc->first, bc->rows, bc->count, bc->row_type, &bc->req);
+   if(handleMpiError(pd->rank, ret, "mpi_utils:startBandCheckpoint()") != MPI_SUCCESS){
+      MPI_File_close(&bc->fh);
+      return ERROR;
+   }
+   bc->pending = 1;
+   return SUCCESS;
+}
+
+int finishBandCheckpoint(BandCheckpoint * bc, ProcessData * pd){
+   int ret = MPI_SUCCESS;
+
+   bc->pending = 0;
+   ret = MPI_Wait(&bc->req, MPI_STATUS_IGNORE);
+   // the old checkpoint is only replaced once the new one is on disk
+   if(ret == MPI_SUCCESS) ret = MPI_File_sync(bc->fh);
+   if(handleMpiError(pd->rank, ret, "mpi_utils:finishBandCheckpoint()") != MPI_SUCCESS){
+      MPI_File_close(&bc->fh);
+      return ERROR;
+   }
+   if(handleMpiError(pd->rank, MPI_File_close(&bc->fh), "mpi_utils:finishBandCheckpoint:MPI_File_close()") != MPI_SUCCESS) return ERROR;
+   if(pd->rank == pd->num_p-1 && rename(bc->tmpfile, bc->cd->file) == -1){
+      printf("Error [mpi_utils:finishBandCheckpoint:rename()]: cannot rename '%s' to '%s'\n", bc->tmpfile, bc->cd->file);
+      return ERROR;
+   }
+   bc->saved++;
+   bc->saved_iteration = bc->iteration;
+   return SUCCESS;
+}
+
+int closeBandCheckpoint(BandCheckpoint * bc, ProcessData * pd){
+   int ret = SUCCESS;
+
+   if(bc->pending) ret = finishBandCheckpoint(bc, pd);
+   MPI_Type_free(&bc->row_type);
+   free(bc->edge);
+   free(bc->rows);
+   free(bc->tmpfile);
+   return ret;
+}
+
+// gets the # exchanges done by a process on this node, or NULL if it is on another node
+static volatile int * sharedCount(SharedData * sm, int node_rank){
+   MPI_Aint size = 0;
+   int disp_unit = 0, * count = NULL;
+
+   if(node_rank == MPI_UNDEFINED) return NULL;
+   MPI_Win_shared_query(sm->count_win, node_rank, &size, &disp_unit, &count);
+   return count;
+}
+
+// orders this process's loads and stores of both blocks and the counts with those of the other processes on this node
+static void syncShared(SharedData * sm){
+   MPI_Win_sync(sm->win[0]);
+   MPI_Win_sync(sm->win[1]);
+   MPI_Win_sync(sm->count_win);
+}
+
+int setSharedData(ProcessData * pd, SharedData * sm, elem_t ** X, elem_t ** Y, int is_last){
+   MPI_Group world_group, node_group;
+   MPI_Aint size = 0;
+   elem_t * blocks[2] = {*X, *Y}, * base = NULL, * above = NULL;
+   int near[2] = {LEFT(pd->rank), RIGHT(pd->rank, is_last)}, node[2] = {MPI_UNDEFINED, MPI_UNDEFINED};
+   int * count = NULL, disp_unit = 0, b = 0, ret = MPI_SUCCESS;
+
+   ret = MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, pd->rank, MPI_INFO_NULL, &sm->node_comm);
+   if(handleMpiError(pd->rank, ret, "mpi_utils:setSharedData:MPI_Comm_split_type()") != MPI_SUCCESS) return ERROR;
+   // node ranks keep the rank order, so the process above (below) on this node is the node rank before (after) this one
+   MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+   MPI_Comm_group(sm->node_comm, &node_group);
+   MPI_Group_translate_ranks(world_group, 2, near, node_group, node);
+   MPI_Group_free(&node_group);
+   MPI_Group_free(&world_group);
+   for(int i = 0; i < 2; i++) if(node[i] == MPI_PROC_NULL) node[i] = MPI_UNDEFINED;
+   sm->msg_up = (node[0] == MPI_UNDEFINED) ? near[0] : MPI_PROC_NULL;
+   sm->msg_down = (node[1] == MPI_UNDEFINED) ? near[1] : MPI_PROC_NULL;
+   // a segment only holds the ghost rows that do not belong to a process on this node
+   sm->first = (node[0] == MPI_UNDEFINED) ? 0 : pd->halo;
+   sm->seg_rows = pd->block_size - sm->first - ((node[1] == MPI_UNDEFINED) ? 0 : pd->halo);
+
+   for(b = 0; b < 2; b++){
+      // segments of a contiguous window follow each other, so the block starts in the segment of the process above
+      ret = MPI_Win_allocate_shared((MPI_Aint)MATRIX_SIZE(sm->seg_rows, pd->cols), ELEM_SIZE, MPI_INFO_NULL, sm->node_comm, &base, &sm->win[b]);
+      if(handleMpiError(pd->rank, ret, "mpi_utils:setSharedData:MPI_Win_allocate_shared()") != MPI_SUCCESS) goto end_win;
+      if(node[0] != MPI_UNDEFINED){
+         MPI_Win_shared_query(sm->win[b], node[0], &size, &disp_unit, &above);
+         if(&above[size/ELEM_SIZE] != base){
+            printf("Error [mpi_utils:setSharedData]: shared window segments of process %d are not contiguous\n", pd->rank);
+            b++;
+            goto end_win;
+         }
+      }
+      // each process writes its own segment first, so its pages are on its NUMA node
+      memcpy(base, &blocks[b][MATRIX_COUNT(sm->first, pd->cols)], MATRIX_SIZE(sm->seg_rows, pd->cols));
+      blocks[b] = base - MATRIX_COUNT(sm->first, pd->cols);
+   }
+   ret = MPI_Win_allocate_shared((MPI_Aint)INT_SIZE, INT_SIZE, MPI_INFO_NULL, sm->node_comm, &count, &sm->count_win);
+   if(handleMpiError(pd->rank, ret, "mpi_utils:setSharedData:MPI_Win_allocate_shared()") != MPI_SUCCESS) goto end_win;
+   *count = 0;
+   sm->count = count;
+   sm->count_up = sharedCount(sm, node[0]);
+   sm->count_down = sharedCount(sm, node[1]);
+
+   // one passive target epoch for the whole run, MPI_Win_sync orders the loads and stores
+   MPI_Win_lock_all(MPI_MODE_NOCHECK, sm->win[0]);
+   MPI_Win_lock_all(MPI_MODE_NOCHECK, sm->win[1]);
+   MPI_Win_lock_all(MPI_MODE_NOCHECK, sm->count_win);
+   // every segment and count is written before a process reads its neighbors'
+   syncShared(sm);
+   ret = MPI_Barrier(sm->node_comm);
+   if(handleMpiError(pd->rank, ret, "mpi_utils:setSharedData:MPI_Barrier()") != MPI_SUCCESS){
+      freeSharedData(sm);
+      return ERROR;
+   }
+   syncShared(sm);
+   *X = blocks[0];
+   *Y = blocks[1];
+   return SUCCESS;
+
+end_win:
+   while(b-- > 0) MPI_Win_free(&sm->win[b]);
+   MPI_Comm_free(&sm->node_comm);
+   return ERROR;
+}
+
+int exchangeShared2D(elem_t * X, ProcessData * pd, SharedData * sm){
+   long c = (long)pd->cols, m = (long)pd->block_size, h = (long)pd->halo;
+   int count = *sm->count+1, ret = MPI_SUCCESS;
+
+   // this block's rows are written before its count says so
+   syncShared(sm);
+   *sm->count = count;
+   MPI_Win_sync(sm->count_win);
+   // first halo rows go up and last halo rows go down to blocks on other nodes
+   ret = MPI_Sendrecv(&X[TOP_SOURCE(h, c)], pd->halo*pd->cols, MPI_ELEM, sm->msg_up, HALO_UP_TAG,
+                      &X[BOT_TARGET(m, h, c)], pd->halo*pd->cols, MPI_ELEM, sm->msg_down, HALO_UP_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   if(ret == MPI_SUCCESS) ret = MPI_Sendrecv(&X[BOT_SOURCE(m, h, c)], pd->halo*pd->cols, MPI_ELEM, sm->msg_down, HALO_DOWN_TAG,
+                      &X[TOP_TARGET], pd->halo*pd->cols, MPI_ELEM, sm->msg_up, HALO_DOWN_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   if(handleMpiError(pd->rank, ret, "mpi_utils:exchangeShared2D:MPI_Sendrecv()") != MPI_SUCCESS) return ERROR;
+
+   // once the processes above and below on this node catch up, their rows of X are written and they
+   // stopped reading this block's rows of the other block, which is written next (the cpu is given up
+   // while waiting in case processes outnumber cores)
+   while((sm->count_up != NULL && *sm->count_up < count) || (sm->count_down != NULL && *sm->count_down < count)){
+      sched_yield();
+      MPI_Win_sync(sm->count_win);
+   }
+   syncShared(sm);
+   return SUCCESS;
+}
+
+void freeSharedData(SharedData * sm){
+   for(int b = 0; b < 2; b++){
+      MPI_Win_unlock_all(sm->win[b]);
+      MPI_Win_free(&sm->win[b]);
+   }
+   MPI_Win_unlock_all(sm->count_win);
+   MPI_Win_free(&sm->count_win);
+   MPI_Comm_free(&sm->node_comm);
+}
@@ -18,10 +18,31 @@
 #define LEFT(rank) ((EQUAL(rank,0)) ? MPI_PROC_NULL : rank-1)    // left neighbor 
 #define RIGHT(rank, first) ((first) ? MPI_PROC_NULL : rank+1)     // right neighbor
 
-#define TOP_SOURCE(n) n                                 // rank send top row
-#define BOT_SOURCE(m,n) MATRIX_COUNT((m-2),(n))         // rank send bottom row
-#define TOP_TARGET 0                                    // rank recv top row (ghost)
-#define BOT_TARGET(m,n) MATRIX_COUNT((m-1),(n))         // rank recv bottom row (ghost)
+#define TOP_SOURCE(h,n) MATRIX_COUNT((h),(n))           // rank send top h rows
+#define BOT_SOURCE(m,h,n) MATRIX_COUNT((m)-2*(h),(n))   // rank send bottom h rows
+#define TOP_TARGET 0                                    // rank recv top h rows (ghost)
+#define BOT_TARGET(m,h,n) MATRIX_COUNT((m)-(h),(n))     // rank recv bottom h rows (ghost)
+
+#define HALO_UP_TAG 100         // tag for rows sent to the block above
+#define HALO_DOWN_TAG 101       // tag for rows sent to the block below
+#define HALO_LEFT_TAG 102       // tag for columns sent to the block on the left
+#define HALO_RIGHT_TAG 103      // tag for columns sent to the block on the right
+#define HALO_REQUESTS 4         // persistent requests per block (2 sends, 2 recvs)
+
+#define CKPT_NONE 0             // root decisions after each iteration with --checkpoint
+#define CKPT_START 1
+#define CKPT_FINISH 2
+
+#if ELEM_TYPE == DOUBLE_ELEM
+#define MPI_ELEM MPI_DOUBLE     // MPI datatype of elem_t
+#else
+#define MPI_ELEM MPI_FLOAT
+#endif
+#ifdef SINGLE_PRECISION
+#define MPI_ACC MPI_FLOAT       // MPI datatype of acc_t
+#else
+#define MPI_ACC MPI_DOUBLE
+#endif
 
 /** 
  *  @struct _processData
@@ -34,20 +55,143 @@ typedef struct _processData{
     int block_size;
     int rows;
     int cols;
+    int planes;                 // # planes of a volume (3D only)
+    int halo;                   // # ghost rows (and cols) on each side of a block, the stencil radius
 }ProcessData;
 
+/** 
+ *  @struct _gridData
+ *  @typedef GridData (local)
+ *  @brief struct for a process's block in a 2D cartesian process grid over the first 2 dims of a matrix (rows, cols)
+ *         or a volume (planes, rows), the inner dim (1 for a matrix, cols for a volume) is never split, blocks have
+ *         pd->halo ghost slices on each side of both split dims, a grid of Px1 processes is row blocks (or slabs of planes)
+ */
+typedef struct _gridData{
+    MPI_Comm comm;
+    int dims[2];                // process grid along each split dim
+    int coords[2];              // this process's place in the grid
+    int prev[2];                // process before this one along each split dim (up, left | front, up)
+    int next[2];                // process after this one along each split dim (down, right | back, down)
+    int extent[2];              // global size of each split dim (with the boundary)
+    int size[2];                // block size of each split dim with ghosts (size[0] is also pd->block_size)
+    int low[2];                 // global index of the block's first ghost along each split dim
+    int inner;                  // # elements of each point of the split dims
+    MPI_Datatype face;          // halo points of each interior slice along dims[0], sent along dims[1]
+    MPI_Datatype slice;         // one whole slice along dims[0] with its ghosts
+    MPI_Datatype region;        // block part gathered by the root
+    MPI_Datatype * root_regions;    // each process's gathered part of the whole matrix or volume (root only)
+}GridData;
+
+/** 
+ *  @struct _frameData
+ *  @typedef FrameData (local)
+ *  @brief struct for writing each process's rows of every iteration into a stacked file with MPI-IO,
+ *         the 2 blocks swap every iteration so each has its own rows datatype and pending write
+ */
+typedef struct _frameData{
+    MPI_File fh;
+    MPI_Datatype rows[2];       // absolute addresses of the rows written from each block (with MPI_BOTTOM)
+    MPI_Request req[2];         // pending write from each block
+    elem_t * edge;              // matrix boundary rows of the first/last block (its ghost rows alternate)
+    MPI_Offset first;           // byte offset of this process's first row in a frame
+    MPI_Offset frame_size;      // bytes per frame
+}FrameData;
+
+/** 
+ *  @struct _bandCheckpoint
+ *  @typedef BandCheckpoint (local)
+ *  @brief struct for writing a checkpoint with MPI-IO, every row block copies its own rows of the checkpointed
+ *         iteration and writes them while the next iterations are computed
+ */
+typedef struct _bandCheckpoint{
+    MPI_File fh;
+    MPI_Request req;            // pending write of this process's rows
+    MPI_Datatype row_type;
+    CheckpointData * cd;
+    char * tmpfile;             // checkpoints are written here and renamed over cd->file
+    elem_t * rows;              // copy of this process's rows of the checkpointed iteration
+    elem_t * edge;              // matrix boundary rows of the first/last block (its ghost rows alternate)
+    MPI_Offset first;           // byte offset of this process's first row
+    int lo;                     // first row of the block written
+    int count;                  // # rows written
+    int iteration;              // iteration being written
+    int last;                   // iteration of the last checkpoint started (or the first iteration)
+    double last_time;
+    int pending;                // 1 = a checkpoint is being written
+    int saved;                  // # checkpoints written
+    int saved_iteration;        // iteration of the last checkpoint written
+}BandCheckpoint;
+
+/** 
+ *  @struct _teamMember
+ *  @typedef TeamMember (private)
+ *  @brief struct for one thread of a process's thread team, member 0 is the thread that called MPI_Init_thread
+ */
+typedef struct _teamMember{
+    struct _threadTeam * team;
+    struct _rowSums * rs;
+    double thread_compute;
+    acc_t residual;             // partial residual of this thread's share of a checked sweep
+    long active_computed[2];    // # active tiles and points computed by this thread
+    int id;
+}TeamMember;
+
+/** 
+ *  @struct _threadTeam
+ *  @typedef ThreadTeam (local)
+ *  @brief struct for a process's thread team, the main thread sets a sweep of rows lo..hi, every thread
+ *         computes its share between 2 barriers, only the main thread calls MPI (MPI_THREAD_FUNNELED)
+ */
+typedef struct _threadTeam{
+    pthread_barrier_t barrier;
+    pthread_t * threads;        // members 1..num_threads-1
+    TeamMember * members;
+    elem_t * X;
+    elem_t * Y;
+    int lo;
+    int hi;
+    int width;
+    int num_threads;
+    int stop;
+    int checking;               // 1 = the sweep gets its residual
+    int norm;                   // RESIDUAL_MAX | RESIDUAL_L2
+    int k;                      // # iterations done before the sweep (selects the changed tile map)
+    struct _activeTiles * at;   // this block's changed tile maps, threads share whole tile rows (NULL = every point is computed)
+}ThreadTeam;
+
+/** 
+ *  @struct _sharedData
+ *  @typedef SharedData (local)
+ *  @brief struct for a process's rows of both blocks in node shared memory windows, the windows are contiguous
+ *         so a block's ghost rows are the rows of the blocks above and below on the same node (read in place),
+ *         blocks on other nodes still send rows
+ */
+typedef struct _sharedData{
+    MPI_Comm node_comm;         // processes on this node
+    MPI_Win win[2];             // this node's rows of each block, in rank order
+    MPI_Win count_win;          // # exchanges done by each process on this node
+    volatile int * count;       // # exchanges done by this process
+    volatile int * count_up;    // # exchanges done by the process above if it is on this node, else NULL
+    volatile int * count_down;  // # exchanges done by the process below if it is on this node, else NULL
+    int first;                  // first row of the block in this process's window segment (halo if the rows above are the process above's)
+    int seg_rows;               // # rows of the block in this process's window segment
+    int msg_up;                 // process above if it is on another node, else MPI_PROC_NULL
+    int msg_down;               // process below if it is on another node, else MPI_PROC_NULL
+}SharedData;
+
 typedef struct _conditionBools{       
     int is_root;
     int is_parallel;
     int write_state;
     int print_state;
     int debug_on;
+    int overlap;
 }ConditionBools;
 
 typedef struct _matrixPointer{       
-    double * A;
-    double * B;
-    double * C;
+    elem_t * A;
+    elem_t * B;
+    elem_t * C;
     int * sub_offset;
     int * sub_count;
 }MatrixPointer;
@@ -76,7 +220,8 @@ void abortComm(int id, char * err_msg, int err_code);
 int handleMpiError(int rank, int err_code, char * location);
 
 /** 
- *  @brief computes offsets and displacements for MPI_Scatterv
+ *  @brief computes offsets and displacements for MPI_Scatterv, and shares the matrix order and stencil data with all p,
+ *         blocks split the rows inside the pd->halo boundary rows and have pd->halo ghost rows on each side
  *  @param sub_offset (int[]) vla for sub offset MPI_Scatterv
  *  @param sub_offset (int[]) vla for sub counts in MPI_Scatterv
  *  @param pd (ProcessData *) local struct for process data
@@ -85,4 +230,241 @@ int handleMpiError(int rank, int err_code, char * location);
  */
 int setScatterData(ProcessData * pd, MatrixPointer * mp, StencilData * sd, ConditionBools cb);
 
+/** 
+ *  @brief reads the matrix order and each process's row block (with pd->halo ghost rows) from a data file using MPI-IO,
+ *         the file must hold elem_t elements
+ *  @param X (elem_t**) block to allocate and read into
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param infile (char*) Input filename (.dat)
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: X, pd->rows, pd->cols, pd->block_size;
+ */
+int mpiReadBlock2D(elem_t ** X, ProcessData * pd, char * infile);
+
+/** 
+ *  @brief writes each process's rows of a matrix into a data file using MPI-IO, the first and last
+ *         process also write their top and bottom ghost rows, which must hold the matrix boundary rows
+ *  @param X (elem_t*) block to write
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param outfile (char*) Output filename (.dat)
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS
+ */
+int mpiWriteBlock2D(elem_t * X, ProcessData * pd, char * outfile);
+
+/** 
+ *  @brief creates persistent requests that send the first and last pd->halo rows of a block to the blocks above
+ *         and below and receive their rows into the ghost rows, start them with MPI_Startall()
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param X (elem_t*) block the requests are bound to
+ *  @param is_last (int) 1 if this is the last block (no block below)
+ *  @param req (MPI_Request*) HALO_REQUESTS requests to create
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: req;
+ */
+int initHaloRequests(ProcessData * pd, elem_t * X, int is_last, MPI_Request * req);
+
+/** 
+ *  @brief frees persistent requests from initHaloRequests()
+ *  @param req (MPI_Request*) requests to free (MPI_REQUEST_NULL is skipped)
+ *  @param count (int) # requests
+ */
+void freeHaloRequests(MPI_Request * req, int count);
+
+/** 
+ *  @brief exchanges depth rows with the blocks above and below, blocks have depth ghost rows on each side
+ *         so depth iterations can run between exchanges (ghost rows are recomputed redundantly)
+ *  @param X (elem_t*) block of block_size-2*pd->halo owned rows plus 2*depth ghost rows
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param depth (int) # ghost rows on each side (<= owned rows of every block)
+ *  @param is_last (int) 1 if this is the last block (no block below)
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: X;
+ */
+int exchangeDeepHalo2D(elem_t * X, ProcessData * pd, int depth, int is_last);
+
+/** 
+ *  @brief creates a 2D cartesian process grid over the first 2 dims of a matrix or volume and this process's block
+ *         and halo datatypes (pd->halo ghosts on each side), the order must be shared first, every process returns
+ *         ERROR for a shape that does not fit (the root prints why)
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param gd (GridData *) local struct for grid data
+ *  @param shape (char*) NULL (Px1, whole slices of dims[0]) | "auto" (MPI_Dims_create, more processes along the longer dim) | "<p>x<q>"
+ *  @param extent0 (int) # rows of a matrix | # planes of a volume
+ *  @param extent1 (int) # cols of a matrix | # rows of a volume
+ *  @param inner (int) 1 for a matrix | # cols of a volume
+ *  @param is_root (int) 1 if this process gathers the matrix or volume
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: gd, pd->block_size;
+ */
+int setGridData(ProcessData * pd, GridData * gd, char * shape, int extent0, int extent1, int inner, int is_root);
+
+/** 
+ *  @brief frees the grid communicator and datatypes from setGridData()
+ *  @param gd (GridData *) local struct for grid data
+ */
+void freeGridData(GridData * gd);
+
+/** 
+ *  @brief initializes a tile as its part of the matrix from init2D()
+ *  @param X (elem_t*) tile to initialize
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param gd (GridData *) local struct for grid data
+ */
+void initGrid2D(elem_t * X, ProcessData * pd, GridData * gd);
+
+/** 
+ *  @brief sends each process its block (with ghosts) of the root's matrix or volume
+ *  @param A (elem_t*) whole matrix or volume (root only)
+ *  @param X (elem_t*) block to receive into
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param gd (GridData *) local struct for grid data
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: X;
+ */
+int scatterGrid(elem_t * A, elem_t * X, ProcessData * pd, GridData * gd);
+
+/** 
+ *  @brief gathers each block's interior into the root's matrix or volume, edge blocks along dims[1] also send
+ *         their boundary (the boundary along dims[0] is never gathered)
+ *  @param X (elem_t*) block to send
+ *  @param A (elem_t*) whole matrix or volume (root only)
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param gd (GridData *) local struct for grid data
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: A;
+ */
+int gatherGrid(elem_t * X, elem_t * A, ProcessData * pd, GridData * gd);
+
+/** 
+ *  @brief exchanges ghost faces with the blocks along dims[1] (left/right tiles, up/down pencils), then whole
+ *         ghost slices with the blocks along dims[0], which also fills the corners (or edges) of the 9-pt (27-pt) stencil
+ *  @param X (elem_t*) block to exchange
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param gd (GridData *) local struct for grid data
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: X;
+ */
+int exchangeGrid(elem_t * X, ProcessData * pd, GridData * gd);
+
+/** 
+ *  @brief opens a stacked file sized for all iterations, every row block writes its own rows of each frame
+ *         (the first and last blocks also write the pd->halo boundary rows kept from X), call on every process
+ *  @param fr (FrameData *) local struct for frame data
+ *  @param X (elem_t*) block holding the initial rows (block 0), written as frame 0
+ *  @param Y (elem_t*) other block
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param iterations (int) # iterations (the file holds iterations+1 frames)
+ *  @param stacked_file (char*) stacked filename (.raw)
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: fr;
+ */
+int openFrames2D(FrameData * fr, elem_t * X, elem_t * Y, ProcessData * pd, int iterations, char * stacked_file);
+
+/** 
+ *  @brief starts a non-blocking collective write of this process's rows of a frame, the block must not be
+ *         modified before waitFrame2D() returns for it
+ *  @param fr (FrameData *) local struct for frame data
+ *  @param block (int) 0 = X, 1 = Y from openFrames2D()
+ *  @param frame (int) frame index (0 = initial matrix)
+ *  @param rank (int) process rank
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS
+ */
+int writeFrame2D(FrameData * fr, int block, int frame, int rank);
+
+/** 
+ *  @brief waits for the pending frame write from a block so it can be modified
+ *  @param fr (FrameData *) local struct for frame data
+ *  @param block (int) 0 = X, 1 = Y from openFrames2D()
+ *  @param rank (int) process rank
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS
+ */
+int waitFrame2D(FrameData * fr, int block, int rank);
+
+/** 
+ *  @brief waits for pending frame writes and closes the stacked file from openFrames2D()
+ *  @param fr (FrameData *) local struct for frame data
+ *  @param rank (int) process rank
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS
+ */
+int closeFrames2D(FrameData * fr, int rank);
+
+/** 
+ *  @brief waits for pending frame writes and cuts the stacked file from openFrames2D() down to the iterations
+ *         computed when the run stopped early (collective)
+ *  @param fr (FrameData *) local struct for frame data
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param iterations (int) # iterations written after the initial matrix
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS
+ */
+int truncateFrames2D(FrameData * fr, ProcessData * pd, int iterations);
+
+/** 
+ *  @brief allocates the copy of this process's rows for checkpoints written with MPI-IO, the first and last
+ *         blocks keep their pd->halo boundary rows from X
+ *  @param bc (BandCheckpoint *) local struct for checkpoint data
+ *  @param cd (CheckpointData *) checkpoint file and interval
+ *  @param X (elem_t*) block read from infile (or the checkpoint)
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param start (int) iteration of the matrix before the first iteration
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: bc;
+ */
+int openBandCheckpoint(BandCheckpoint * bc, CheckpointData * cd, elem_t * X, ProcessData * pd, int start);
+
+/** 
+ *  @brief decides on the root whether to start a checkpoint or finish the pending one
+ *  @param bc (BandCheckpoint *) local struct for checkpoint data
+ *  @param iteration (int) iteration of the latest block
+ *  @param rank (int) process rank
+ *  @return [value]: CKPT_NONE | CKPT_START if one is due | CKPT_FINISH if the root's rows are written | -1 = ERROR
+ */
+int claimBandCheckpoint(BandCheckpoint * bc, int iteration, int rank);
+
+/** 
+ *  @brief copies this process's rows of a block and starts a non-blocking collective write of them into a
+ *         temporary checkpoint file, the root also writes the metadata and trailer
+ *  @param bc (BandCheckpoint *) local struct for checkpoint data
+ *  @param X (elem_t*) block holding the iteration, can be modified as soon as this returns
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param iteration (int) iteration of X
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS
+ */
+int startBandCheckpoint(BandCheckpoint * bc, elem_t * X, ProcessData * pd, int iteration);
+
+/** 
+ *  @brief waits for the pending write, flushes and closes the temporary checkpoint file, and renames it over the checkpoint file
+ *  @param bc (BandCheckpoint *) local struct for checkpoint data
+ *  @param pd (ProcessData *) local struct for process data
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS
+ */
+int finishBandCheckpoint(BandCheckpoint * bc, ProcessData * pd);
+
+/** 
+ *  @brief finishes a pending checkpoint and deallocates the rows from openBandCheckpoint()
+ *  @param bc (BandCheckpoint *) local struct for checkpoint data
+ *  @param pd (ProcessData *) local struct for process data
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS
+ */
+int closeBandCheckpoint(BandCheckpoint * bc, ProcessData * pd);
+
+/** 
+ *  @brief groups processes by node and moves this process's rows of both blocks into shared memory windows, blocks
+ *         next to each other on the node overlap so each reads the rows of the processes above and below in place
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param sm (SharedData *) local struct for shared memory data
+ *  @param X (elem_t**) first block, its rows are copied into the window (the caller frees the old block)
+ *  @param Y (elem_t**) second block, its rows are copied into the window (the caller frees the old block)
+ *  @param is_last (int) 1 if this is the last block (no block below)
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: sm, X, Y;
+ */
+int setSharedData(ProcessData * pd, SharedData * sm, elem_t ** X, elem_t ** Y, int is_last);
+
+/** 
+ *  @brief exchanges ghost rows, rows go to and come from blocks on other nodes, processes on this node only
+ *         count their exchanges in the window and wait for the counts of the processes above and below,
+ *         so a process only waits for its own neighbors and no rows are copied
+ *  @param X (elem_t*) block to exchange (must be the same block on every process)
+ *  @param pd (ProcessData *) local struct for process data
+ *  @param sm (SharedData *) local struct for shared memory data
+ *  @return [value]: -1 = ERROR | 0 = SUCCESS; [args]: X;
+ */
+int exchangeShared2D(elem_t * X, ProcessData * pd, SharedData * sm);
+
+/** 
+ *  @brief frees the shared memory windows (and both blocks in them) and the node communicator
+ *  @param sm (SharedData *) local struct for shared memory data
+ */
+void freeSharedData(SharedData * sm);
+
 #endif /* MPI_UTILS_ */
\ No newline at end of file
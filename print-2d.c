@@ -3,30 +3,56 @@
  * @author Leslie Horace
  * @brief Main program to read a matrix from and file print it's contents to the console
  * @version 2.0
- * 
+ *
  */
-    
+
 #include "utilities.h"
+#include "stack_utils.h"
 
 int main(int argn, char **argv) {
     int ret = EXIT_FAILURE;
-    // check if all args were entered 
-    if (argn != 2) {       
-        printf("Usage: %s <input_data_file>\n", argv[0]);
+    // frame k of a compressed stacked file (.stk) instead of a data file
+    char * frame_arg = NULL;
+    int frame = -1, found = popOption(&argn, argv, "--frame", &frame_arg);
+    if(found == ERROR) goto end;
+    if(found && (frame = parseInt(frame_arg, 0, SKIP_ARG, "--frame")) == ERROR) goto end;
+    // check if all args were entered
+    if (argn != 2) {
+        printf("Usage: %s <input_data_file> [--frame <k>]\n", argv[0]);
         goto end;
     }
-    int m = 0, n = 0; 
+    int m = 0, n = 0;
     char * infile = argv[1];
-    double * A = NULL;
+    elem_t * A = NULL;
 
+    if(frame >= 0){
+        // decode frame k from a compressed stacked file
+        StackReader sr;
+        if(openStackReader(&sr, infile) == ERROR) goto end;
+        printf("Reading frame %d (iteration %d) from '%s'\n", frame, frame*sr.hdr.sample.every, infile);
+        m = sr.hdr.rows, n = sr.hdr.cols;
+        if((A = malloc(MATRIX_SIZE(m, n))) == NULL){
+            printf("Error [print-2d:main:malloc()]: Failed to allocate %d x %d matrix\n", m, n);
+            closeStackReader(&sr);
+            goto end;
+        }
+        int read_ret = readStackFrame(&sr, frame, A);
+        closeStackReader(&sr);
+        if(read_ret == ERROR){
+            free(A);
+            goto end;
+        }
+    }
     // read in matrix from (.dat) file
-    printf("Reading data from '%s'\n", infile);
-    if(read2D(&A, &m, &n, infile) == ERROR) goto end;
+    else{
+        printf("Reading data from '%s'\n", infile);
+        if(read2D(&A, &m, &n, infile) == ERROR) goto end;
+    }
     print2D(A, m, n);       // print the matrix
     free(A);
 
     ret = EXIT_SUCCESS;
 
 end:
-    exit(ret); 
+    exit(ret);
 }
@@ -1,63 +1,284 @@
 /**
  * @file pth-stencil-2d.c
  * @author Leslie Horace
- * @brief Main program for performing and recording 9-pt serial stencil operations
+ * @brief Main program for performing and recording threaded stencil operations (9-pt by default)
  * @version 2.0
  */
-#include "utilities.h"
+#include "kernel_utils.h"
+#include "writer_utils.h"
+
+/**
+ *  @brief Computes the rows between two time blocked thread blocks that were skipped by their shrinking edges
+ *  @param X (elem_t*) Matrix written on odd steps
+ *  @param Y (elem_t*) Matrix written on even steps
+ *  @param edge (int) last row of the upper thread block
+ *  @param steps (int) # iterations in the time block
+ *  @param n (int) # columns
+ *  @param rs (RowSums*) row sum buffer for each step (NULL = box kernel)
+ */
+void pthTriangleFill(elem_t *X, elem_t *Y, int edge, int steps, int n, RowSums * rs){
+    int r = stencilRadius2D();
+    resetRowSums(rs, steps);
+    // step t is missing rows edge-t*r+1 .. edge+t*r, each step widens by the stencil radius on both sides
+    for(int t = 1; t < steps; t++){
+        for(int i = edge-t*r+1; i <= edge+t*r; i++){
+            if(t % 2 == 0) stencilRow2D(X, Y, i, n, (rs) ? &rs[t] : NULL);
+            else stencilRow2D(Y, X, i, n, (rs) ? &rs[t] : NULL);
+        }
+    }
+}
+
+/**
+ *  @brief Publishes the # of phases this thread has completed (release)
+ *  @param tp (ThreadPrivate*) thread private data
+ *  @param count (int) # completed phases
+ */
+void pthPublish(ThreadPrivate * tp, int count){
+    __atomic_store_n(&tp->t_shared->progress[tp->rank].count, count, __ATOMIC_RELEASE);
+}
+
+/**
+ *  @brief Waits until the neighboring blocks have completed at least count phases (acquire)
+ *  @param tp (ThreadPrivate*) thread private data
+ *  @param count (int) # phases the neighbors must complete
+ *  @param check_prev (int) 1 = wait on block above
+ *  @param check_next (int) 1 = wait on block below
+ */
+void pthWaitNeighbors(ThreadPrivate * tp, int count, int check_prev, int check_next){
+    Progress * p = tp->t_shared->progress;
+    int prev = tp->rank-1, next = tp->rank+1, spins = 0;
+    if(prev < 0 || !check_prev) prev = tp->rank;    // nothing above, check self instead
+    if(next >= tp->t_shared->num_threads || !check_next) next = tp->rank;
+    while(__atomic_load_n(&p[prev].count, __ATOMIC_ACQUIRE) < count || __atomic_load_n(&p[next].count, __ATOMIC_ACQUIRE) < count){
+        if(++spins > 1000) sched_yield();   // give up the core if the neighbor is far behind
+    }
+}
+
+/**
+ *  @brief Pins the calling thread to its cpu from the cpu list (rank % # cpus)
+ *  @param tp (ThreadPrivate*) thread private data
+ */
+void pthPin(ThreadPrivate * tp){
+    cpu_set_t cpu_set;
+    int ret = 0;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(tp->t_shared->cpus[tp->rank % tp->t_shared->num_cpus], &cpu_set);
+    // not fatal, thread runs unpinned
+    if((ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set)) != SUCCESS){
+        errno = ret;
+        perror("Warning [pth-stencil-2d:pthPin:pthread_setaffinity_np()]");
+    }
+}
+
+/**
+ *  @brief Resets this thread's tile deque to its static share of the tiles for the next iteration
+ *  @param tp (ThreadPrivate*) thread private data
+ */
+void pthTileReset(ThreadPrivate * tp){
+    TileQueue * q = &tp->t_shared->queues[tp->rank];
+    int p = tp->t_shared->num_threads, nt = tp->t_shared->num_tiles;
+    pthread_mutex_lock(&q->lock);
+    q->head = BLOCK_LOW(tp->rank, p, nt);
+    q->tail = BLOCK_HIGH(tp->rank, p, nt)+1;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ *  @brief Pops the next tile from this thread's deque, or steals the last tile of another thread's deque
+ *  @param tp (ThreadPrivate*) thread private data
+ *  @return [val]: tile index | ERROR (-1) if every deque is empty
+ */
+int pthTileNext(ThreadPrivate * tp){
+    int p = tp->t_shared->num_threads, tile = ERROR;
+    // check own deque first, then the others round robin
+    for(int v = 0; v < p && tile == ERROR; v++){
+        TileQueue * q = &tp->t_shared->queues[(tp->rank+v) % p];
+        pthread_mutex_lock(&q->lock);
+        if(q->head < q->tail) tile = (v == 0) ? q->head++ : --q->tail;
+        pthread_mutex_unlock(&q->lock);
+        if(v > 0 && tile != ERROR) tp->tiles_stolen++;
+    }
+    return tile;
+}
+
+/**
+ *  @brief Computes every tile of one iteration with the dynamic tile scheduler
+ *  @param tp (ThreadPrivate*) thread private data
+ *  @param X (elem_t*) Matrix being modified
+ *  @param Y (elem_t*) Matrix for computations
+ *  @param k (int) # iterations done (selects the changed tile map with --active-tiles)
+ *  @param checking (int) 1 = get the residual of this thread's tiles
+ *  @return [val]: partial residual of this thread's tiles (0 if not checking)
+ */
+acc_t pthTileSweep(ThreadPrivate * tp, elem_t *X, elem_t *Y, int k, int checking){
+    int rows = tp->m_data->rows, cols = tp->m_data->cols, tile = 0, r0 = 0, j0 = 0, norm = tp->s_data->res.norm, r = stencilRadius2D();
+    int tr = tp->t_shared->tile_rows, tc = tp->t_shared->tile_cols, tiles_per_row = (cols-2*r+tc-1)/tc;
+    acc_t residual = 0, part = 0;
+    pthTileReset(tp);
+    while((tile = pthTileNext(tp)) != ERROR){
+        r0 = r + (tile/tiles_per_row)*tr;
+        j0 = r + (tile%tiles_per_row)*tc;
+        // the active tiles have the same shape, unchanged neighborhoods are skipped
+        if(tp->t_shared->at != NULL){
+            part = activeTile2D(tp->t_shared->at, X, Y, tile, k, tp->rs, checking, norm, tp->active_computed);
+            residual = RESIDUAL_SUM(residual, part, norm);
+            continue;
+        }
+        if(!checking){
+            stencilTile2D(X, Y, r0, MIN(r0+tr-1, rows-1-r), j0, MIN(j0+tc, cols-r), cols, tp->rs);
+            continue;
+        }
+        part = residualTile2D(X, Y, r0, MIN(r0+tr-1, rows-1-r), j0, MIN(j0+tc, cols-r), cols, tp->rs, norm);
+        residual = RESIDUAL_SUM(residual, part, norm);
+    }
+    return residual;
+}
+
+/**
+ *  @brief Combines every thread's partial residual of a checked chunk, called by every thread after the chunk's
+ *         barrier so all threads get the same residual and stop on the same iteration, rank 0 records it
+ *  @param tp (ThreadPrivate*) thread private data
+ *  @param chunk (int) chunk index (partials of even and odd chunks are kept apart)
+ *  @param iteration (int) checked iteration
+ *  @return [val]: converged (1) | not converged (0)
+ */
+int pthConverged(ThreadPrivate * tp, int chunk, int iteration){
+    ResidualData * res = &tp->s_data->res;
+    acc_t * part = &tp->t_shared->residuals[(chunk%2)*tp->t_shared->num_threads], residual = part[0];
+    double value = 0.0;
+    for(int tid = 1; tid < tp->t_shared->num_threads; tid++) residual = RESIDUAL_SUM(residual, part[tid], res->norm);
+    value = residualNorm(res, residual);
+    return (tp->rank == 0) ? residualConverged(res, value, iteration) : (value <= res->tolerance);
+}
+
+/**
+ *  @brief Claims a checkpoint of the iteration a chunk ends on if one is due, called by rank 0 before the chunk's
+ *         last barrier so every thread sees the claim after it and copies its rows in the next chunk
+ *  @param tp (ThreadPrivate*) thread private data
+ *  @param chunk (int) chunk index
+ *  @param end (int) # iterations done at the end of the chunk (the last iteration is the outfile)
+ */
+void pthClaimCheckpoint(ThreadPrivate * tp, int chunk, int end){
+    ThreadShared * ts = tp->t_shared;
+    int claimed = (end < tp->s_data->iterations) ? claimCheckpoint(ts->cp, tp->s_data->start+end) : 0;
+    if(claimed == ERROR) ts->write_error = 1;
+    ts->ckpt_due[chunk%2] = (claimed == 1);
+}
 
 void * pthStencilLoop(void* tp_ptr){
     ThreadPrivate * tp = tp_ptr;
     double start_compute = 0.0, end_compute = 0.0;
-    size_t w_count = 0, m_count = MATRIX_COUNT(tp->m_data->rows,tp->m_data->cols);
-    double * A = tp->m_data->A, * B = tp->m_data->B;
-    FILE * fp = NULL;
-    int ret = 0;
+    elem_t * A = tp->m_data->A, * B = tp->m_data->B;
+    int rows = tp->m_data->rows, cols = tp->m_data->cols, block_end = tp->block_start+tp->block_size-1, r = stencilRadius2D();
+    StackedWriter sw;
+    Checkpointer * cp = tp->t_shared->cp;
+    ActiveTiles * at = tp->t_shared->at;
+    int ret = 0, steps = 1, phase = 0, writing = 0, chunk = 0, copying = 0, checking = 0;
+    acc_t residual = 0;
+    int first = (tp->rank == 0) ? 0 : tp->block_start;
+    int last = (tp->rank == tp->t_shared->num_threads-1) ? rows-1 : block_end;
+
+    // pin this thread before touching any memory
+    if(tp->t_shared->cpus != NULL) pthPin(tp);
+    // first touch this block's rows (+ boundary rows) so its pages are on this thread's NUMA node
+    if(tp->t_shared->first_touch){
+        if(readRows2D(A, cols, first, last-first+1, tp->f_data->initfile) == ERROR) tp->t_shared->init_error = 1;
+        // a restart continues from the checkpoint read into A
+        if(tp->f_data->ckpt.restart) memcpy(&B[IDX((long)first,0,(long)cols)], &A[IDX((long)first,0,(long)cols)], MATRIX_SIZE(last-first+1, cols));
+        else init2D(&B[IDX((long)first,0,(long)cols)], last-first+1, cols);
+        // wait for all rows before any thread reads its neighbor's rows
+        ret = pthread_barrier_wait(&tp->t_shared->barrier);
+        if(handleBarrier(ret, "Error [pth-stencil-2d:pthStencilLoop:pthread_barrier_wait()]") == ERROR) goto stop_all;
+        if(tp->t_shared->init_error) goto stop_all;
+    }
 
     if(tp->rank == 0){
         // check if debugging is level 2 for printing matrix state
         if(tp->s_data->debug_level == 2) print2D(B, tp->m_data->rows, tp->m_data->cols);
         // check if writeRaw option is true for stacked raw file
         if(tp->f_data->allfile != NULL){
-            // open the file for writing and check for errors
-            if ((fp = fopen(tp->f_data->allfile, "wb")) == NULL){
-                printf("Error: cannot open/write to '%s'\n", tp->f_data->allfile);
-                goto stop_all;
-            }
-            // write to stacked raw file and check for errors
-            w_count = fwrite(B, DOUBLE_SIZE, m_count, fp);
-            if(handleIOError(fp, w_count, m_count, "[pthStencilLoop:fwrite()]") == ERROR) goto stop_write;
+            // start the stacked file writer thread so other threads never wait on rank 0's writes,
+            // a write error stops writing but not the iterations, other threads are waiting at barriers
+            writing = (openStackedWriter(&sw, tp->f_data, rows, cols, tp->s_data->iterations) == SUCCESS);
+            if(!writing || pushSnapshot(&sw, B) == ERROR) tp->t_shared->write_error = 1;
         }
     }
 
-    // start blocked stencil iterations 
-    for(int i = 0; i< tp->s_data->iterations; i++){
+    // start blocked stencil iterations in chunks of time_block steps, a checked iteration is a chunk of its own
+    // each chunk is 2 phases (trapezoid, triangle), phase counts are only used by neighbor sync
+    for(int k = 0; k < tp->s_data->iterations; k += steps, phase += 2, chunk++){
+        steps = residualSteps(&tp->s_data->res, tp->s_data->start+k, MIN(tp->s_data->time_block, tp->s_data->iterations-k));
+        checking = residualDue(&tp->s_data->res, tp->s_data->start+k+steps);
+        // copy this block's rows of a checkpoint claimed at the end of the last chunk, B is not written before this block's step 2
+        copying = (cp != NULL && chunk > 0 && tp->t_shared->ckpt_due[(chunk-1)%2]);
+        if(copying && last >= first) memcpy(&cp->X[IDX((long)first,0,(long)cols)], &B[IDX((long)first,0,(long)cols)], MATRIX_SIZE(last-first+1, cols));
+        // wait for neighbors to finish the last chunk, they read and write rows next to this block
+        if(tp->t_shared->neighbor_sync) pthWaitNeighbors(tp, phase, 1, 1);
         GET_TIME(start_compute);  
-        // perform blocked stencil algorithm
-        for(int i = tp->block_start; i < (tp->block_start+tp->block_size); i++){
-            stencil2D(A, B, i, tp->m_data->cols);  
+        // perform tiled or blocked stencil algorithm, block edges next to other threads shrink each step
+        residual = 0;
+        if(tp->t_shared->num_tiles > 0){
+            residual = pthTileSweep(tp, A, B, k, checking);
+        }else if(at != NULL){
+            // each thread computes whole tile rows, the changed maps are shared so tiles next to other threads are still skipped
+            residual = activeSweep2D(at, A, B, BLOCK_LOW(tp->rank, tp->t_shared->num_threads, at->tiles_r)*at->tiles_c, 
+                (BLOCK_HIGH(tp->rank, tp->t_shared->num_threads, at->tiles_r)+1)*at->tiles_c, k, tp->rs, checking, tp->s_data->res.norm, tp->active_computed);
+        }else if(tp->block_size > 0 && checking){
+            residual = residualSweep2D(A, B, tp->block_start, block_end, cols, tp->rs, tp->s_data->res.norm);
+        }else if(tp->block_size > 0){
+            timeBlock2D(A, B, tp->block_start, block_end, steps, (tp->block_start > r), (block_end < rows-1-r), cols, tp->rs);
         }
         GET_TIME(end_compute);  
         tp->thread_compute += (end_compute-start_compute);  
+        if(checking) tp->t_shared->residuals[(chunk%2)*tp->t_shared->num_threads+tp->rank] = residual;
+
+        if(tp->t_shared->neighbor_sync){
+            pthPublish(tp, phase+1);
+        }else{
+            if(tp->rank == 0 && cp != NULL && steps == 1) pthClaimCheckpoint(tp, chunk, k+steps);
+            // wait for all threads to finish this iteration andbreak if error
+            ret = pthread_barrier_wait(&tp->t_shared->barrier);
+            if(handleBarrier(ret, "Error [pth-stencil-2d:pthStencilLoop:pthread_barrier_wait()]") == ERROR) break; 
+            // every thread has copied its rows of the claimed checkpoint
+            if(tp->rank == 0 && copying) queueCheckpoint(cp);
+        }
+
+        if(steps > 1){
+            // triangle reads and writes the next block's trapezoid rows
+            if(tp->t_shared->neighbor_sync) pthWaitNeighbors(tp, phase+1, 0, 1);
+            GET_TIME(start_compute);  
+            // fill in the triangle between this block and the next block skipped by the shrinking edges
+            if(block_end < rows-1-r) pthTriangleFill(A, B, block_end, steps, cols, tp->rs);
+            GET_TIME(end_compute);  
+            tp->thread_compute += (end_compute-start_compute);  
+            if(!tp->t_shared->neighbor_sync){
+                if(tp->rank == 0 && cp != NULL) pthClaimCheckpoint(tp, chunk, k+steps);
+                ret = pthread_barrier_wait(&tp->t_shared->barrier);
+                if(handleBarrier(ret, "Error [pth-stencil-2d:pthStencilLoop:pthread_barrier_wait()]") == ERROR) break; 
+            }
+        }
+        if(tp->t_shared->neighbor_sync) pthPublish(tp, phase+2);
 
-        // wait for all threads to finish this iteration andbreak if error
-        ret = pthread_barrier_wait(&tp->t_shared->barrier);
-        if(handleBarrier(ret, "Error [pth-stencil-2d:pthStencilLoop:pthread_barrier_wait()]") == ERROR) break; 
         if(tp->rank == 0){
             // print matrix state if debug level is 2
             if(tp->s_data->debug_level == 2) print2D(A, tp->m_data->rows, tp->m_data->cols);
-            // write to stacked raw file if exists, stop if error
-            if(tp->f_data->allfile != NULL){
-                w_count = fwrite(A, DOUBLE_SIZE, m_count, fp);
-                if(handleIOError(fp, w_count, m_count, "[pth-stencil-2d:pthStencilLoop:fwrite()]") == ERROR) goto stop_write;
-            }
+            // queue a snapshot for the stacked raw file, A is only read until the next barrier
+            if(writing && !tp->t_shared->write_error && pushSnapshot(&sw, A) == ERROR) tp->t_shared->write_error = 1;
         }
 
-        // swap matrix pointers for next iteration
-        swap2D(&A, &B); 
+        // swap matrix pointers for next iteration if the last step was written to A
+        if(steps % 2) swap2D(&A, &B); 
+        // every thread stops once the field has stopped changing, B is the outfile
+        if(checking && pthConverged(tp, chunk, tp->s_data->start+k+steps)) break;
     }
 
-    // set local matrix ptrs back to shared matrix ptrs
+    // set local matrix ptrs back to shared matrix ptrs, with neighbor sync every
+    // thread must be done (and done reading the shared ptrs) before they change
+    if(tp->rank == 0 && tp->t_shared->neighbor_sync){
+        for(int tid = 1; tid < tp->t_shared->num_threads; tid++){
+            while(__atomic_load_n(&tp->t_shared->progress[tid].count, __ATOMIC_ACQUIRE) < phase) sched_yield();
+        }
+    }
     if(tp->rank == 0) {
         tp->m_data->A = A;
         tp->m_data->B = B;
@@ -65,8 +286,8 @@ void * pthStencilLoop(void* tp_ptr){
     // max thread time is the overall compute time
     if(MAX(tp->s_data->compute_time, tp->thread_compute) == tp->thread_compute) tp->s_data->compute_time = tp->thread_compute;
 
-stop_write:
-    if(tp->f_data->allfile != NULL && tp->rank == 0) fclose(fp);
+    // wait for queued iterations to be written
+    if(writing && closeWriter(&sw) == ERROR) tp->t_shared->write_error = 1;
 stop_all:
     return NULL;
 }
@@ -76,48 +297,226 @@ int main(int argc, char **argv) {
     double start_overall = 0.0, end_overall = 0.0;
     GET_TIME(start_overall);                                 
 
+    // initialize structs shared between threads
+    StencilData sd = {.iterations=0,.start=0,.debug_level=0,.time_block=1,.compute_time=0.0};
+    ThreadShared ts = {.num_threads=0, .neighbor_sync=0, .first_touch=0, .num_cpus=0, .init_error=0, .write_error=0, 
+        .tile_rows=0, .tile_cols=0, .num_tiles=0, .cpus=NULL, .ckpt_due={0, 0}, .progress=NULL, .queues=NULL, .cp=NULL, .residuals=NULL, .at=NULL};
+    ActiveTiles at;
+    Checkpointer cp;
+    // parse optional args first so only positional args remain
+    if((sd.time_block = parseIntOption(&argc, argv, "--time-block", 1, SKIP_ARG, 1)) == ERROR) goto end_all;
+    char * simd = NULL, * kernel = NULL, * strip = NULL, * sync = NULL, * pin = NULL, * tiles = NULL, * active = NULL, * stencil = NULL;
+    int tile_rows = 0, tile_cols = 0, radius = 1, interior = 0;
+    int fast_math = popOption(&argc, argv, "--fast-math", NULL);
+    ts.first_touch = popOption(&argc, argv, "--first-touch", NULL);
+    int use_mmap = popOption(&argc, argv, "--mmap", NULL);
+    int direct_io = popOption(&argc, argv, "--direct-io", NULL);
+    int write_buffers = parseIntOption(&argc, argv, "--write-buffers", 1, SKIP_ARG, WRITER_BUFFERS);
+    if(write_buffers == ERROR) goto end_all;
+    int compress_workers = parseIntOption(&argc, argv, "--compress", 1, SKIP_ARG, 0);
+    if(compress_workers == ERROR) goto end_all;
+    SampleData sample;
+    if(parseSampleOptions(&argc, argv, &sample) == ERROR) goto end_all;
+    CheckpointData ckpt;
+    if(parseCheckpointOptions(&argc, argv, &ckpt) == ERROR) goto end_all;
+    if(parseResidualOptions(&argc, argv, &sd.res) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--pin", &pin) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--tiles", &tiles) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--sync", &sync) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--simd", &simd) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--kernel", &kernel) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--strip", &strip) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--active-tiles", &active) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--stencil", &stencil) == ERROR) goto end_all;
+
     // check if 6 or 7 args were entered
     if (argc < 6 || argc > 7){ 
-        printf("Usage: %s <num_iterations> <infile> <outfile> <debug_level[0-2]> <num_threads> <all_stacked_file (optional)>\n", argv[0]);
+        printf("Usage: %s <num_iterations> <infile> <outfile> <debug_level[0-2]> <num_threads> <all_stacked_file (optional)> [--time-block <k>] [--simd <auto|avx512|avx2|sse2|scalar>] [--kernel <box|separable>] [--fast-math] [--strip <auto|cols>] [--sync <barrier|neighbor>] [--pin <cpu_list>] [--first-touch] [--tiles <rows>x<cols>] [--mmap] [--write-buffers <n>] [--direct-io] [--compress <workers>] [--every <n>] [--roi <rows>x<cols>+<row>+<col>] [--pool <k>] [--checkpoint <file>] [--checkpoint-every <n>] [--checkpoint-secs <t>] [--restart] [--tolerance <tol>] [--residual <max|l2>] [--check-every <k>] [--active-tiles <rows>x<cols>] [--stencil <5pt|9pt|13pt|25pt|file>]\n", argv[0]);
         goto end_all;
     }
+    // parse cpu list for pinning threads, thread i is pinned to cpus[i % num_cpus]
+    if(pin != NULL && (ts.num_cpus = parseCpuList(pin, &ts.cpus)) == ERROR) goto end_all;
+    // select the stencil, then the best row kernel for this cpu (or the requested one)
+    if(setStencil2D(stencil) == ERROR) goto end_all;
+    if(setKernel2D(simd, kernel, fast_math) == ERROR) goto end_all;
+    radius = stencilRadius2D();
+    if(setStripWidth2D(strip) == ERROR) goto end_all;
+    // strips of a time block would need the next strip's columns from earlier steps
+    if(strip != NULL && sd.time_block > 1){
+        printf("Warning [pth-stencil-2d:main]: --strip ignored for time blocks with --time-block[%d] > 1\n", sd.time_block);
+    }
+    // compressed frames have no fixed offsets to write with O_DIRECT
+    if(compress_workers > 0 && direct_io){
+        printf("Warning [pth-stencil-2d:main]: --direct-io ignored with --compress\n");
+        direct_io = 0;
+    }
 
-    // initialize structs shared between threads
-    StencilData sd = {.iterations=0,.debug_level=0,.compute_time=0.0};
-    ThreadShared ts = {.num_threads=0};
-    FileData fd = {argv[2], argv[3], (argc == 7) ? argv[6] : NULL};
-    MatrixData md = {NULL, NULL, 0, 0};
+    FileData fd = {.initfile=argv[2], .finalfile=argv[3], .allfile=(argc == 7) ? argv[6] : NULL, 
+        .write_buffers=write_buffers, .direct_io=direct_io, .compress_workers=compress_workers, .sample=sample, .ckpt=ckpt};
+    MatrixData md = {.A=NULL, .B=NULL, .rows=0, .cols=0, .map_in=NULL, .map_out=NULL};
 
     // parse <num_iterations> <debug_level[0-2]> <num_threads> arguments, end if error
     if((sd.iterations = parseInt(argv[1], 1, SKIP_ARG, "num_iterations")) == ERROR) goto end_all;
     if((sd.debug_level = parseInt(argv[4], 0, 2, "debug_level")) == ERROR) goto end_all;
     if((ts.num_threads = parseInt(argv[5], 1, SKIP_ARG, "num_threads")) == ERROR) goto end_all;
+    // read the rest of the iterations from the checkpoint, which becomes the input file
+    if(fd.ckpt.restart && setRestart(&sd, &fd) == ERROR) goto end_all;
+    // parse tile shape for the dynamic tile scheduler and for active tiles
+    if(tiles != NULL && parseTileShape(tiles, "--tiles", &ts.tile_rows, &ts.tile_cols) == ERROR) goto end_all;
+    if(active != NULL && parseTileShape(active, "--active-tiles", &tile_rows, &tile_cols) == ERROR) goto end_all;
+    // scheduled tiles are the active tiles
+    if(active != NULL && tiles != NULL && (tile_rows != ts.tile_rows || tile_cols != ts.tile_cols)){
+        printf("Warning [pth-stencil-2d:main]: --active-tiles %s replaced by --tiles %s\n", active, tiles);
+    }
+    if(active != NULL && tiles != NULL){
+        tile_rows = ts.tile_rows;
+        tile_cols = ts.tile_cols;
+    }
+    // check sync mode, barrier is the default
+    if(sync != NULL && strcmp(sync, "neighbor") == 0) ts.neighbor_sync = 1;
+    else if(sync != NULL && strcmp(sync, "barrier") != 0){
+        printf("Error [pth-stencil-2d:main]: unknown --sync '%s' [barrier|neighbor]\n", sync);
+        goto end_all;
+    }
+    // tiles are handed out at runtime, so no thread knows which rows its neighbors compute
+    if(ts.tile_rows > 0 && sd.time_block > 1){
+        printf("Warning [pth-stencil-2d:main]: --time-block[%d] ignored with --tiles\n", sd.time_block);
+        sd.time_block = 1;
+    }
+    if(ts.tile_rows > 0 && ts.neighbor_sync){
+        printf("Warning [pth-stencil-2d:main]: --sync neighbor ignored with --tiles\n");
+        ts.neighbor_sync = 0;
+    }
+    // every iteration is needed for printing or the stacked file, so time blocking and neighbor sync are turned off
+    if((fd.allfile != NULL || sd.debug_level == 2) && sd.time_block > 1){
+        printf("Warning [pth-stencil-2d:main]: --time-block[%d] ignored when printing or writing all stacked file\n", sd.time_block);
+        sd.time_block = 1;
+    }
+    if((fd.allfile != NULL || sd.debug_level == 2) && ts.neighbor_sync){
+        printf("Warning [pth-stencil-2d:main]: --sync neighbor ignored when printing or writing all stacked file\n");
+        ts.neighbor_sync = 0;
+    }
+    // threads far ahead of their neighbors would overwrite rows of a checkpoint before they are copied
+    if(fd.ckpt.file != NULL && ts.neighbor_sync){
+        printf("Warning [pth-stencil-2d:main]: --sync neighbor ignored with --checkpoint\n");
+        ts.neighbor_sync = 0;
+    }
+    // every thread needs every other thread's residual to agree on when to stop
+    if(sd.res.tolerance > 0.0 && ts.neighbor_sync){
+        printf("Warning [pth-stencil-2d:main]: --sync neighbor ignored with --tolerance\n");
+        ts.neighbor_sync = 0;
+    }
+    // skipped tiles are only known one iteration at a time, and every thread reads the whole changed map
+    if(active != NULL && sd.time_block > 1){
+        printf("Warning [pth-stencil-2d:main]: --time-block[%d] ignored with --active-tiles\n", sd.time_block);
+        sd.time_block = 1;
+    }
+    if(active != NULL && ts.neighbor_sync){
+        printf("Warning [pth-stencil-2d:main]: --sync neighbor ignored with --active-tiles\n");
+        ts.neighbor_sync = 0;
+    }
+    if(active != NULL && strip != NULL){
+        printf("Warning [pth-stencil-2d:main]: --strip ignored with --active-tiles\n");
+        setStripWidth2D(strip = NULL);
+    }
 
-    // read in matrix A from infile and check for errors
-    if(read2D(&md.A, &md.rows, &md.cols, fd.initfile) == ERROR) goto end_all;
+    // mapped pages belong to the page cache, so threads cannot place them by touching them first
+    if(use_mmap && ts.first_touch){
+        printf("Warning [pth-stencil-2d:main]: --first-touch ignored with --mmap\n");
+        ts.first_touch = 0;
+    }
+    // map infile and outfile as the matrices, or read in matrix A from infile, 
+    // or only its order if each thread first touches its own rows
+    if(use_mmap){
+        if(mapMatrices2D(&md, sd.iterations, fd.initfile, fd.finalfile) == ERROR) goto end_all;
+    }else if(ts.first_touch){
+        if(readHeader2D(&md.rows, &md.cols, fd.initfile) == ERROR) goto end_all;
+        if(malloc1D((void*)&md.A, MATRIX_SIZE(md.rows, md.cols), "md.A") == ERROR) goto end_all;
+    }else if(read2D(&md.A, &md.rows, &md.cols, fd.initfile) == ERROR) goto end_all;
+    // the outer radius rows and cols are the boundary, threads split the rows between them
+    interior = md.rows-2*radius;
+    if(MIN(md.rows, md.cols) <= 2*radius){
+        printf("Error [pth-stencil-2d:main]: %dx%d matrix has no interior for stencil radius %d\n", md.rows, md.cols, radius);
+        goto end_b;
+    }
+    // count tiles, threads steal tiles so only the tile count limits the threads doing work
+    if(ts.tile_rows > 0){
+        ts.num_tiles = ((interior+ts.tile_rows-1)/ts.tile_rows) * ((md.cols-2*radius+ts.tile_cols-1)/ts.tile_cols);
+        if(ts.num_threads > ts.num_tiles){
+            printf("Warning [pth-stencil-2d:main]: num_threads[%d] > num_tiles[%d]\n", ts.num_threads, ts.num_tiles);
+        }
+    }
     // show warning if num_threads > blockable rows (users choice)
-    if(MAX(ts.num_threads,md.rows-2) == ts.num_threads){
-        printf("Warning [pth-stencil-2d:main]: num_threads[%d] > blockable rows[%d]\n", ts.num_threads, md.rows-2);
+    else if(MAX(ts.num_threads,interior) == ts.num_threads){
+        printf("Warning [pth-stencil-2d:main]: num_threads[%d] > blockable rows[%d]\n", ts.num_threads, interior);
     }
-    // malloc space for duplicate matrix B and check for errors
-    if(malloc1D((void*)&md.B, MATRIX_SIZE(md.rows, md.cols), "md.B") == ERROR) goto end_a;
+    // neighboring blocks overlap by up to 2*(time_block-1)*radius rows, so each block needs 2*time_block*radius rows
+    if(sd.time_block > 1 && MAX(1, (interior/ts.num_threads)/(2*radius)) < sd.time_block){
+        printf("Warning [pth-stencil-2d:main]: --time-block[%d] reduced to %d for smallest block size[%d]\n", 
+            sd.time_block, MAX(1, (interior/ts.num_threads)/(2*radius)), interior/ts.num_threads);
+        sd.time_block = MAX(1, (interior/ts.num_threads)/(2*radius));
+    }
+    // blocks thinner than the radius would make threads two blocks apart depend on each other
+    if(ts.neighbor_sync && ts.num_threads > interior/radius){
+        printf("Warning [pth-stencil-2d:main]: --sync neighbor ignored when num_threads[%d] > blockable rows[%d]/radius[%d]\n", ts.num_threads, interior, radius);
+        ts.neighbor_sync = 0;
+    }
+    // malloc space for duplicate matrix B unless it is the mapped outfile and check for errors
+    if(md.B == NULL && malloc1D((void*)&md.B, MATRIX_SIZE(md.rows, md.cols), "md.B") == ERROR) goto end_a;
 
     // pointers for thread handles and thread private struct
     pthread_t * th_handles = NULL;
     ThreadPrivate * tp = NULL, * tp_tmp = NULL;
+    int num_rs = 0;
 
     // malloc thread_handles and private data struct, end if error
     if(malloc1D((void*)&th_handles, ts.num_threads*PTR_SIZE, "th_handles") == ERROR) goto end_b;
     if(malloc1D((void*)&tp, ts.num_threads*sizeof(ThreadPrivate), "tp")  == ERROR) goto end_c;
     tp_tmp = tp;    // save start addr 
+    num_rs = ts.num_threads;
+
+    // allocate each thread's row sums for each step in a time block (separable kernel only)
+    for(int tid = 0; tid < num_rs; tid++) tp[tid].rs = NULL;
+    for(int tid = 0; tid < num_rs; tid++){
+        if(mallocRowSums(&tp[tid].rs, sd.time_block, md.cols) == ERROR) goto end_d;
+    }
+
+    // allocate and zero the progress counters for neighbor sync
+    if(malloc1D((void*)&ts.progress, ts.num_threads*sizeof(Progress), "ts.progress") == ERROR) goto end_d;
+    memset(ts.progress, 0, ts.num_threads*sizeof(Progress));
+    // allocate each thread's partial residual for even and odd chunks
+    if(sd.res.tolerance > 0.0 && malloc1D((void*)&ts.residuals, 2*ts.num_threads*ACC_SIZE, "ts.residuals") == ERROR) goto end_d;
+    // allocate a tile deque and lock for each thread
+    if(ts.num_tiles > 0){
+        if(malloc1D((void*)&ts.queues, ts.num_threads*sizeof(TileQueue), "ts.queues") == ERROR) goto end_d;
+        for(int tid = 0; tid < ts.num_threads; tid++){
+            pthread_mutex_init(&ts.queues[tid].lock, NULL);
+            ts.queues[tid].head = ts.queues[tid].tail = 0;
+        }
+    }
 
     // initialize pthread barrier with number of threads and check for error
     ret = pthread_barrier_init(&ts.barrier, NULL, ts.num_threads);
     if(handleBarrier(ret, "Error [pth-stencil-2d:main:pthread_barrier_init()]") == ERROR) goto end_d;
 
-    init2D(md.B, md.rows, md.cols);    // initialize matrix B
+    // initialize matrix B, or continue from the checkpoint read into A (threads do it with first touch)
+    if(!ts.first_touch && fd.ckpt.restart) memcpy(md.B, md.A, MATRIX_SIZE(md.rows, md.cols));
+    else if(!ts.first_touch) init2D(md.B, md.rows, md.cols);
+    // start the checkpoint writer thread, every thread copies its rows of a checkpoint
+    if(fd.ckpt.file != NULL){
+        if(openCheckpointer(&cp, &fd.ckpt, md.rows, md.cols, sd.start) == ERROR) goto end_d;
+        ts.cp = &cp;
+    }
+    // boundaries are compared once both matrices are set, threads read their own rows with first touch so any side may differ
+    if(active != NULL){
+        int edges = (ts.first_touch && !fd.ckpt.restart) ? ACTIVE_SIDES : activeEdges2D(md.A, md.B, md.rows, md.cols, ACTIVE_SIDES);
+        if(mallocActiveTiles(&at, radius, md.rows-1-radius, md.cols, tile_rows, tile_cols, edges) == ERROR) goto end_d;
+        ts.at = &at;
+    }
     // initialize/compute private thread data, then create threads
-    if(sd.debug_level > 0) printf("Running %d stencil iterations with %d threads...\n", sd.iterations, ts.num_threads);
+    if(sd.debug_level > 0 && fd.ckpt.restart) printf("Restarting from iteration %d of '%s'\n", sd.start, fd.ckpt.file);
+    if(sd.debug_level > 0) printf("Running %d stencil iterations with %d threads and %s kernel...\n", 
+        sd.iterations, ts.num_threads, kernelName2D());
     
     for(int tid = 0; tid < ts.num_threads; tid++){
         tp->m_data = &md;
@@ -125,9 +524,11 @@ int main(int argc, char **argv) {
         tp->s_data = &sd;
         tp->t_shared = &ts;
         tp->rank = tid;
-        tp->block_start = BLOCK_LOW(tid, ts.num_threads, md.rows-2)+1;
-        tp->block_size = BLOCK_SIZE(tid, ts.num_threads, md.rows-2);
+        tp->block_start = BLOCK_LOW(tid, ts.num_threads, interior)+radius;
+        tp->block_size = BLOCK_SIZE(tid, ts.num_threads, interior);
         tp->thread_compute = 0.0;
+        tp->tiles_stolen = 0;
+        tp->active_computed[0] = tp->active_computed[1] = 0;
 
         // create each thread, pass thread data struct, and void function, check for errors
         if((ret = pthread_create(&th_handles[tid], NULL, pthStencilLoop, (void*)tp)) != SUCCESS){
@@ -146,19 +547,45 @@ int main(int argc, char **argv) {
             perror("Error [pth-stencil-2d:main:pthread_join()]");
         }
     }
+    // wait for a queued checkpoint to be written
+    if(ts.cp != NULL && closeCheckpointer(&cp) == ERROR) ts.write_error = 1;
 
     // destroy the barrier and check for any errors
     ret = pthread_barrier_destroy(&ts.barrier);
     if(handleBarrier(ret, "Error [pth-stencil-2d:main:pthread_barrier_destroy()]") == ERROR) goto end_d;
 
+    // stop if any thread could not read its rows or rank 0 could not write the stacked file
+    if(ts.init_error || ts.write_error){
+        ret = EXIT_FAILURE;
+        goto end_d;
+    }
+    // the iterations after convergence were never computed
+    if(sd.res.converged) sd.iterations = sd.res.converged-sd.start;
     // write final matrix state to outfile
-    if(write2D(md.B, md.rows, md.cols, fd.finalfile) == ERROR) goto end_d;
+    if(save2D(&md, md.B, fd.finalfile) == ERROR) goto end_d;
     if(sd.debug_level > 0){
         printDataFileInfo(fd.finalfile, md.rows, md.cols, 0);
-        if(fd.allfile != NULL) printStackedFileInfo(fd.allfile, md.rows, md.cols, sd.iterations);
+        if(fd.allfile != NULL) printStackedOutputInfo(&fd, md.rows, md.cols, sd.iterations);
+        if(ts.cp != NULL) printCheckpointInfo(fd.ckpt.file, cp.saved, cp.saved_iteration);
+        if(sd.res.tolerance > 0.0) printResidualInfo(&sd.res);
     }
 
     // calculate times and print
+    if(sd.debug_level > 0 && ts.num_tiles > 0){
+        int stolen = 0;
+        for(int tid = 0; tid < ts.num_threads; tid++) stolen += tp_tmp[tid].tiles_stolen;
+        printf("------------------------------------------------------\n");
+        printf("Scheduled %d tiles[%dx%d] per iteration, %d tiles stolen\n", ts.num_tiles, ts.tile_rows, ts.tile_cols, stolen);
+    }
+    if(sd.debug_level > 0 && ts.at != NULL){
+        for(int tid = 0; tid < ts.num_threads; tid++){
+            sd.active_computed[0] += tp_tmp[tid].active_computed[0];
+            sd.active_computed[1] += tp_tmp[tid].active_computed[1];
+        }
+        printActiveStats(sd.active_computed[0], MATRIX_COUNT(at.tiles_r, at.tiles_c)*sd.iterations, at.tile_rows, at.tile_cols);
+    }
+    // skipped tiles are not counted in the kernel rate
+    if(sd.debug_level > 0) printKernelStats((ts.at != NULL) ? sd.active_computed[1] : MATRIX_COUNT(interior, md.cols-2*radius)*sd.iterations, sd.compute_time);
     GET_TIME(end_overall);
     printTimes((end_overall-start_overall), sd.compute_time);
 
@@ -166,13 +593,22 @@ int main(int argc, char **argv) {
 
 end_d: 
     tp = tp_tmp;    // restore start addr
+    for(int tid = 0; tid < num_rs; tid++) freeRowSums(tp[tid].rs, sd.time_block);
+    free(ts.progress);
+    free(ts.residuals);
+    if(ts.at != NULL) freeActiveTiles(&at);
+    if(ts.queues != NULL){
+        for(int tid = 0; tid < num_rs; tid++) pthread_mutex_destroy(&ts.queues[tid].lock);
+        free(ts.queues);
+    }
     free(tp);
 end_c:
     free(th_handles);
 end_b:
-    free(md.B);
+    free2D(&md, md.B);
 end_a:
-    free(md.A);
+    free2D(&md, md.A);
 end_all:
+    free(ts.cpus);
     exit(ret); 
 }
\ No newline at end of file
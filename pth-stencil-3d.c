@@ -0,0 +1,163 @@
+/**
+ * @file pth-stencil-3d.c
+ * @author Leslie Horace
+ * @brief Main program for performing threaded 3D stencil operations (7-pt by default)
+ * @version 1.0
+ */
+#include "kernel_utils.h"
+
+void * pthStencilLoop3D(void* tp_ptr){
+    ThreadPrivate * tp = tp_ptr;
+    double start_compute = 0.0, end_compute = 0.0;
+    elem_t * A = tp->m_data->A, * B = tp->m_data->B;
+    int planes = tp->m_data->planes, rows = tp->m_data->rows, cols = tp->m_data->cols;
+    int block_end = tp->block_start+tp->block_size-1, ret = 0;
+    // first and last threads also own the boundary planes
+    int first = (tp->rank == 0) ? 0 : tp->block_start;
+    int last = (tp->rank == tp->t_shared->num_threads-1) ? planes-1 : block_end;
+
+    // first touch this block's planes of B so its pages are on this thread's NUMA node
+    memcpy(&B[VOLUME_COUNT(first, rows, cols)], &A[VOLUME_COUNT(first, rows, cols)], VOLUME_SIZE(last-first+1, rows, cols));
+    // wait for all planes before any thread reads its neighbor's planes
+    ret = pthread_barrier_wait(&tp->t_shared->barrier);
+    if(handleBarrier(ret, "Error [pth-stencil-3d:pthStencilLoop3D:pthread_barrier_wait()]") == ERROR) goto stop_all;
+
+    for(int k = 0; k < tp->s_data->iterations; k++){
+        GET_TIME(start_compute);
+        sweep3D(A, B, tp->block_start, block_end, rows, cols);
+        GET_TIME(end_compute);
+        tp->thread_compute += (end_compute-start_compute);
+        // wait for all planes of this iteration before the volumes swap
+        ret = pthread_barrier_wait(&tp->t_shared->barrier);
+        if(handleBarrier(ret, "Error [pth-stencil-3d:pthStencilLoop3D:pthread_barrier_wait()]") == ERROR) break;
+        swap2D(&A, &B);
+    }
+    // every thread swapped the same # times, B is the latest
+    if(tp->rank == 0){
+        tp->m_data->A = A;
+        tp->m_data->B = B;
+    }
+stop_all:
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int ret = EXIT_FAILURE;
+    double start_overall = 0.0, end_overall = 0.0;
+    GET_TIME(start_overall);
+
+    // initialize structs shared between threads
+    StencilData sd = {.iterations=0,.start=0,.debug_level=0,.time_block=1,.compute_time=0.0};
+    ThreadShared ts = {.num_threads=0, .neighbor_sync=0, .first_touch=1, .num_cpus=0, .init_error=0, .write_error=0,
+        .tile_rows=0, .tile_cols=0, .num_tiles=0, .cpus=NULL, .ckpt_due={0, 0}, .progress=NULL, .queues=NULL, .cp=NULL, .residuals=NULL, .at=NULL};
+    // parse optional args first so only positional args remain
+    char * simd = NULL, * stencil = NULL, * block = NULL;
+    int interior = 0;
+    int fast_math = popOption(&argc, argv, "--fast-math", NULL);
+    if(popOption(&argc, argv, "--simd", &simd) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--stencil", &stencil) == ERROR) goto end_all;
+    if(popOption(&argc, argv, "--block", &block) == ERROR) goto end_all;
+
+    // check if 6 args were entered
+    if (argc != 6){
+        printf("Usage: %s <num_iterations> <infile> <outfile> <debug_level[0-1]> <num_threads> [--stencil <7pt|27pt>] [--simd <auto|avx512|avx2|sse2|scalar>] [--fast-math] [--block <auto|off|rows>x<cols>]\n", argv[0]);
+        goto end_all;
+    }
+    // select the stencil, then the best row kernel for this cpu (or the requested one)
+    if(setStencil3D(stencil) == ERROR) goto end_all;
+    if(setKernel3D(simd, fast_math) == ERROR) goto end_all;
+
+    MatrixData md = {.A=NULL, .B=NULL, .rows=0, .cols=0, .planes=0, .map_in=NULL, .map_out=NULL};
+    char * infile = argv[2], * outfile = argv[3];
+
+    // parse <num_iterations> <debug_level[0-1]> <num_threads> arguments, end if error
+    if((sd.iterations = parseInt(argv[1], 1, SKIP_ARG, "num_iterations")) == ERROR) goto end_all;
+    if((sd.debug_level = parseInt(argv[4], 0, 1, "debug_level")) == ERROR) goto end_all;
+    if((ts.num_threads = parseInt(argv[5], 1, SKIP_ARG, "num_threads")) == ERROR) goto end_all;
+    // read in volume A, threads split its interior planes between them
+    if(read3D(&md.A, &md.planes, &md.rows, &md.cols, infile) == ERROR) goto end_all;
+    interior = md.planes-2;
+    if(MIN(md.planes, MIN(md.rows, md.cols)) < 3){
+        printf("Error [pth-stencil-3d:main]: %dx%dx%d volume has no interior\n", md.planes, md.rows, md.cols);
+        goto end_a;
+    }
+    // show warning if num_threads > blockable planes (users choice)
+    if(ts.num_threads > interior){
+        printf("Warning [pth-stencil-3d:main]: num_threads[%d] > blockable planes[%d]\n", ts.num_threads, interior);
+    }
+    // malloc space for volume B, each thread copies its planes of A into it
+    if(malloc1D((void*)&md.B, VOLUME_SIZE(md.planes, md.rows, md.cols), "md.B") == ERROR) goto end_a;
+    // size the blocks streamed through the planes to the cache (or the requested shape)
+    if(setBlock3D(block, md.rows, md.cols) == ERROR) goto end_b;
+
+    // pointers for thread handles and thread private struct
+    pthread_t * th_handles = NULL;
+    ThreadPrivate * tp = NULL;
+
+    // malloc thread_handles and private data struct, end if error
+    if(malloc1D((void*)&th_handles, ts.num_threads*PTR_SIZE, "th_handles") == ERROR) goto end_b;
+    if(malloc1D((void*)&tp, ts.num_threads*sizeof(ThreadPrivate), "tp")  == ERROR) goto end_c;
+
+    // initialize pthread barrier with number of threads and check for error
+    ret = pthread_barrier_init(&ts.barrier, NULL, ts.num_threads);
+    if(handleBarrier(ret, "Error [pth-stencil-3d:main:pthread_barrier_init()]") == ERROR) goto end_d;
+
+    if(sd.debug_level > 0) printf("Running %d 3D stencil iterations with %d threads and %s kernel...\n",
+        sd.iterations, ts.num_threads, kernelName3D());
+    // initialize private thread data, then create threads
+    for(int tid = 0; tid < ts.num_threads; tid++){
+        tp[tid].m_data = &md;
+        tp[tid].f_data = NULL;
+        tp[tid].s_data = &sd;
+        tp[tid].t_shared = &ts;
+        tp[tid].rank = tid;
+        tp[tid].block_start = BLOCK_LOW(tid, ts.num_threads, interior)+1;
+        tp[tid].block_size = BLOCK_SIZE(tid, ts.num_threads, interior);
+        tp[tid].thread_compute = 0.0;
+        tp[tid].rs = NULL;
+
+        // create each thread, pass thread data struct, and void function, check for errors
+        if((ret = pthread_create(&th_handles[tid], NULL, pthStencilLoop3D, (void*)&tp[tid])) != SUCCESS){
+            errno = ret;
+            perror("Error [pth-stencil-3d:main:pthread_create()]");
+            ts.num_threads = tid+1; // set number of threads for joining only created threads
+            break;  // break thread creation since we are missing threads
+        }
+    }
+
+    // join each thread to the parent thread and check for errors, max thread time is the overall compute time
+    for (int tid = 0;  tid < ts.num_threads; tid++){
+        if((ret = pthread_join(th_handles[tid], NULL)) != SUCCESS){
+            errno = ret;
+            perror("Error [pth-stencil-3d:main:pthread_join()]");
+        }
+        sd.compute_time = MAX(sd.compute_time, tp[tid].thread_compute);
+    }
+
+    // destroy the barrier and check for any errors
+    ret = pthread_barrier_destroy(&ts.barrier);
+    if(handleBarrier(ret, "Error [pth-stencil-3d:main:pthread_barrier_destroy()]") == ERROR) goto end_d;
+
+    // write final volume state to outfile
+    if(write3D(md.B, md.planes, md.rows, md.cols, outfile) == ERROR) goto end_d;
+    if(sd.debug_level > 0){
+        printVolumeFileInfo(outfile, md.planes, md.rows, md.cols);
+        printKernelStats3D(VOLUME_COUNT(interior, md.rows-2, md.cols-2)*sd.iterations, sd.compute_time);
+    }
+    // calculate times and print
+    GET_TIME(end_overall);
+    printTimes((end_overall-start_overall), sd.compute_time);
+
+    ret = EXIT_SUCCESS;
+
+end_d:
+    free(tp);
+end_c:
+    free(th_handles);
+end_b:
+    free(md.B);
+end_a:
+    free(md.A);
+end_all:
+    exit(ret);
+}
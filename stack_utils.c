@@ -0,0 +1,333 @@
+/**
+ * @file stack_utils.c
+ * @author Leslie Horace
+ * @brief File storing the compressed stacked file encoder and reader
+ * @version 1.0
+ *
+ * Each element is XORed with a reference element, which is the same element
+ * of the previous frame, or the element to its left in key frames and at the
+ * start of every chunk. Iterations change little from frame to frame, so the
+ * XOR usually has zero high bytes (sign, exponent, and top of the mantissa)
+ * or is zero. A chunk is a 4-bit count of significant low bytes for every
+ * element, then those bytes, so an unchanged element costs half a byte.
+ * Chunks are independent and are encoded in parallel by the worker threads.
+ * Files are little endian, like the x86 hosts that write them.
+ */
+#include <stdint.h>
+#include "stack_utils.h"
+
+#define HEAD_BYTES(n) (((n)+1)/2)                       // 4-bit byte counts of n elements
+#define MAX_CHUNK_SIZE(n,size) (HEAD_BYTES(n)+(n)*(size))   // worst case encoded chunk
+
+// # elements in chunk c of a frame
+static long chunkCount(StackHeader * hdr, int c){
+    return MATRIX_COUNT(MIN(hdr->chunk_rows, hdr->rows-c*hdr->chunk_rows), hdr->cols);
+}
+
+// encodes n elements of size bytes against ref (NULL = the element to the left), returns the encoded size
+static unsigned int encodeChunk(char * out, char * cur, char * ref, long n, int size){
+    unsigned char * head = (unsigned char*)out;
+    char * body = out + HEAD_BYTES(n);
+    uint64_t x = 0, r = 0;
+    int bytes = 0;
+
+    memset(head, 0, HEAD_BYTES(n));
+    for(long w = 0; w < n; w++){
+        x = r = 0;
+        memcpy(&x, cur + w*size, size);
+        if(ref != NULL) memcpy(&r, ref + w*size, size);
+        else if(w > 0) memcpy(&r, cur + (w-1)*size, size);
+        x ^= r;
+        // significant bytes up to the highest nonzero byte, stored low byte first
+        bytes = (x == 0) ? 0 : (71 - __builtin_clzll(x))/8;
+        head[w/2] |= (unsigned char)(bytes << (4*(w%2)));
+        memcpy(body, &x, bytes);
+        body += bytes;
+    }
+    return (unsigned int)(body - out);
+}
+
+// decodes n elements of size bytes into out, which holds the previous frame unless key is set
+static int decodeChunk(char * out, int key, char * in, unsigned int in_size, long n, int size){
+    unsigned char * head = (unsigned char*)in;
+    char * body = in + HEAD_BYTES(n), * end = in + in_size;
+    uint64_t x = 0, r = 0;
+    int bytes = 0;
+
+    if((long)in_size < HEAD_BYTES(n)) return ERROR;
+    for(long w = 0; w < n; w++){
+        bytes = (head[w/2] >> (4*(w%2))) & 0xF;
+        if(bytes > size || body + bytes > end) return ERROR;
+        x = r = 0;
+        memcpy(&x, body, bytes);
+        body += bytes;
+        if(!key) memcpy(&r, out + w*size, size);
+        else if(w > 0) memcpy(&r, out + (w-1)*size, size);
+        x ^= r;
+        memcpy(out + w*size, &x, size);
+    }
+    return (body == end) ? SUCCESS : ERROR;
+}
+
+// claims and encodes chunks of the current frame until none are left
+static void encodeChunks(StackEncoder * se){
+    char * cur = NULL, * ref = NULL;
+    long first = 0;
+    int c = 0;
+
+    pthread_mutex_lock(&se->lock);
+    while(se->next_chunk < se->num_chunks){
+        c = se->next_chunk++;
+        cur = se->cur;
+        ref = (se->key) ? NULL : se->prev;
+        pthread_mutex_unlock(&se->lock);
+
+        first = MATRIX_COUNT(c*se->hdr.chunk_rows, se->hdr.cols)*se->hdr.elem_size;
+        se->sizes[c] = encodeChunk(se->chunks[c], cur+first, (ref != NULL) ? ref+first : NULL, chunkCount(&se->hdr, c), se->hdr.elem_size);
+
+        pthread_mutex_lock(&se->lock);
+        if(++se->done_chunks == se->num_chunks) pthread_cond_signal(&se->done);
+    }
+    pthread_mutex_unlock(&se->lock);
+}
+
+static void * encodeWorker(void * se_ptr){
+    StackEncoder * se = se_ptr;
+    long seen = 0;
+
+    pthread_mutex_lock(&se->lock);
+    for(;;){
+        while(se->generation == seen && !se->stop) pthread_cond_wait(&se->ready, &se->lock);
+        if(se->stop) break;
+        seen = se->generation;
+        pthread_mutex_unlock(&se->lock);
+        encodeChunks(se);
+        pthread_mutex_lock(&se->lock);
+    }
+    pthread_mutex_unlock(&se->lock);
+    return NULL;
+}
+
+// wakes and joins the first count worker threads
+static void stopWorkers(StackEncoder * se, int count){
+    pthread_mutex_lock(&se->lock);
+    se->stop = 1;
+    pthread_cond_broadcast(&se->ready);
+    pthread_mutex_unlock(&se->lock);
+    for(int t = 0; t < count; t++) pthread_join(se->workers[t], NULL);
+}
+
+int openEncoder(StackEncoder *se, char * outfile, SampleData *sample, int frames, int num_workers){
+    int c = 0, t = 0, rows = SAMPLE_ROWS(*sample), cols = SAMPLE_COLS(*sample);
+
+    memset(se, 0, sizeof(StackEncoder));
+    memcpy(se->hdr.magic, STACK_MAGIC, 4);
+    se->hdr.elem_size = ELEM_SIZE;
+    se->hdr.rows = rows;
+    se->hdr.cols = cols;
+    se->hdr.sample = *sample;
+    se->hdr.chunk_rows = MAX(1, (int)(STACK_CHUNK_BYTES/MATRIX_SIZE(1, cols)));
+    se->hdr.key_interval = STACK_KEY_INTERVAL;
+    se->hdr.capacity = frames;
+    se->num_chunks = (rows + se->hdr.chunk_rows-1)/se->hdr.chunk_rows;
+    se->num_workers = num_workers;
+    se->frame_bytes = MATRIX_SIZE(rows, cols);
+    se->offset = (off_t)(sizeof(StackHeader) + frames*sizeof(FrameEntry));
+
+    // the file is sized in closeEncoder(), O_TRUNC would wait for writeback of an old file's pages
+    if((se->fd = open(outfile, O_WRONLY | O_CREAT, 0644)) == -1){
+        printf("Error [stack_utils:openEncoder:open()]: cannot open/write '%s'\n", outfile);
+        return ERROR;
+    }
+    if(malloc1D((void*)&se->index, frames*sizeof(FrameEntry), "se->index") == ERROR) goto end_open;
+    memset(se->index, 0, frames*sizeof(FrameEntry));
+    if(malloc1D((void*)&se->prev, se->frame_bytes, "se->prev") == ERROR) goto end_index;
+    if(malloc1D((void*)&se->sizes, se->num_chunks*sizeof(unsigned int), "se->sizes") == ERROR) goto end_prev;
+    if(malloc1D((void*)&se->chunks, se->num_chunks*PTR_SIZE, "se->chunks") == ERROR) goto end_sizes;
+    for(c = 0; c < se->num_chunks; c++){
+        if(malloc1D((void*)&se->chunks[c], MAX_CHUNK_SIZE(chunkCount(&se->hdr, c), se->hdr.elem_size), "se->chunks[c]") == ERROR) goto end_chunks;
+    }
+    if(malloc1D((void*)&se->workers, num_workers*sizeof(pthread_t), "se->workers") == ERROR) goto end_chunks;
+    pthread_mutex_init(&se->lock, NULL);
+    pthread_cond_init(&se->ready, NULL);
+    pthread_cond_init(&se->done, NULL);
+    // the thread calling encodeFrame() is the first worker
+    for(t = 0; t < num_workers-1; t++){
+        if((errno = pthread_create(&se->workers[t], NULL, encodeWorker, (void*)se)) != SUCCESS){
+            perror("Error [stack_utils:openEncoder:pthread_create()]");
+            goto end_workers;
+        }
+    }
+    return SUCCESS;
+
+end_workers:
+    stopWorkers(se, t);
+    pthread_cond_destroy(&se->done);
+    pthread_cond_destroy(&se->ready);
+    pthread_mutex_destroy(&se->lock);
+    free(se->workers);
+end_chunks:
+    while(c-- > 0) free(se->chunks[c]);
+    free(se->chunks);
+end_sizes:
+    free(se->sizes);
+end_prev:
+    free(se->prev);
+end_index:
+    free(se->index);
+end_open:
+    close(se->fd);
+    return ERROR;
+}
+
+int encodeFrame(StackEncoder *se, char * frame){
+    FrameEntry * fe = NULL;
+    off_t offset = se->offset;
+
+    if(se->hdr.frames == se->hdr.capacity){
+        printf("Error [stack_utils:encodeFrame()]: frame index is full (%d frames)\n", se->hdr.capacity);
+        return ERROR;
+    }
+    // hand the frame to the workers and encode chunks alongside them
+    pthread_mutex_lock(&se->lock);
+    se->cur = frame;
+    se->key = (se->hdr.frames % se->hdr.key_interval == 0);
+    se->next_chunk = se->done_chunks = 0;
+    se->generation++;
+    pthread_cond_broadcast(&se->ready);
+    pthread_mutex_unlock(&se->lock);
+    encodeChunks(se);
+    pthread_mutex_lock(&se->lock);
+    while(se->done_chunks < se->num_chunks) pthread_cond_wait(&se->done, &se->lock);
+    pthread_mutex_unlock(&se->lock);
+
+    // chunk size table, then the chunks in order
+    if(writeAll(se->fd, (char*)se->sizes, se->num_chunks*sizeof(unsigned int), offset) == ERROR) return ERROR;
+    offset += se->num_chunks*sizeof(unsigned int);
+    for(int c = 0; c < se->num_chunks; c++){
+        if(writeAll(se->fd, se->chunks[c], se->sizes[c], offset) == ERROR) return ERROR;
+        offset += se->sizes[c];
+    }
+    fe = &se->index[se->hdr.frames++];
+    fe->offset = (long long)se->offset;
+    fe->size = (long long)(offset - se->offset);
+    se->offset = offset;
+    memcpy(se->prev, frame, se->frame_bytes);
+    return SUCCESS;
+}
+
+int closeEncoder(StackEncoder *se){
+    int ret = SUCCESS;
+
+    stopWorkers(se, se->num_workers-1);
+    // the index and header go last so a file cut short has no index entries past its frames
+    if(writeAll(se->fd, (char*)se->index, se->hdr.capacity*sizeof(FrameEntry), sizeof(StackHeader)) == ERROR) ret = ERROR;
+    if(ret == SUCCESS && writeAll(se->fd, (char*)&se->hdr, sizeof(StackHeader), 0) == ERROR) ret = ERROR;
+    // drop anything left from an older, larger file
+    if(ret == SUCCESS && ftruncate(se->fd, se->offset) == -1){
+        perror("Error [stack_utils:closeEncoder:ftruncate()]");
+        ret = ERROR;
+    }
+    if(close(se->fd) == -1){
+        perror("Error [stack_utils:closeEncoder:close()]");
+        ret = ERROR;
+    }
+
+    pthread_cond_destroy(&se->done);
+    pthread_cond_destroy(&se->ready);
+    pthread_mutex_destroy(&se->lock);
+    free(se->workers);
+    for(int c = 0; c < se->num_chunks; c++) free(se->chunks[c]);
+    free(se->chunks);
+    free(se->sizes);
+    free(se->prev);
+    free(se->index);
+    return ret;
+}
+
+int openStackReader(StackReader *sr, char * infile){
+    StackHeader * hdr = &sr->hdr;
+    long long max_size = 1;
+
+    memset(sr, 0, sizeof(StackReader));
+    sr->decoded = -1;
+    if((sr->fd = open(infile, O_RDONLY)) == -1){
+        printf("Error [stack_utils:openStackReader:open()]: cannot open/read '%s'\n", infile);
+        return ERROR;
+    }
+    if(readAll(sr->fd, (char*)hdr, sizeof(StackHeader), 0) == ERROR) goto end_open;
+    if(memcmp(hdr->magic, STACK_MAGIC, 4) != 0 || (hdr->elem_size != DOUBLE_ELEM && hdr->elem_size != FLOAT_ELEM)
+        || hdr->rows < 1 || hdr->cols < 1 || hdr->chunk_rows < 1 || hdr->key_interval < 1 || hdr->frames < 0 || hdr->frames > hdr->capacity
+        || hdr->sample.every < 1 || hdr->sample.pool < 1){
+        printf("Error [stack_utils:openStackReader()]: '%s' is not a compressed stacked file\n", infile);
+        goto end_open;
+    }
+    if(malloc1D((void*)&sr->index, hdr->frames*sizeof(FrameEntry), "sr->index") == ERROR) goto end_open;
+    if(readAll(sr->fd, (char*)sr->index, hdr->frames*sizeof(FrameEntry), sizeof(StackHeader)) == ERROR) goto end_index;
+    for(int f = 0; f < hdr->frames; f++) max_size = MAX(max_size, sr->index[f].size);
+    if(malloc1D((void*)&sr->buf, (long)max_size, "sr->buf") == ERROR) goto end_index;
+    if(malloc1D((void*)&sr->frame, MATRIX_COUNT(hdr->rows, hdr->cols)*hdr->elem_size, "sr->frame") == ERROR) goto end_buf;
+    return SUCCESS;
+
+end_buf:
+    free(sr->buf);
+end_index:
+    free(sr->index);
+end_open:
+    close(sr->fd);
+    return ERROR;
+}
+
+// decodes frame f over the previous frame in sr->frame
+static int decodeFrame(StackReader *sr, int f){
+    StackHeader * hdr = &sr->hdr;
+    int num_chunks = (hdr->rows + hdr->chunk_rows-1)/hdr->chunk_rows;
+    unsigned int * sizes = (unsigned int*)sr->buf;
+    char * in = sr->buf + num_chunks*sizeof(unsigned int), * end = sr->buf + sr->index[f].size;
+    long first = 0;
+
+    if(sr->index[f].size < (long long)(num_chunks*sizeof(unsigned int))) goto bad_frame;
+    if(readAll(sr->fd, sr->buf, sr->index[f].size, sr->index[f].offset) == ERROR) return ERROR;
+    for(int c = 0; c < num_chunks; c++){
+        if(sizes[c] > (unsigned long)(end - in)) goto bad_frame;
+        first = MATRIX_COUNT(c*hdr->chunk_rows, hdr->cols)*hdr->elem_size;
+        if(decodeChunk(sr->frame+first, f % hdr->key_interval == 0, in, sizes[c], chunkCount(hdr, c), hdr->elem_size) == ERROR) goto bad_frame;
+        in += sizes[c];
+    }
+    return SUCCESS;
+
+bad_frame:
+    printf("Error [stack_utils:decodeFrame()]: frame %d is corrupt\n", f);
+    return ERROR;
+}
+
+int readStackFrame(StackReader *sr, int k, elem_t *X){
+    StackHeader * hdr = &sr->hdr;
+    int key = k - k % hdr->key_interval, first = key;
+    long count = MATRIX_COUNT(hdr->rows, hdr->cols);
+
+    if(k < 0 || k >= hdr->frames){
+        printf("Error [stack_utils:readStackFrame()]: frame %d is not in [0, %d]\n", k, hdr->frames-1);
+        return ERROR;
+    }
+    // keep decoding from the last frame read if it is between the key frame and k
+    if(sr->decoded >= key && sr->decoded <= k) first = sr->decoded+1;
+    for(int f = first; f <= k; f++){
+        if(decodeFrame(sr, f) == ERROR){
+            sr->decoded = -1;
+            return ERROR;
+        }
+        sr->decoded = f;
+    }
+    if(hdr->elem_size == ELEM_SIZE) memcpy(X, sr->frame, count*ELEM_SIZE);
+    else if(hdr->elem_size == DOUBLE_ELEM) for(long i = 0; i < count; i++) X[i] = ((double*)sr->frame)[i];
+    else for(long i = 0; i < count; i++) X[i] = ((float*)sr->frame)[i];
+    return SUCCESS;
+}
+
+void closeStackReader(StackReader *sr){
+    free(sr->frame);
+    free(sr->buf);
+    free(sr->index);
+    close(sr->fd);
+}
@@ -0,0 +1,142 @@
+/**
+ *  @file stack_utils.h
+ *  @author Leslie Horace
+ *  @brief Header file for the compressed stacked file encoder and reader in stack_utils.c
+ *  @version 1.0
+ *
+ *  A compressed stacked file (.stk) is a StackHeader, a frame index of FrameEntry, then the frames.
+ *  Frame k holds iteration k*sample.every, the region and pooling in sample give its order rows x cols.
+ *  Each frame is a table of chunk sizes (unsigned int) followed by its chunks, a chunk holds
+ *  chunk_rows whole rows (the last one may hold fewer).
+ */
+#include "utilities.h"
+
+#ifndef STACK_UTILS_
+#define STACK_UTILS_
+
+#define STACK_MAGIC "STK1"          // first 4 bytes of a compressed stacked file
+#define STACK_CHUNK_BYTES (256*1024)    // target raw bytes per chunk (whole rows)
+#define STACK_KEY_INTERVAL 32       // every k-th frame is a key frame that decodes without the frames before it
+
+/**
+ *  @struct _stackHeader
+ *  @typedef StackHeader
+ *  @brief struct at the start of a compressed stacked file
+ */
+typedef struct _stackHeader{
+    char magic[4];
+    int elem_size;              // bytes per element (DOUBLE_ELEM | FLOAT_ELEM)
+    int rows;
+    int cols;
+    int chunk_rows;
+    int key_interval;
+    int frames;                 // # frames written
+    int capacity;               // # frame index entries, frames start after the index
+    SampleData sample;          // recorded iterations and region of the computed matrix
+}StackHeader;
+
+/**
+ *  @struct _frameEntry
+ *  @typedef FrameEntry
+ *  @brief struct for one frame index entry
+ */
+typedef struct _frameEntry{
+    long long offset;           // file offset of the frame's chunk size table
+    long long size;             // frame bytes including its chunk size table
+}FrameEntry;
+
+/**
+ *  @struct _stackEncoder
+ *  @typedef StackEncoder (shared)
+ *  @brief struct for a compressed stacked file being written, chunks [next_chunk, num_chunks) of
+ *         the current frame are not yet claimed by the calling thread or a worker thread
+ */
+typedef struct _stackEncoder{
+    StackHeader hdr;
+    FrameEntry * index;
+    pthread_t * workers;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       // signaled when a frame is ready to encode or the workers stop
+    pthread_cond_t done;        // signaled when the last chunk of a frame is encoded
+    char * cur;                 // frame being encoded
+    char * prev;                // last frame encoded, the XOR reference of the next frame
+    char ** chunks;             // encoded chunks of the current frame
+    unsigned int * sizes;       // encoded chunk sizes of the current frame
+    size_t frame_bytes;
+    off_t offset;               // end of the written frames
+    long generation;            // # frames handed to the workers
+    int num_chunks;
+    int next_chunk;
+    int done_chunks;
+    int key;                    // 1 = current frame is a key frame
+    int num_workers;
+    int stop;
+    int fd;
+}StackEncoder;
+
+/**
+ *  @struct _stackReader
+ *  @typedef StackReader
+ *  @brief struct for a compressed stacked file opened for reading, frame holds the last decoded frame
+ */
+typedef struct _stackReader{
+    StackHeader hdr;
+    FrameEntry * index;
+    char * frame;
+    char * buf;                 // encoded frame
+    int decoded;                // # of the frame in frame (-1 = none)
+    int fd;
+}StackReader;
+
+/**
+ *  @brief Creates a compressed stacked file and starts the threads that encode its chunks
+ *  @param se (StackEncoder*) encoder to start
+ *  @param outfile (char*) compressed stacked filename
+ *  @param sample (SampleData*) recorded iterations and region (from setSampleOrder()), frames are SAMPLE_ROWS x SAMPLE_COLS
+ *  @param frames (int) max # frames (initial matrix + recorded iterations)
+ *  @param num_workers (int) # threads encoding chunks, including the thread calling encodeFrame()
+ *  @return [arg] se (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int openEncoder(StackEncoder *se, char * outfile, SampleData *sample, int frames, int num_workers);
+
+/**
+ *  @brief Encodes one frame in parallel chunks and appends it to the file, frames that are not
+ *         key frames are XOR encoded against the previous frame
+ *  @param se (StackEncoder*) encoder from openEncoder()
+ *  @param frame (char*) hdr.rows*hdr.cols elements of elem_t
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int encodeFrame(StackEncoder *se, char * frame);
+
+/**
+ *  @brief Writes the frame index and header, stops the encoding threads, and closes the file
+ *  @param se (StackEncoder*) encoder from openEncoder()
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int closeEncoder(StackEncoder *se);
+
+/**
+ *  @brief Opens a compressed stacked file and reads its header and frame index
+ *  @param sr (StackReader*) reader to open
+ *  @param infile (char*) compressed stacked filename
+ *  @return [arg] sr (addr), sr->hdr has the matrix order and # frames; [val]: ERROR (-1) | SUCCESS (0)
+ */
+int openStackReader(StackReader *sr, char * infile);
+
+/**
+ *  @brief Decodes frame k into a matrix, converting elements of another type, only the frames
+ *         from the last key frame (or the last frame read) to k are decoded
+ *  @param sr (StackReader*) reader from openStackReader()
+ *  @param k (int) frame # (0 = initial matrix)
+ *  @param X (elem_t*) Matrix for reading (rows*cols allocated)
+ *  @return [arg] X; [val]: ERROR (-1) | SUCCESS (0)
+ */
+int readStackFrame(StackReader *sr, int k, elem_t *X);
+
+/**
+ *  @brief Closes a compressed stacked file and frees its reader
+ *  @param sr (StackReader*) reader from openStackReader()
+ */
+void closeStackReader(StackReader *sr);
+
+#endif /* STACK_UTILS_ */
@@ -1,50 +1,64 @@
 /**
  * @file stencil-2d.c
  * @author Leslie Horace
- * @brief Main program for performing and recording 9-pt serial stencil operations
+ * @brief Main program for performing and recording serial stencil operations (9-pt by default)
  * @version 2.0
  * 
  */
-#include "utilities.h"   
+#include "kernel_utils.h"   
+#include "writer_utils.h"
 
-int stencilLoop(MatrixData md, FileData fd, StencilData * sd){
-    size_t w_count = 0, m_count = MATRIX_COUNT(md.rows,md.cols);
+int stencilLoop(MatrixData md, FileData * fd, StencilData * sd, ActiveTiles * at){
     double start_compute=0.0, end_compute=0.0;
-    FILE * fp;
-    int ret = ERROR;
+    StackedWriter sw;
+    Checkpointer cp;
+    RowSums * rs = NULL;
+    acc_t residual = 0;
+    int ret = ERROR, steps = 1, checking = 0, r = stencilRadius2D();
 
-    if(fd.allfile != NULL){
-         // check if file is open for writing
-        if((fp = fopen(fd.allfile, "wb")) == NULL){ 
-            printf("[stencil-2d:stencilLoop()]: cannot open/write '%s'\n", fd.allfile);
-            goto stop_all;
-        }
-        // write initial matrix to stacked raw file and check for errors
-        w_count = fwrite(md.A, DOUBLE_SIZE, m_count, fp);
-        if(handleIOError(fp, w_count, m_count, "[stencil-2d:stencilLoop()]") == ERROR) goto stop_write;
+    // allocate row sums for each step in a time block (separable kernel only)
+    if(mallocRowSums(&rs, sd->time_block, md.cols) == ERROR) goto stop_all;
+    if(fd->allfile != NULL){
+        // start the stacked file writer thread and queue the initial matrix
+        if(openStackedWriter(&sw, fd, md.rows, md.cols, sd->iterations) == ERROR) goto stop_sums;
+        if(pushSnapshot(&sw, md.A) == ERROR) goto stop_write;
     }
-    // write the initial matrix to output file 
-    for(int i=0; i < sd->iterations; i++){   
+    // start the checkpoint writer thread
+    if(fd->ckpt.file != NULL && openCheckpointer(&cp, &fd->ckpt, md.rows, md.cols, sd->start) == ERROR) goto stop_write;
+    // perform stencil iterations in blocks of time_block steps, a checked iteration is swept alone with its residual
+    for(int k = 0; k < sd->iterations; k += steps){
+        steps = residualSteps(&sd->res, sd->start+k, MIN(sd->time_block, sd->iterations-k));
+        checking = residualDue(&sd->res, sd->start+k+steps);
         GET_TIME(start_compute);      
-        for(int i = 1; i < md.rows-1; i++){ 
-            stencil2D(md.A, md.B, i, md.cols);        // perform stencil iterations 
-        }
+        if(at != NULL) residual = activeSweep2D(at, md.A, md.B, 0, at->tiles_r*at->tiles_c, k, rs, checking, sd->res.norm, sd->active_computed);
+        else if(checking) residual = residualSweep2D(md.A, md.B, r, md.rows-1-r, md.cols, rs, sd->res.norm);
+        else timeBlock2D(md.A, md.B, r, md.rows-1-r, steps, 0, 0, md.cols, rs);
         GET_TIME(end_compute);
         sd->compute_time += (end_compute-start_compute);         // record/sum io time 
-        // write current iteration to raw file, stop if error occurs
-        if(fd.allfile != NULL){
-            w_count = fwrite(md.A, DOUBLE_SIZE, m_count, fp);
-            if(handleIOError(fp, w_count, m_count,"[stencil-2d:stencilLoop()]") == ERROR) goto stop_write;
-        }
-        // swap matrices for next iteration
-        swap2D(&md.A, &md.B);  
+        // queue current iteration for the raw file (written while the next one is computed), stop if error occurs
+        if(fd->allfile != NULL && pushSnapshot(&sw, md.A) == ERROR) goto stop_ckpt;
+        // swap matrices for next iteration if the last step was written to md.A
+        if(steps % 2) swap2D(&md.A, &md.B);  
+        // stop once the field has stopped changing, md.B is the outfile
+        if(checking && residualConverged(&sd->res, residualNorm(&sd->res, residual), sd->start+k+steps)) break;
+        // copy md.B for a due checkpoint (written while the next iterations are computed), the last iteration is the outfile
+        if(fd->ckpt.file != NULL && k+steps < sd->iterations && saveCheckpoint(&cp, md.B, sd->start+k+steps) == ERROR) goto stop_ckpt;
     } 
 
-    if(write2D(md.B, md.rows, md.cols, fd.finalfile)==ERROR) goto stop_write;
+    if(save2D(&md, md.B, fd->finalfile)==ERROR) goto stop_ckpt;
 
     ret=SUCCESS;
+stop_ckpt:
+    // wait for a queued checkpoint to be written
+    if(fd->ckpt.file != NULL){
+        if(closeCheckpointer(&cp) == ERROR) ret = ERROR;
+        else if(ret == SUCCESS) printCheckpointInfo(fd->ckpt.file, cp.saved, cp.saved_iteration);
+    }
 stop_write: 
-    if(fd.allfile != NULL) free(fp);
+    // wait for queued iterations to be written
+    if(fd->allfile != NULL && closeWriter(&sw) == ERROR) ret = ERROR;
+stop_sums:
+    freeRowSums(rs, sd->time_block);
 stop_all:
     return ret;
 }
@@ -54,29 +68,101 @@ int main(int argn, char **argv) {
     double start_time = 0.0, end_time = 0.0;
     GET_TIME(start_time); 
 
+    StencilData sd = {.iterations=0, .start=0, .debug_level=0, .time_block=1, .compute_time=0.0};
+    // parse optional args first so only positional args remain
+    if((sd.time_block = parseIntOption(&argn, argv, "--time-block", 1, SKIP_ARG, 1)) == ERROR) goto end_all;
+    char * simd = NULL, * kernel = NULL, * strip = NULL, * active = NULL, * stencil = NULL;
+    int tile_rows = 0, tile_cols = 0, radius = 1;
+    int fast_math = popOption(&argn, argv, "--fast-math", NULL);
+    int use_mmap = popOption(&argn, argv, "--mmap", NULL);
+    int direct_io = popOption(&argn, argv, "--direct-io", NULL);
+    int write_buffers = parseIntOption(&argn, argv, "--write-buffers", 1, SKIP_ARG, WRITER_BUFFERS);
+    if(write_buffers == ERROR) goto end_all;
+    int compress_workers = parseIntOption(&argn, argv, "--compress", 1, SKIP_ARG, 0);
+    if(compress_workers == ERROR) goto end_all;
+    SampleData sample;
+    if(parseSampleOptions(&argn, argv, &sample) == ERROR) goto end_all;
+    CheckpointData ckpt;
+    if(parseCheckpointOptions(&argn, argv, &ckpt) == ERROR) goto end_all;
+    if(parseResidualOptions(&argn, argv, &sd.res) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--simd", &simd) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--kernel", &kernel) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--strip", &strip) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--active-tiles", &active) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--stencil", &stencil) == ERROR) goto end_all;
+
     if (argn < 4  || argn > 5){
-        printf("Usage: %s <num_iterations> <infile> <outfile> <all_stacked_file(optional)>\n", argv[0]);
+        printf("Usage: %s <num_iterations> <infile> <outfile> <all_stacked_file(optional)> [--time-block <k>] [--simd <auto|avx512|avx2|sse2|scalar>] [--kernel <box|separable>] [--fast-math] [--strip <auto|cols>] [--mmap] [--write-buffers <n>] [--direct-io] [--compress <workers>] [--every <n>] [--roi <rows>x<cols>+<row>+<col>] [--pool <k>] [--checkpoint <file>] [--checkpoint-every <n>] [--checkpoint-secs <t>] [--restart] [--tolerance <tol>] [--residual <max|l2>] [--check-every <k>] [--active-tiles <rows>x<cols>] [--stencil <5pt|9pt|13pt|25pt|file>]\n", argv[0]);
         goto end_all;
     }
+    // select the stencil, then the best row kernel for this cpu (or the requested one)
+    if(setStencil2D(stencil) == ERROR) goto end_all;
+    if(setKernel2D(simd, kernel, fast_math) == ERROR) goto end_all;
+    radius = stencilRadius2D();
+    if(setStripWidth2D(strip) == ERROR) goto end_all;
+    if(active != NULL && parseTileShape(active, "--active-tiles", &tile_rows, &tile_cols) == ERROR) goto end_all;
+    // skipped tiles are only known one iteration at a time, and the tiles already limit the columns swept
+    if(active != NULL && sd.time_block > 1){
+        printf("Warning [stencil-2d:main]: --time-block[%d] ignored with --active-tiles\n", sd.time_block);
+        sd.time_block = 1;
+    }
+    if(active != NULL && strip != NULL){
+        printf("Warning [stencil-2d:main]: --strip ignored with --active-tiles\n");
+        setStripWidth2D(strip = NULL);
+    }
+    // strips of a time block would need the next strip's columns from earlier steps
+    if(strip != NULL && sd.time_block > 1){
+        printf("Warning [stencil-2d:main]: --strip ignored for time blocks with --time-block[%d] > 1\n", sd.time_block);
+    }
+    // compressed frames have no fixed offsets to write with O_DIRECT
+    if(compress_workers > 0 && direct_io){
+        printf("Warning [stencil-2d:main]: --direct-io ignored with --compress\n");
+        direct_io = 0;
+    }
 
-    MatrixData md = {NULL, NULL, 0, 0};  
-    FileData fd = {argv[2], argv[3], (argn > 4) ? argv[4] : NULL};
-    StencilData sd = {0, 0, 0.0};
+    MatrixData md = {.A=NULL, .B=NULL, .rows=0, .cols=0, .map_in=NULL, .map_out=NULL};
+    ActiveTiles at = {.changed={NULL, NULL}};
+    FileData fd = {.initfile=argv[2], .finalfile=argv[3], .allfile=(argn > 4) ? argv[4] : NULL, 
+        .write_buffers=write_buffers, .direct_io=direct_io, .compress_workers=compress_workers, .sample=sample, .ckpt=ckpt};
 
     // parse <num iterations> arg as base 10 int
     if((sd.iterations = parseInt(argv[1], 1, SKIP_ARG, "sd.iterations")) == ERROR) goto end_all;
-    // check if reading file into md.A was successful
-    if(read2D(&md.A, &md.rows, &md.cols, fd.initfile) == ERROR) goto end_a;
-    // allocate space matrix md.B
-    if(malloc1D((void*)&md.B, MATRIX_SIZE(md.rows, md.cols), "md.B") == ERROR) goto end_a;
-    // initialize md.B as a duplicate of md.A
-    init2D(md.B, md.rows, md.cols);    
+    // read the rest of the iterations from the checkpoint, which becomes the input file
+    if(fd.ckpt.restart && setRestart(&sd, &fd) == ERROR) goto end_all;
+    // every iteration is needed for the stacked file, so time blocking is turned off
+    if(fd.allfile != NULL && sd.time_block > 1){
+        printf("Warning [stencil-2d:main]: --time-block[%d] ignored when writing all stacked file\n", sd.time_block);
+        sd.time_block = 1;
+    }
+    // map infile and outfile as the matrices, or check if reading file into md.A was successful
+    if(use_mmap){
+        if(mapMatrices2D(&md, sd.iterations, fd.initfile, fd.finalfile) == ERROR) goto end_a;
+    }else if(read2D(&md.A, &md.rows, &md.cols, fd.initfile) == ERROR) goto end_a;
+    // allocate space matrix md.B unless it is the mapped outfile
+    if(md.B == NULL && malloc1D((void*)&md.B, MATRIX_SIZE(md.rows, md.cols), "md.B") == ERROR) goto end_a;
+    // the outer radius rows and cols are the boundary
+    if(MIN(md.rows, md.cols) <= 2*radius){
+        printf("Error [stencil-2d:main]: %dx%d matrix has no interior for stencil radius %d\n", md.rows, md.cols, radius);
+        goto end_b;
+    }
+    // initialize md.B as a duplicate of md.A, or as the checkpoint the iterations continue from
+    if(fd.ckpt.restart) memcpy(md.B, md.A, MATRIX_SIZE(md.rows, md.cols));
+    else init2D(md.B, md.rows, md.cols);    
+    // tiles next to a boundary that differs between the matrices see it change every iteration
+    if(active != NULL && mallocActiveTiles(&at, radius, md.rows-1-radius, md.cols, tile_rows, tile_cols, activeEdges2D(md.A, md.B, md.rows, md.cols, ACTIVE_SIDES)) == ERROR) goto end_b;
     // perfrom stencil iterations
-    printf("Running %d serial stencil iterations...\n", sd.iterations);
-    if(stencilLoop(md, fd, &sd) == ERROR) goto end_b;
+    if(fd.ckpt.restart) printf("Restarting from iteration %d of '%s'\n", sd.start, fd.ckpt.file);
+    printf("Running %d serial stencil iterations with %s kernel...\n", sd.iterations, kernelName2D());
+    if(stencilLoop(md, &fd, &sd, (active != NULL) ? &at : NULL) == ERROR) goto end_b;
+    // the iterations after convergence were never computed
+    if(sd.res.converged) sd.iterations = sd.res.converged-sd.start;
     // print file information
     printDataFileInfo(fd.finalfile, md.rows, md.cols, 0);
-    if(fd.allfile != NULL) printStackedFileInfo(fd.allfile, md.rows, md.cols, sd.iterations);
+    if(fd.allfile != NULL) printStackedOutputInfo(&fd, md.rows, md.cols, sd.iterations);
+    if(sd.res.tolerance > 0.0) printResidualInfo(&sd.res);
+    if(active != NULL) printActiveStats(sd.active_computed[0], MATRIX_COUNT(at.tiles_r, at.tiles_c)*sd.iterations, at.tile_rows, at.tile_cols);
+    // skipped tiles are not counted in the kernel rate
+    printKernelStats((active != NULL) ? sd.active_computed[1] : MATRIX_COUNT(md.rows-2*radius, md.cols-2*radius)*sd.iterations, sd.compute_time);
     // calculate total time and cpu time, display total times for elapsed, compute, and io
     GET_TIME(end_time);
 
@@ -84,9 +170,10 @@ int main(int argn, char **argv) {
     ret = EXIT_SUCCESS;
 
 end_b:
-    free(md.B);     
+    freeActiveTiles(&at);
+    free2D(&md, md.B);     
 end_a:
-    free(md.A);
+    free2D(&md, md.A);
 end_all:
     exit(ret); 
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+/**
+ * @file stencil-3d.c
+ * @author Leslie Horace
+ * @brief Main program for performing serial 3D stencil operations (7-pt by default)
+ * @version 1.0
+ *
+ */
+#include "kernel_utils.h"
+
+int stencilLoop3D(MatrixData md, StencilData * sd, char * outfile){
+    double start_compute=0.0, end_compute=0.0;
+    // perform stencil iterations, the boundary planes, rows and cols of md.A and md.B never change
+    for(int k = 0; k < sd->iterations; k++){
+        GET_TIME(start_compute);
+        sweep3D(md.A, md.B, 1, md.planes-2, md.rows, md.cols);
+        GET_TIME(end_compute);
+        sd->compute_time += (end_compute-start_compute);
+        // swap volumes for next iteration, md.B is the latest
+        swap2D(&md.A, &md.B);
+    }
+    return write3D(md.B, md.planes, md.rows, md.cols, outfile);
+}
+
+int main(int argn, char **argv) {
+    int ret = EXIT_FAILURE;
+    double start_time = 0.0, end_time = 0.0;
+    GET_TIME(start_time);
+
+    StencilData sd = {.iterations=0, .start=0, .debug_level=0, .time_block=1, .compute_time=0.0};
+    // parse optional args first so only positional args remain
+    char * simd = NULL, * stencil = NULL, * block = NULL;
+    int fast_math = popOption(&argn, argv, "--fast-math", NULL);
+    if(popOption(&argn, argv, "--simd", &simd) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--stencil", &stencil) == ERROR) goto end_all;
+    if(popOption(&argn, argv, "--block", &block) == ERROR) goto end_all;
+
+    if (argn != 4){
+        printf("Usage: %s <num_iterations> <infile> <outfile> [--stencil <7pt|27pt>] [--simd <auto|avx512|avx2|sse2|scalar>] [--fast-math] [--block <auto|off|rows>x<cols>]\n", argv[0]);
+        goto end_all;
+    }
+    // select the stencil, then the best row kernel for this cpu (or the requested one)
+    if(setStencil3D(stencil) == ERROR) goto end_all;
+    if(setKernel3D(simd, fast_math) == ERROR) goto end_all;
+
+    MatrixData md = {.A=NULL, .B=NULL, .rows=0, .cols=0, .planes=0, .map_in=NULL, .map_out=NULL};
+    char * infile = argv[2], * outfile = argv[3];
+
+    // parse <num iterations> arg as base 10 int
+    if((sd.iterations = parseInt(argv[1], 1, SKIP_ARG, "sd.iterations")) == ERROR) goto end_all;
+    // check if reading the volume into md.A was successful
+    if(read3D(&md.A, &md.planes, &md.rows, &md.cols, infile) == ERROR) goto end_a;
+    if(MIN(md.planes, MIN(md.rows, md.cols)) < 3){
+        printf("Error [stencil-3d:main]: %dx%dx%d volume has no interior\n", md.planes, md.rows, md.cols);
+        goto end_a;
+    }
+    // allocate md.B as a duplicate of md.A so both hold the boundary
+    if(malloc1D((void*)&md.B, VOLUME_SIZE(md.planes, md.rows, md.cols), "md.B") == ERROR) goto end_a;
+    memcpy(md.B, md.A, VOLUME_SIZE(md.planes, md.rows, md.cols));
+    // size the blocks streamed through the planes to the cache (or the requested shape)
+    if(setBlock3D(block, md.rows, md.cols) == ERROR) goto end_b;
+    printf("Running %d serial 3D stencil iterations with %s kernel...\n", sd.iterations, kernelName3D());
+    // perfrom stencil iterations, the outfile is written by stencilLoop3D() from the latest volume
+    if(stencilLoop3D(md, &sd, outfile) == ERROR) goto end_b;
+    printVolumeFileInfo(outfile, md.planes, md.rows, md.cols);
+    printKernelStats3D(VOLUME_COUNT(md.planes-2, md.rows-2, md.cols-2)*sd.iterations, sd.compute_time);
+    // calculate total time and cpu time, display total times for elapsed, compute, and io
+    GET_TIME(end_time);
+
+    printTimes((end_time-start_time), sd.compute_time);
+    ret = EXIT_SUCCESS;
+
+end_b:
+    free(md.B);
+end_a:
+    free(md.A);
+end_all:
+    exit(ret);
+}
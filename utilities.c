@@ -17,7 +17,7 @@ int malloc1D(void**P, long size, char * p_name){
     return SUCCESS;
 }
 
-void init2D(double *X, int m, int n){
+void init2D(elem_t *X, int m, int n){
     long r = (long)m, c = (long)n; 
     for(long i = 0; i < r; i++){
         for(long j = 1; j < c-1; j++){
@@ -27,7 +27,11 @@ void init2D(double *X, int m, int n){
     }
 }
 
-void print2D(double *X, int m, int n){
+void init3D(elem_t *X, int p, int m, int n){
+    init2D(X, p*m, n);      // every row of every plane is a matrix row
+}
+
+void print2D(elem_t *X, int m, int n){
     long r = (long)m, c = (long)n; 
     printf("\n");
     for(long i = 0; i < r; i ++){
@@ -37,35 +41,141 @@ void print2D(double *X, int m, int n){
     }
 }
 
-void swap2D(double **X, double **Y){
-    double *Z = *Y;        // temp pointer = target matrix
+void swap2D(elem_t **X, elem_t **Y){
+    elem_t *Z = *Y;        // temp pointer = target matrix
     *Y=*X;      // target = source
     *X=Z;       // source = target
 }
 
-int read2D(double **X, int *m, int *n, char * infile){
-    FILE * fp = NULL; 
+int decodeHeader2D(int * meta, int *m, int *n, int *type){
+    // untagged metadata is the {rows, cols} of a double matrix
+    *type = (meta[0] < 0) ? -meta[0] : DOUBLE_ELEM;
+    if(*type != DOUBLE_ELEM && *type != FLOAT_ELEM){
+        printf("Error [utilities:decodeHeader2D()]: unknown element type tag %d\n", meta[0]);
+        return ERROR;
+    }
+    *m = (meta[0] < 0) ? meta[1] : meta[0];
+    *n = (meta[0] < 0) ? meta[2] : meta[1];
+    return SUCCESS;
+}
+
+int encodeHeader2D(int * meta, int m, int n){
+    // double files keep the untagged metadata so older files and tools still work
+    if(ELEM_TYPE == DOUBLE_ELEM){
+        meta[0] = m; meta[1] = n;
+        return 2;
+    }
+    meta[0] = -ELEM_TYPE; meta[1] = m; meta[2] = n;
+    return 3;
+}
+
+// reads the metadata at the start of fp, leaving fp at the first element
+static int readMetadata(FILE * fp, int *m, int *n, int *type, char * location){
+    int meta[3] = {0, 0, 0};
+    size_t read_count = fread(meta, INT_SIZE, 2, fp);
+    if(handleIOError(fp, read_count, (size_t)2, location) == ERROR) return ERROR;
+    // tagged metadata has the type before the matrix order
+    if(meta[0] < 0){
+        read_count = fread(&meta[2], INT_SIZE, 1, fp);
+        if(handleIOError(fp, read_count, (size_t)1, location) == ERROR) return ERROR;
+    }
+    return decodeHeader2D(meta, m, n, type);
+}
+
+// reads m rows of n elements of type into X, elements of another type are converted one row at a time
+static int readElements(FILE * fp, elem_t *X, long m, long n, int type, char * location){
     size_t read_count = 0;
     int ret = ERROR;
+    char * row = NULL;
+
+    if(type == ELEM_TYPE){
+        read_count = fread(X, ELEM_SIZE, MATRIX_COUNT(m,n), fp); 
+        return handleIOError(fp, read_count, (size_t)MATRIX_COUNT(m,n), location);
+    }
+    if(malloc1D((void*)&row, n*type, "row") == ERROR) return ERROR;
+    for(long i = 0; i < m; i++){
+        read_count = fread(row, (size_t)type, (size_t)n, fp);
+        if(handleIOError(fp, read_count, (size_t)n, location) == ERROR) goto end_row;
+        for(long j = 0; j < n; j++){
+            X[IDX(i,j,n)] = (type == DOUBLE_ELEM) ? ((double*)row)[j] : ((float*)row)[j];
+        }
+    }
+    ret = SUCCESS;
+
+end_row:
+    free(row);
+    return ret;
+}
+
+int read2D(elem_t **X, int *m, int *n, char * infile){
+    FILE * fp = NULL; 
+    int ret = ERROR, type = 0;
 
     // check if file is open for reading
     if ((fp = fopen(infile, "rb")) == NULL){
         printf("Error [utilities:read2D:fopen()]: cannot open/read '%s'\n", infile);
         goto end_all;
     }
-    // attempt to read in matrix order metadata
-    read_count = fread(&(*m), INT_SIZE, 1, fp);
-    if(handleIOError(fp, read_count, (size_t)1, "Error [utilities:read2D:fread()]") == ERROR) goto end_read;
-    read_count = fread(&(*n), INT_SIZE, 1, fp);
-    if(handleIOError(fp, read_count, (size_t)1, "Error [utilities:read2D:fread()]") == ERROR) goto end_read;
+    // attempt to read in matrix order and element type metadata
+    if(readMetadata(fp, m, n, &type, "Error [utilities:read2D:fread()]") == ERROR) goto end_read;
 
     // attempt to allocate space for n*n natrix
     if(malloc1D((void*)X, MATRIX_SIZE(*m,*n), "Y") == ERROR) goto end_read;
 
     // attempt to read infile contents into matrix 
-    read_count = fread(X[0], DOUBLE_SIZE, MATRIX_COUNT(*m,*n), fp); 
-    if(handleIOError(fp, read_count, (size_t)MATRIX_COUNT(*m,*n), "Error [utilities:read2D:fread()]") == ERROR){
-        goto end_read; // deallocate and exit
+    if(readElements(fp, *X, *m, *n, type, "Error [utilities:read2D:fread()]") == ERROR) goto end_read;
+
+    ret = SUCCESS;
+
+end_read:
+    fclose(fp); 
+end_all:
+    return ret;
+}
+
+int read3D(elem_t **X, int *p, int *m, int *n, char * infile){
+    FILE * fp = NULL; 
+    size_t read_count = 0;
+    int ret = ERROR, type = 0, meta[4] = {0, 0, 0, 0};
+
+    if ((fp = fopen(infile, "rb")) == NULL){
+        printf("Error [utilities:read3D:fopen()]: cannot open/read '%s'\n", infile);
+        goto end_all;
+    }
+    // volume metadata is always tagged, {-(type+VOLUME_TAG), planes, rows, cols}
+    read_count = fread(meta, INT_SIZE, 4, fp);
+    if(handleIOError(fp, read_count, (size_t)4, "Error [utilities:read3D:fread()]") == ERROR) goto end_read;
+    type = -meta[0]-VOLUME_TAG;
+    if(type != DOUBLE_ELEM && type != FLOAT_ELEM){
+        printf("Error [utilities:read3D()]: '%s' is not a volume data file (type tag %d)\n", infile, meta[0]);
+        goto end_read;
+    }
+    *p = meta[1]; *m = meta[2]; *n = meta[3];
+    // planes are stored one after another, so the volume is read as a matrix of planes*rows rows
+    if(malloc1D((void*)X, VOLUME_SIZE(*p,*m,*n), "X") == ERROR) goto end_read;
+    if(readElements(fp, *X, (long)*p*(*m), *n, type, "Error [utilities:read3D:fread()]") == ERROR) goto end_read;
+
+    ret = SUCCESS;
+
+end_read:
+    fclose(fp); 
+end_all:
+    return ret;
+}
+
+int readHeader2D(int *m, int *n, char * infile){
+    FILE * fp = NULL; 
+    int ret = ERROR, type = 0;
+
+    if ((fp = fopen(infile, "rb")) == NULL){
+        printf("Error [utilities:readHeader2D:fopen()]: cannot open/read '%s'\n", infile);
+        goto end_all;
+    }
+    // attempt to read in matrix order metadata, callers read the rows without converting them
+    if(readMetadata(fp, m, n, &type, "Error [utilities:readHeader2D:fread()]") == ERROR) goto end_read;
+    if(type != ELEM_TYPE){
+        printf("Error [utilities:readHeader2D()]: '%s' holds %s elements, this build uses %s\n", infile, ELEM_NAME(type), ELEM_NAME(ELEM_TYPE));
+        goto end_read;
     }
 
     ret = SUCCESS;
@@ -76,9 +186,35 @@ end_all:
     return ret;
 }
 
-int write2D(double *X, int m, int n, char * outfile){
+int readRows2D(elem_t *X, int n, int first, int count, char * infile){
     FILE * fp = NULL; 
+    size_t read_count = 0;
     int ret = ERROR;
+
+    if(count <= 0) return SUCCESS;   // nothing to read
+    if ((fp = fopen(infile, "rb")) == NULL){
+        printf("Error [utilities:readRows2D:fopen()]: cannot open/read '%s'\n", infile);
+        goto end_all;
+    }
+    // skip metadata and rows before first
+    if(fseek(fp, HEADER_SIZE(ELEM_TYPE) + MATRIX_SIZE(first, n), SEEK_SET) != 0){
+        perror("Error [utilities:readRows2D:fseek()]");
+        goto end_read;
+    }
+    read_count = fread(&X[IDX((long)first,0,(long)n)], ELEM_SIZE, MATRIX_COUNT(count,n), fp); 
+    if(handleIOError(fp, read_count, (size_t)MATRIX_COUNT(count,n), "Error [utilities:readRows2D:fread()]") == ERROR) goto end_read;
+
+    ret = SUCCESS;
+
+end_read:
+    fclose(fp); 
+end_all:
+    return ret;
+}
+
+int write2D(elem_t *X, int m, int n, char * outfile){
+    FILE * fp = NULL; 
+    int ret = ERROR, meta[3], meta_count = encodeHeader2D(meta, m, n);
     size_t write_count = 0;
 
     // check if file is open for writing
@@ -86,14 +222,12 @@ int write2D(double *X, int m, int n, char * outfile){
         printf("Error [utilities:write2D:fopen()]: cannot open/write '%s'\n", outfile);
         goto end_all;
     }
-    // write matrix order metadata
-    write_count = fwrite(&m, INT_SIZE, 1, fp);
-    if(handleIOError(fp, write_count, (size_t)1, "Error [utilities:write2D:fwrite()]") == ERROR) goto end_write;
-    write_count = fwrite(&n, INT_SIZE, 1, fp);
-    if(handleIOError(fp, write_count, (size_t)1, "Error [utilities:write2D:fwrite()]") == ERROR) goto end_write;
+    // write matrix order and element type metadata
+    write_count = fwrite(meta, INT_SIZE, meta_count, fp);
+    if(handleIOError(fp, write_count, (size_t)meta_count, "Error [utilities:write2D:fwrite()]") == ERROR) goto end_write;
 
     // write matrix into outfile
-    write_count = fwrite(X, DOUBLE_SIZE, MATRIX_COUNT(m,n), fp);
+    write_count = fwrite(X, ELEM_SIZE, MATRIX_COUNT(m,n), fp);
     if(handleIOError(fp, write_count, (size_t)MATRIX_COUNT(m,n), "Error [utilities:write2d:fwrite()] ") == ERROR) goto end_write;
 
     ret = SUCCESS;   // here if no error
@@ -104,15 +238,183 @@ end_all:
     return ret;
 }
 
-void stencil2D(double *X, double *Y, int ri, int n){
-    long i = (long)ri, c = (long)n;
-    for(long j = 1; j < c-1; j++){
-        X[IDX(i,j,c)] = (Y[IDX(i-1,j-1,c)] + Y[IDX(i-1,j,c)] + Y[IDX(i-1,j+1,c)] 
-            + Y[IDX(i,j+1,c)] + Y[IDX(i+1,j+1,c)] + Y[IDX(i+1,j,c)] 
-            + Y[IDX(i+1,j-1,c)] + Y[IDX(i,j-1,c)] + Y[IDX(i,j,c)])/9.0;
-        
+int write3D(elem_t *X, int p, int m, int n, char * outfile){
+    FILE * fp = NULL; 
+    int ret = ERROR, meta[4] = {-(ELEM_TYPE+VOLUME_TAG), p, m, n};
+    size_t write_count = 0;
+
+    if ((fp = fopen(outfile, "wb")) == NULL){
+        printf("Error [utilities:write3D:fopen()]: cannot open/write '%s'\n", outfile);
+        goto end_all;
+    }
+    write_count = fwrite(meta, INT_SIZE, 4, fp);
+    if(handleIOError(fp, write_count, (size_t)4, "Error [utilities:write3D:fwrite()]") == ERROR) goto end_write;
+    write_count = fwrite(X, ELEM_SIZE, VOLUME_COUNT(p,m,n), fp);
+    if(handleIOError(fp, write_count, (size_t)VOLUME_COUNT(p,m,n), "Error [utilities:write3D:fwrite()]") == ERROR) goto end_write;
+
+    ret = SUCCESS;
+
+end_write:   
+    fclose(fp);
+end_all:
+    return ret;
+}
+
+int writeAll(int fd, char * buf, size_t size, off_t offset){
+    ssize_t w_count = 0;
+    while(size > 0){
+        if((w_count = pwrite(fd, buf, size, offset)) == -1){
+            if(errno == EINTR) continue;
+            perror("Error [utilities:writeAll:pwrite()]");
+            return ERROR;
+        }
+        buf += w_count;
+        offset += w_count;
+        size -= (size_t)w_count;
+    }
+    return SUCCESS;
+}
+
+int readAll(int fd, char * buf, size_t size, off_t offset){
+    ssize_t r_count = 0;
+    while(size > 0){
+        if((r_count = pread(fd, buf, size, offset)) <= 0){
+            if(r_count == -1 && errno == EINTR) continue;
+            if(r_count == 0) printf("Error [utilities:readAll:pread()]: unexpected end of file\n");
+            else perror("Error [utilities:readAll:pread()]");
+            return ERROR;
+        }
+        buf += r_count;
+        offset += r_count;
+        size -= (size_t)r_count;
+    }
+    return SUCCESS;
+}
+
+int mapRead2D(elem_t **X, int *m, int *n, char * infile){
+    int fd = -1, ret = ERROR, meta[3] = {0, 0, 0}, order[2] = {0, 0}, type = 0;
+    struct stat st;
+    void * base = MAP_FAILED;
+
+    // check if file is open for reading
+    if((fd = open(infile, O_RDONLY)) == -1){
+        printf("Error [utilities:mapRead2D:open()]: cannot open/read '%s'\n", infile);
+        goto end_all;
     }
-    
+    // read matrix order metadata and check the file holds the whole matrix
+    if(pread(fd, meta, 3*INT_SIZE, 0) < (ssize_t)(2*INT_SIZE) || fstat(fd, &st) == -1){
+        printf("Error [utilities:mapRead2D:pread()]: cannot read matrix order from '%s'\n", infile);
+        goto end_open;
+    }
+    if(decodeHeader2D(meta, &order[0], &order[1], &type) == ERROR) goto end_open;
+    // the mapped elements are used as they are, so they must be elem_t
+    if(type != ELEM_TYPE){
+        printf("Error [utilities:mapRead2D()]: '%s' holds %s elements, this build uses %s\n", infile, ELEM_NAME(type), ELEM_NAME(ELEM_TYPE));
+        goto end_open;
+    }
+    if(order[0] < 1 || order[1] < 1 || st.st_size < (off_t)DATAFILE_SIZE(order[0], order[1])){
+        printf("Error [utilities:mapRead2D:fstat()]: '%s' is too small for a %dx%d matrix\n", infile, order[0], order[1]);
+        goto end_open;
+    }
+    // map the file copy-on-write so the matrix can be modified without touching the file
+    base = mmap(NULL, DATAFILE_SIZE(order[0], order[1]), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(base == MAP_FAILED){
+        perror("Error [utilities:mapRead2D:mmap()]");
+        goto end_open;
+    }
+    // the first sweep reads the file front to back, so start read-ahead now
+    madvise(base, DATAFILE_SIZE(order[0], order[1]), MADV_SEQUENTIAL);
+    madvise(base, DATAFILE_SIZE(order[0], order[1]), MADV_WILLNEED);
+
+    *m = order[0];
+    *n = order[1];
+    *X = (elem_t*)((char*)base + HEADER_SIZE(ELEM_TYPE));    // elements start after the metadata (elem_t aligned)
+    ret = SUCCESS;
+
+end_open:
+    close(fd);      // the mapping stays valid after close
+end_all:
+    return ret;
+}
+
+int mapCreate2D(elem_t **X, int m, int n, char * outfile){
+    int fd = -1, ret = ERROR, err = 0;
+    void * base = MAP_FAILED;
+
+    // check if file is open for writing, an existing file is resized instead of truncated since
+    // O_TRUNC waits for writeback of its old pages and every byte is overwritten anyway
+    if((fd = open(outfile, O_RDWR | O_CREAT, 0644)) == -1){
+        printf("Error [utilities:mapCreate2D:open()]: cannot open/write '%s'\n", outfile);
+        goto end_all;
+    }
+    // set the exact size and preallocate blocks so stores into the mapping cannot fail with SIGBUS on a full disk
+    if(ftruncate(fd, DATAFILE_SIZE(m, n)) == -1){
+        perror("Error [utilities:mapCreate2D:ftruncate()]");
+        goto end_open;
+    }
+    if((err = posix_fallocate(fd, 0, DATAFILE_SIZE(m, n))) != 0){
+        errno = err;
+        perror("Error [utilities:mapCreate2D:posix_fallocate()]");
+        goto end_open;
+    }
+    base = mmap(NULL, DATAFILE_SIZE(m, n), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED){
+        perror("Error [utilities:mapCreate2D:mmap()]");
+        goto end_open;
+    }
+    madvise(base, DATAFILE_SIZE(m, n), MADV_SEQUENTIAL);
+
+    // write matrix order and element type metadata
+    encodeHeader2D((int*)base, m, n);
+    *X = (elem_t*)((char*)base + HEADER_SIZE(ELEM_TYPE));
+    ret = SUCCESS;
+
+end_open:
+    close(fd);
+end_all:
+    return ret;
+}
+
+int unmap2D(elem_t *X, int m, int n){
+    if(X == NULL) return SUCCESS;
+    if(munmap((char*)X - HEADER_SIZE(ELEM_TYPE), DATAFILE_SIZE(m, n)) == -1){
+        perror("Error [utilities:unmap2D:munmap()]");
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int mapMatrices2D(MatrixData *md, int iterations, char * infile, char * outfile){
+    if(mapRead2D(&md->map_in, &md->rows, &md->cols, infile) == ERROR) return ERROR;
+    if(mapCreate2D(&md->map_out, md->rows, md->cols, outfile) == ERROR){
+        unmap2D(md->map_in, md->rows, md->cols);
+        md->map_in = NULL;
+        return ERROR;
+    }
+    // odd steps write A and even steps write B, so the mapped output takes the role of the matrix written last
+    if(iterations % 2){
+        memcpy(md->map_out, md->map_in, MATRIX_SIZE(md->rows, md->cols));   // A needs the input boundary rows
+        unmap2D(md->map_in, md->rows, md->cols);
+        md->map_in = NULL;
+        md->A = md->map_out;
+        md->B = NULL;       // caller allocates B
+    }else{
+        md->A = md->map_in;
+        md->B = md->map_out;
+    }
+    return SUCCESS;
+}
+
+int save2D(MatrixData *md, elem_t *X, char * outfile){
+    if(md->map_out == NULL) return write2D(X, md->rows, md->cols, outfile);
+    // final state is normally already in the mapped output
+    if(X != md->map_out) memcpy(md->map_out, X, MATRIX_SIZE(md->rows, md->cols));
+    return SUCCESS;
+}
+
+void free2D(MatrixData *md, elem_t *X){
+    if(X != NULL && (X == md->map_in || X == md->map_out)) unmap2D(X, md->rows, md->cols);
+    else free(X);
 }
 
 int parseInt(char *arg_ptr, int arg_min, int arg_max, char *arg_name){
@@ -133,6 +435,248 @@ int parseInt(char *arg_ptr, int arg_min, int arg_max, char *arg_name){
     return ret;
 }
 
+int popOption(int *argc, char **argv, char *opt_name, char **value){
+    int skip = (value != NULL) ? 2 : 1;     // switches have no value to remove
+    for(int i = 1; i < *argc; i++){
+        if(strcmp(argv[i], opt_name) != 0) continue;
+        // option takes a value, check if one was entered
+        if(value != NULL){
+            if(i+1 >= *argc){
+                printf("Error [utilities:popOption()]: <%s> is missing a value\n", opt_name);
+                return ERROR;
+            }
+            *value = argv[i+1];
+        }
+        // shift remaining args over the option and its value
+        for(int j = i; j+skip < *argc; j++) argv[j] = argv[j+skip];
+        *argc -= skip;
+        return 1;
+    }
+    return 0;
+}
+
+int parseIntOption(int *argc, char **argv, char *opt_name, int arg_min, int arg_max, int default_val){
+    char * value = NULL;
+    int found = popOption(argc, argv, opt_name, &value);
+    if(found == ERROR) return ERROR;
+    if(found == 0) return default_val;
+    return parseInt(value, arg_min, arg_max, opt_name);
+}
+
+int parseCpuList(char * list, int ** cpus){
+    char * tmp_ptr = NULL, * start_ptr = NULL;
+    int count = 0, lo = 0, hi = 0;
+
+    // first pass validates and counts the cpu ids, second pass saves them
+    for(int pass = 0; pass < 2; pass++){
+        tmp_ptr = list; 
+        count = 0;
+        while(*tmp_ptr != '\0'){
+            start_ptr = tmp_ptr;
+            lo = hi = strtol(start_ptr, &tmp_ptr, 10);
+            if(*tmp_ptr == '-' && tmp_ptr != start_ptr) hi = strtol(tmp_ptr+1, &tmp_ptr, 10);
+            if(tmp_ptr == start_ptr || lo < 0 || hi < lo || hi >= CPU_SETSIZE || (*tmp_ptr != ',' && *tmp_ptr != '\0')){
+                printf("Error [utilities:parseCpuList()]: <cpu_list> '%s' is not a valid list, e.g., 0-3,8\n", list);
+                return ERROR;
+            }
+            for(int c = lo; c <= hi; c++){
+                if(pass) (*cpus)[count] = c;
+                count++;
+            }
+            if(*tmp_ptr == ',') tmp_ptr++;
+        }
+        if(count == 0){
+            printf("Error [utilities:parseCpuList()]: <cpu_list> is empty\n");
+            return ERROR;
+        }
+        if(!pass && malloc1D((void*)cpus, count*INT_SIZE, "cpus") == ERROR) return ERROR;
+    }
+    return count;
+}
+
+int parseSampleOptions(int *argc, char **argv, SampleData *sample){
+    char * roi = NULL, extra = 0;
+    int found = 0;
+
+    memset(sample, 0, sizeof(SampleData));
+    if((sample->every = parseIntOption(argc, argv, "--every", 1, SKIP_ARG, 1)) == ERROR) return ERROR;
+    if((sample->pool = parseIntOption(argc, argv, "--pool", 1, SKIP_ARG, 1)) == ERROR) return ERROR;
+    if((found = popOption(argc, argv, "--roi", &roi)) == ERROR) return ERROR;
+    if(found && (sscanf(roi, "%dx%d+%d+%d%c", &sample->roi_rows, &sample->roi_cols, &sample->row0, &sample->col0, &extra) != 4
+        || sample->roi_rows < 1 || sample->roi_cols < 1 || sample->row0 < 0 || sample->col0 < 0)){
+        printf("Error [utilities:parseSampleOptions()]: <--roi> %s must be <rows>x<cols>+<row>+<col>, e.g. 512x512+100+0\n", roi);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int setSampleOrder(SampleData *sample, int rows, int cols){
+    sample->src_rows = rows;
+    sample->src_cols = cols;
+    if(sample->roi_rows == 0){
+        sample->row0 = sample->col0 = 0;
+        sample->roi_rows = rows;
+        sample->roi_cols = cols;
+    }else if(sample->row0 + sample->roi_rows > rows || sample->col0 + sample->roi_cols > cols){
+        printf("Error [utilities:setSampleOrder()]: <--roi> %dx%d+%d+%d is outside the %dx%d matrix\n",
+            sample->roi_rows, sample->roi_cols, sample->row0, sample->col0, rows, cols);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int parseCheckpointOptions(int *argc, char **argv, CheckpointData *cd){
+    memset(cd, 0, sizeof(CheckpointData));
+    if((cd->every = parseIntOption(argc, argv, "--checkpoint-every", 1, SKIP_ARG, 0)) == ERROR) return ERROR;
+    if((cd->secs = parseIntOption(argc, argv, "--checkpoint-secs", 1, SKIP_ARG, 0)) == ERROR) return ERROR;
+    if(popOption(argc, argv, "--checkpoint", &cd->file) == ERROR) return ERROR;
+    cd->restart = popOption(argc, argv, "--restart", NULL);
+    if(cd->file == NULL && (cd->every || cd->secs || cd->restart)){
+        printf("Error [utilities:parseCheckpointOptions()]: --checkpoint-every, --checkpoint-secs, and --restart need --checkpoint <file>\n");
+        return ERROR;
+    }
+    if(cd->file != NULL && cd->every == 0 && cd->secs == 0) cd->secs = CKPT_SECS;
+    return SUCCESS;
+}
+
+int checkpointDue(CheckpointData *cd, int iteration, int last, double last_time){
+    double now = 0.0;
+
+    if(cd->every > 0 && iteration-last >= cd->every) return 1;
+    if(cd->secs == 0) return 0;
+    GET_TIME(now);
+    return (now-last_time >= cd->secs);
+}
+
+int encodeCheckpoint2D(int * meta, CheckpointTrailer * trailer, int m, int n, int iteration){
+    memset(trailer, 0, sizeof(CheckpointTrailer));
+    memcpy(trailer->magic, CKPT_MAGIC, 4);
+    trailer->iteration = iteration;
+    return encodeHeader2D(meta, m, n);
+}
+
+int writeCheckpoint2D(elem_t *X, int m, int n, int iteration, char * file, char * tmpfile){
+    CheckpointTrailer trailer;
+    int fd = -1, ret = ERROR, meta[3], meta_count = encodeCheckpoint2D(meta, &trailer, m, n, iteration);
+
+    if((fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1){
+        printf("Error [utilities:writeCheckpoint2D:open()]: cannot open/write '%s'\n", tmpfile);
+        goto end_all;
+    }
+    if(writeAll(fd, (char*)meta, meta_count*INT_SIZE, 0) == ERROR) goto end_open;
+    if(writeAll(fd, (char*)X, MATRIX_SIZE(m, n), HEADER_SIZE(ELEM_TYPE)) == ERROR) goto end_open;
+    if(writeAll(fd, (char*)&trailer, sizeof(CheckpointTrailer), DATAFILE_SIZE(m, n)) == ERROR) goto end_open;
+    // the old checkpoint is only replaced once the new one is on disk
+    if(fsync(fd) == -1){
+        perror("Error [utilities:writeCheckpoint2D:fsync()]");
+        goto end_open;
+    }
+    ret = SUCCESS;
+
+end_open:
+    if(close(fd) == -1){
+        perror("Error [utilities:writeCheckpoint2D:close()]");
+        ret = ERROR;
+    }
+    if(ret == SUCCESS && rename(tmpfile, file) == -1){
+        printf("Error [utilities:writeCheckpoint2D:rename()]: cannot rename '%s' to '%s'\n", tmpfile, file);
+        ret = ERROR;
+    }
+end_all:
+    return ret;
+}
+
+int readCheckpoint2D(int *iteration, char * file){
+    CheckpointTrailer trailer;
+    struct stat st;
+    int fd = -1, ret = ERROR, m = 0, n = 0;
+
+    // checkpoints are restarted as they are, so the file must hold elem_t
+    if(readHeader2D(&m, &n, file) == ERROR) goto end_all;
+    if((fd = open(file, O_RDONLY)) == -1){
+        printf("Error [utilities:readCheckpoint2D:open()]: cannot open/read '%s'\n", file);
+        goto end_all;
+    }
+    if(fstat(fd, &st) == -1 || st.st_size != (off_t)CKPT_SIZE(m, n) || readAll(fd, (char*)&trailer, sizeof(CheckpointTrailer), DATAFILE_SIZE(m, n)) == ERROR
+        || memcmp(trailer.magic, CKPT_MAGIC, 4) != 0 || trailer.iteration < 0){
+        printf("Error [utilities:readCheckpoint2D()]: '%s' is not a checkpoint of a %dx%d matrix\n", file, m, n);
+        goto end_open;
+    }
+    *iteration = trailer.iteration;
+    ret = SUCCESS;
+
+end_open:
+    close(fd);
+end_all:
+    return ret;
+}
+
+int setRestart(StencilData *sd, FileData *fd){
+    if(readCheckpoint2D(&sd->start, fd->ckpt.file) == ERROR) return ERROR;
+    if(sd->start >= sd->iterations){
+        printf("Error [utilities:setRestart()]: '%s' is at iteration %d, nothing is left of <num_iterations> %d\n", fd->ckpt.file, sd->start, sd->iterations);
+        return ERROR;
+    }
+    sd->iterations -= sd->start;
+    fd->initfile = fd->ckpt.file;
+    // the stacked file would be missing the iterations before the checkpoint
+    if(fd->allfile != NULL){
+        printf("Warning [utilities:setRestart()]: all stacked file '%s' ignored with --restart\n", fd->allfile);
+        fd->allfile = NULL;
+    }
+    return SUCCESS;
+}
+
+int parseResidualOptions(int *argc, char **argv, ResidualData *res){
+    char * tol = NULL, * norm = NULL, * tmp_ptr = NULL;
+    memset(res, 0, sizeof(ResidualData));
+    if((res->every = parseIntOption(argc, argv, "--check-every", 1, SKIP_ARG, 0)) == ERROR) return ERROR;
+    if(popOption(argc, argv, "--residual", &norm) == ERROR) return ERROR;
+    if(popOption(argc, argv, "--tolerance", &tol) == ERROR) return ERROR;
+    if(tol == NULL){
+        if(res->every || norm != NULL){
+            printf("Error [utilities:parseResidualOptions()]: --residual and --check-every need --tolerance <tol>\n");
+            return ERROR;
+        }
+        return SUCCESS;
+    }
+    res->tolerance = strtod(tol, &tmp_ptr);
+    if(*tmp_ptr != '\0' || !(res->tolerance > 0.0)){
+        printf("Error [utilities:parseResidualOptions()]: --tolerance %s must be a number > 0\n", tol);
+        return ERROR;
+    }
+    if(norm == NULL || strcmp(norm, "max") == 0) res->norm = RESIDUAL_MAX;
+    else if(strcmp(norm, "l2") == 0) res->norm = RESIDUAL_L2;
+    else{
+        printf("Error [utilities:parseResidualOptions()]: unknown --residual '%s' [max|l2]\n", norm);
+        return ERROR;
+    }
+    if(res->every == 0) res->every = RESIDUAL_EVERY;
+    return SUCCESS;
+}
+
+int residualSteps(ResidualData *res, int iteration, int steps){
+    if(res->tolerance == 0.0) return steps;
+    int left = res->every - iteration % res->every;     // iterations up to and including the next checked one
+    return (left == 1) ? 1 : MIN(steps, left-1);
+}
+
+int residualDue(ResidualData *res, int iteration){
+    return res->tolerance > 0.0 && iteration % res->every == 0;
+}
+
+double residualNorm(ResidualData *res, acc_t sum){
+    return (res->norm == RESIDUAL_L2) ? sqrt((double)sum) : (double)sum;
+}
+
+int residualConverged(ResidualData *res, double value, int iteration){
+    res->value = value;
+    res->checked = iteration;
+    if(value > res->tolerance) return 0;
+    res->converged = iteration;
+    return 1;
+}
+
 int handleBarrier(int retval, char * location){
     // on success 1 thread returns the below macro and the rest return 0
     if(retval != PTHREAD_BARRIER_SERIAL_THREAD && retval != SUCCESS){
@@ -157,12 +701,32 @@ void printDataFileInfo(char * file_name, int m, int n, int state){
         (state) ? "final" : "initial", m, n, file_name, file_name, DATAFILE_SIZE(m,n), BtoGB(DATAFILE_SIZE(m,n)));
 }
 
+void printVolumeFileInfo(char * file_name, int p, int m, int n){
+    printf("------------------------------------------------------\n");
+    printf("Wrote volume[%dx%dx%d] state to '%s'\n[%s] size = %ld(B) = %.6Lg(GB)\n", 
+        p, m, n, file_name, file_name, VOLUME_FILE_SIZE(p,m,n), BtoGB(VOLUME_FILE_SIZE(p,m,n)));
+}
+
 void printStackedFileInfo(char * file_name, int m, int n, int iter){
     printf("------------------------------------------------------\n");
     printf("Wrote inital matrix state + %d iterations to '%s'\n[%s] size = %ld(B) = %.6Lg(GB)\n", 
         iter, file_name, file_name, RAWFILE_SIZE(m, n, iter), BtoGB(RAWFILE_SIZE(m,n,iter)));
 }
 
+void printCheckpointInfo(char * file_name, int saved, int iteration){
+    printf("------------------------------------------------------\n");
+    if(saved == 0) printf("Wrote no checkpoints to '%s'\n", file_name);
+    else printf("Wrote %d checkpoint%s to '%s' (last at iteration %d)\n", saved, (saved > 1) ? "s" : "", file_name, iteration);
+}
+
+void printResidualInfo(ResidualData *res){
+    char * norm = (res->norm == RESIDUAL_L2) ? "l2" : "max";
+    printf("------------------------------------------------------\n");
+    if(res->converged) printf("Converged at iteration %d (%s residual %g <= tolerance %g)\n", res->converged, norm, res->value, res->tolerance);
+    else if(res->checked) printf("Not converged (%s residual %g > tolerance %g at iteration %d)\n", norm, res->value, res->tolerance, res->checked);
+    else printf("Not converged (no residual checked, every %d iterations)\n", res->every);
+}
+
 void printTimes(double overall_time, double compute_time){
     printf("\n[Overall Time] = %g sec\n[I/O Time] = %g sec\n[Compute Time] = %g sec", 
         overall_time, overall_time-compute_time, compute_time);
@@ -8,8 +8,16 @@
 #define _GNU_SOURCE
 #include <stdlib.h>     
 #include <stdio.h>  
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "timer.h"
 #ifndef UTILITIES_
 #define UTILITIES_
@@ -18,21 +26,59 @@
 #define INT_SIZE sizeof(int)
 #define PTR_SIZE sizeof(void*)
 
+#define DOUBLE_ELEM 8           // data file element types, tagged by their size in bytes
+#define FLOAT_ELEM 4
+
+// matrix element type, set at build time with make PRECISION=double|single|mixed
+#if defined(SINGLE_PRECISION) || defined(MIXED_PRECISION)
+typedef float elem_t;
+#define ELEM_TYPE FLOAT_ELEM
+#else
+typedef double elem_t;
+#define ELEM_TYPE DOUBLE_ELEM
+#endif
+
+// stencil sum type, mixed precision stores floats but sums them in double
+#ifdef MIXED_PRECISION
+typedef double acc_t;
+#define PRECISION_NAME "mixed"
+#elif defined(SINGLE_PRECISION)
+typedef float acc_t;
+#define PRECISION_NAME "single"
+#else
+typedef double acc_t;
+#define PRECISION_NAME "double"
+#endif
+
+#define ELEM_SIZE sizeof(elem_t)
+#define ACC_SIZE sizeof(acc_t)
+#define ELEM_NAME(t) (((t) == DOUBLE_ELEM) ? "double" : "float")
+
 #define MAX(a,b)  ((a)>(b)?(a):(b))                                     // max value between a and b
+#define MIN(a,b)  ((a)<(b)?(a):(b))                                     // min value between a and b
 #define BLOCK_LOW(id,p,m)  ((id)*(m))/(p)                               //  block starting index 
 #define BLOCK_HIGH(id,p,m) (BLOCK_LOW((id)+1,p,m)-1)                    //  block ending index
 #define BLOCK_SIZE(id,p,m) (BLOCK_HIGH(id,p,m)-BLOCK_LOW(id,p,m)+1)     //  block size 
 #define IDX(i,j,n) (i)*(n)+(j)
 
 #define MATRIX_COUNT(m,n) ((long)(m)*(long)(n))                 // matrix element count
-#define MATRIX_SIZE(m,n) (MATRIX_COUNT(m,n)*DOUBLE_SIZE)        // matrix size in bytes
-#define DATAFILE_SIZE(m,n) (MATRIX_SIZE(m,n)+(2*INT_SIZE))      // calculates data file size
+#define MATRIX_SIZE(m,n) (MATRIX_COUNT(m,n)*ELEM_SIZE)          // matrix size in bytes
+#define HEADER_SIZE(t) (((t) == DOUBLE_ELEM) ? 2*INT_SIZE : 3*INT_SIZE)    // {rows, cols} for doubles, else {-type, rows, cols}
+#define DATAFILE_SIZE(m,n) (MATRIX_SIZE(m,n)+HEADER_SIZE(ELEM_TYPE))    // calculates data file size
 #define RAWFILE_SIZE(m,n,i) (MATRIX_SIZE(m,n)*(i+1))            // calculates raw file size
 
+// volumes are stored plane after plane, so a volume is a matrix of planes*rows rows
+#define VOLUME_TAG 16                                           // added to the element type tag of volume data files
+#define VOLUME_COUNT(p,m,n) ((long)(p)*MATRIX_COUNT(m,n))       // volume element count
+#define VOLUME_SIZE(p,m,n) (VOLUME_COUNT(p,m,n)*ELEM_SIZE)      // volume size in bytes
+#define VOLUME_FILE_SIZE(p,m,n) (VOLUME_SIZE(p,m,n)+4*INT_SIZE) // {-(type+VOLUME_TAG), planes, rows, cols} + volume
+
 
 
 #define BtoGB(bytes) (long double)(bytes*(0.1*10e-9))   // converts bytes to GB for debugging
 
+#define CACHE_LINE 64    // bytes per cache line for padding shared counters
+
 #define SUCCESS 0       // universal success code for child functions
 #define ERROR -1        // universal error code for child functions
 #define SKIP_ARG -2     // const to skip args in error handling func
@@ -43,12 +89,68 @@
  *  @brief  struct for all shared variables for matrices
  */
 typedef struct _matrixData{
-    double *A;
-    double *B;
+    elem_t *A;
+    elem_t *B;
     int rows;
     int cols;
+    int planes;         // # planes of a volume (3D only), A and B hold planes*rows rows
+    elem_t *map_in;     // input file mapped copy-on-write (NULL = not mapped)
+    elem_t *map_out;    // output file mapped shared (NULL = not mapped)
 }MatrixData;
 
+/**
+ *  @struct _sampleData
+ *  @typedef SampleData
+ *  @brief  struct for which iterations, and which elements of them, go into the stacked file
+ */
+typedef struct _sampleData{
+    int src_rows;           // order of the computed matrix
+    int src_cols;
+    int every;              // every n-th iteration is recorded (1 = all iterations)
+    int row0;               // first row and column of the region of interest
+    int col0;
+    int roi_rows;           // region of interest order (0 = whole matrix)
+    int roi_cols;
+    int pool;               // each pool x pool block of the region is recorded as its average (1 = every element)
+}SampleData;
+
+// options record less than the whole matrix every iteration, a region is only known to be the whole matrix after setSampleOrder()
+#define IS_SAMPLED(s) ((s).every > 1 || (s).pool > 1 || ((s).roi_rows > 0 && ((s).roi_rows != (s).src_rows || (s).roi_cols != (s).src_cols)))
+#define IS_RECORDED(s, k) ((k) % (s).every == 0)                              // iteration k is recorded (0 = initial matrix)
+#define SAMPLE_ROWS(s) (((s).roi_rows + (s).pool-1)/(s).pool)                 // recorded frame order (after setSampleOrder())
+#define SAMPLE_COLS(s) (((s).roi_cols + (s).pool-1)/(s).pool)
+#define SAMPLE_FRAMES(s, iter) ((iter)/(s).every + 1)                         // # recorded frames of the initial matrix + iter iterations
+
+#define CKPT_MAGIC "CKP1"       // first 4 bytes of the trailer after a checkpoint's matrix
+#define CKPT_SECS 60            // default seconds between checkpoints
+#define CKPT_SIZE(m,n) (DATAFILE_SIZE(m,n)+(long)sizeof(CheckpointTrailer))    // calculates checkpoint file size
+#define RESIDUAL_MAX 0          // residual is the max |A-B| of the interior points
+#define RESIDUAL_L2 1           // residual is the L2 norm of A-B over the interior points
+#define RESIDUAL_EVERY 10       // default iterations between residual checks
+#define RESIDUAL_SUM(a,b,norm) (((norm) == RESIDUAL_MAX) ? MAX(a,b) : (a)+(b))  // combines partial residuals
+
+/**
+ *  @struct _checkpointData
+ *  @typedef CheckpointData
+ *  @brief  struct for how often the latest matrix is saved so a stopped run can be restarted from it
+ */
+typedef struct _checkpointData{
+    char * file;            // checkpoint filename (NULL = no checkpoints)
+    int every;              // iterations between checkpoints (0 = time based only)
+    int secs;               // seconds between checkpoints (0 = iteration based only)
+    int restart;            // 1 = start from the iteration saved in file
+}CheckpointData;
+
+/**
+ *  @struct _checkpointTrailer
+ *  @typedef CheckpointTrailer
+ *  @brief  struct after the matrix of a checkpoint, which is otherwise a data file any reader accepts
+ */
+typedef struct _checkpointTrailer{
+    char magic[4];
+    int iteration;          // # iterations computed from the initial matrix
+}CheckpointTrailer;
+
 /** 
  *  @struct _fileData
  *  @typedef FileData (shared)
@@ -58,19 +160,64 @@ typedef struct _fileData{
     char * initfile;
     char * finalfile;
     char * allfile;
+    int write_buffers;      // # snapshot buffers for the stacked file writer
+    int direct_io;          // 1 = write the stacked file with O_DIRECT
+    int compress_workers;   // # threads compressing the stacked file (0 = raw stacked file)
+    SampleData sample;      // iterations and region recorded in the stacked file
+    CheckpointData ckpt;    // checkpoint file and interval
 }FileData;
 
+/**
+ *  @struct _residualData
+ *  @typedef ResidualData
+ *  @brief  struct for how often the change between iterations is checked and the tolerance that stops the iterations
+ */
+typedef struct _residualData{
+    double tolerance;       // stop once the residual is at most tolerance (0 = never checked)
+    int every;              // iterations between checks
+    int norm;               // RESIDUAL_MAX | RESIDUAL_L2
+    int converged;          // iteration the residual reached tolerance (0 = not converged)
+    int checked;            // iteration of the last check (0 = none)
+    double value;           // residual of the last check
+}ResidualData;
+
 /** 
  *  @struct _stencilData
  *  @typedef StencilData (shared)
  *  @brief  struct for all shared variables needed in stencil interation loop
  */
 typedef struct _stencilData{
-    int iterations;
+    int iterations;         // # iterations to compute (the rest of them after a restart)
+    int start;              // iteration the matrix is at before the first one (> 0 after a restart)
     int debug_level;
+    int time_block;
     double compute_time;
+    double comm_time;       // time in halo exchanges, gathers, and stacked file writes (mpi only)
+    ResidualData res;       // convergence check options and result
+    long active_computed[2];    // # active tiles and points computed, the rest were skipped (--active-tiles only)
 }StencilData;
 
+/** 
+ *  @struct _progress
+ *  @typedef Progress (shared)
+ *  @brief  struct for a thread's completed phase count, padded to its own cache line
+ */
+typedef struct _progress{
+    int count;
+    char pad[CACHE_LINE-sizeof(int)];
+}Progress;
+
+/** 
+ *  @struct _tileQueue
+ *  @typedef TileQueue (shared)
+ *  @brief  struct for a thread's deque of tile indices [head, tail), owner pops head, thieves steal tail
+ */
+typedef struct _tileQueue{
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+}TileQueue;
+
 /** 
  *  @struct _threadShared
  *  @typedef ThreadShared (shared)
@@ -78,7 +225,22 @@ typedef struct _stencilData{
  */
 typedef struct _threadShared{
     int num_threads;
+    int neighbor_sync;
+    int first_touch;
+    int num_cpus;
+    int init_error;
+    int write_error;
+    int tile_rows;
+    int tile_cols;
+    int num_tiles;
+    int * cpus;
+    int ckpt_due[2];        // checkpoint claimed at the end of the last even/odd chunk, copied by every thread in the next one
     pthread_barrier_t barrier;
+    Progress * progress;
+    TileQueue * queues;
+    struct _checkpointer * cp;  // checkpoint writer (NULL = no checkpoints)
+    acc_t * residuals;      // each thread's partial residual of the last even/odd chunk (NULL = no checks)
+    struct _activeTiles * at;   // changed tile maps (NULL = every point is computed)
 }ThreadShared;
 
 /** 
@@ -95,6 +257,9 @@ typedef struct _threadPrivate{
     int block_start;
     int block_size;
     double thread_compute; 
+    int tiles_stolen;
+    long active_computed[2];    // # active tiles and points computed by this thread
+    struct _rowSums * rs;
 }ThreadPrivate;
 
 
@@ -110,57 +275,195 @@ int malloc1D(void**P, long size, char * p_name);
 
 /**
  *  @brief Initilaizes a matrix in memory for 9-pt stencil operations
- *  @param X (double**) Matrix to initalize
+ *  @param X (elem_t**) Matrix to initalize
+ *  @param m (int) # rows
+ *  @param n (int) # columns
+*/
+void init2D(elem_t *X, int r, int n);
+
+/**
+ *  @brief Initilaizes a volume in memory like init2D(), the first and last col of every row of every plane are 1
+ *  @param X (elem_t*) Volume to initalize
+ *  @param p (int) # planes
  *  @param m (int) # rows
  *  @param n (int) # columns
 */
-void init2D(double *X, int r, int n);
+void init3D(elem_t *X, int p, int m, int n);
 
 /**
  *  @brief Prints a matrix to the console
- *  @param X (double*) Matrix to be printed 
+ *  @param X (elem_t*) Matrix to be printed 
  *  @param m (int) # rows
  *  @param n (int) # columns
 */
-void print2D(double *X, int r, int n);
+void print2D(elem_t *X, int r, int n);
 
 /**
  *  @brief Swaps addresses of two matrix pointers
- *  @param X (double**) Source matrix 
- *  @param Y (double**) Target matrix 
+ *  @param X (elem_t**) Source matrix 
+ *  @param Y (elem_t**) Target matrix 
  *  @return [arg] X (addr), Y (addr)
 */
-void swap2D(double **X, double ** Y);
+void swap2D(elem_t **X, elem_t ** Y);
 
 
 /**
- *  @brief Reads matrix from a data file as binary into memory
- *  @param X (double**) Matrix for reading
+ *  @brief Decodes the metadata at the start of a data file, files without a type tag hold doubles
+ *  @param meta (int*) first 3 ints of the data file
+ *  @param m (int*) # rows
+ *  @param n (int*) # columns
+ *  @param type (int*) element type (DOUBLE_ELEM | FLOAT_ELEM)
+ *  @return [arg] m (addr), n (addr), type (addr); [val]: ERROR (-1) if the type tag is unknown | SUCCESS (0)
+ */
+int decodeHeader2D(int * meta, int *m, int *n, int *type);
+
+/**
+ *  @brief Encodes data file metadata for a matrix of elem_t, HEADER_SIZE(ELEM_TYPE) bytes
+ *  @param meta (int*) space for 3 ints
+ *  @param m (int) # rows
+ *  @param n (int) # columns
+ *  @return [arg] meta (addr); [val]: # ints of metadata
+ */
+int encodeHeader2D(int * meta, int m, int n);
+
+/**
+ *  @brief Reads matrix from a data file as binary into memory, elements of another type are converted
+ *  @param X (elem_t**) Matrix for reading
  *  @param m (int*) # rows
  *  @param n (int*) # columns
  *  @param infile (char*) Input filename (.dat)
  *  @return [arg] X (addr), n (addr), m (addr); [val]: ERROR (-1) | SUCCESS (0) 
  */
-int read2D(double **X, int *m, int *n, char * infile);
+int read2D(elem_t **X, int *m, int *n, char * infile);
 
 /**
- *  @brief Writes matrix from memory as binary data into a (.dat) file
- *  @param X (double*) Matrix for writing
+ *  @brief Reads a volume from a volume data file into memory, elements of another type are converted
+ *  @param X (elem_t**) Volume for reading, planes*rows rows of cols elements
+ *  @param p (int*) # planes
+ *  @param m (int*) # rows
+ *  @param n (int*) # columns
+ *  @param infile (char*) Input filename (.dat)
+ *  @return [arg] X (addr), p (addr), m (addr), n (addr); [val]: ERROR (-1) | SUCCESS (0) 
+ */
+int read3D(elem_t **X, int *p, int *m, int *n, char * infile);
+
+/**
+ *  @brief Reads only the matrix order metadata from a data file, the file must hold elem_t elements
+ *  @param m (int*) # rows
+ *  @param n (int*) # columns
+ *  @param infile (char*) Input filename (.dat)
+ *  @return [arg] n (addr), m (addr); [val]: ERROR (-1) | SUCCESS (0) 
+ */
+int readHeader2D(int *m, int *n, char * infile);
+
+/**
+ *  @brief Reads a range of rows from a data file into an allocated matrix
+ *  @param X (elem_t*) Matrix for reading (all rows allocated)
+ *  @param n (int) # columns
+ *  @param first (int) first row to read
+ *  @param count (int) # rows to read
+ *  @param infile (char*) Input filename (.dat)
+ *  @return [arg] X rows first..first+count-1; [val]: ERROR (-1) | SUCCESS (0) 
+ */
+int readRows2D(elem_t *X, int n, int first, int count, char * infile);
+
+/**
+ *  @brief Writes matrix from memory as binary data into a (.dat) file, non-double elements are tagged in the metadata
+ *  @param X (elem_t*) Matrix for writing
  *  @param m (int) # rows
  *  @param n (int) # columns
  *  @param outfile Input filename (.dat)
  *  @return [val]: ERROR (-1) | SUCCESS (0)
  */
-int write2D(double *A, int m, int n, char * outfile);
+int write2D(elem_t *A, int m, int n, char * outfile);
+
+/**
+ *  @brief Writes a volume from memory into a volume data file, the metadata is always tagged
+ *  @param X (elem_t*) Volume for writing
+ *  @param p (int) # planes
+ *  @param m (int) # rows
+ *  @param n (int) # columns
+ *  @param outfile Output filename (.dat)
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int write3D(elem_t *X, int p, int m, int n, char * outfile);
+
+/**
+ *  @brief Writes all bytes of a buffer at a file offset, retrying short writes
+ *  @param fd (int) file descriptor open for writing
+ *  @param buf (char*) bytes to write
+ *  @param size (size_t) # bytes
+ *  @param offset (off_t) file offset
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int writeAll(int fd, char * buf, size_t size, off_t offset);
+
+/**
+ *  @brief Reads all bytes of a buffer from a file offset, retrying short reads
+ *  @param fd (int) file descriptor open for reading
+ *  @param buf (char*) space for size bytes
+ *  @param size (size_t) # bytes
+ *  @param offset (off_t) file offset
+ *  @return [arg] buf; [val]: ERROR (-1) if the file ends first | SUCCESS (0)
+ */
+int readAll(int fd, char * buf, size_t size, off_t offset);
+
+/**
+ *  @brief Maps a data file copy-on-write so its matrix can be used in place without reading it,
+ *         the file must hold elem_t elements
+ *  @param X (elem_t**) Matrix in the mapped file (after the metadata)
+ *  @param m (int*) # rows
+ *  @param n (int*) # columns
+ *  @param infile (char*) Input filename (.dat)
+ *  @return [arg] X (addr), n (addr), m (addr); [val]: ERROR (-1) | SUCCESS (0) 
+ */
+int mapRead2D(elem_t **X, int *m, int *n, char * infile);
+
+/**
+ *  @brief Creates a preallocated data file and maps it shared so a matrix can be written in place
+ *  @param X (elem_t**) Matrix in the mapped file (after the metadata)
+ *  @param m (int) # rows
+ *  @param n (int) # columns
+ *  @param outfile (char*) Output filename (.dat)
+ *  @return [arg] X (addr); [val]: ERROR (-1) | SUCCESS (0) 
+ */
+int mapCreate2D(elem_t **X, int m, int n, char * outfile);
 
 /**
- *  @brief Algorithm to perform a 9-pt stencil operation
- *  @param X (double*) Matrix being modified
- *  @param Y (double*) Matrix for computations
+ *  @brief Unmaps a matrix from mapRead2D() or mapCreate2D(), shared mappings are written back by the kernel
+ *  @param X (elem_t*) Mapped matrix (NULL is ignored)
  *  @param m (int) # rows
  *  @param n (int) # columns
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int unmap2D(elem_t *X, int m, int n);
+
+/**
+ *  @brief Sets up md->A and md->B for mmap I/O, the input file is mapped as A and the output
+ *         file is mapped as whichever matrix holds the last iteration (B is NULL if it must be allocated)
+ *  @param md (MatrixData*) matrices to set up
+ *  @param iterations (int) # stencil iterations
+ *  @param infile (char*) Input filename (.dat)
+ *  @param outfile (char*) Output filename (.dat)
+ *  @return [arg] md (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int mapMatrices2D(MatrixData *md, int iterations, char * infile, char * outfile);
+
+/**
+ *  @brief Writes the final matrix to outfile, or into the mapped output if mapMatrices2D() was used
+ *  @param md (MatrixData*) matrices
+ *  @param X (elem_t*) final matrix
+ *  @param outfile (char*) Output filename (.dat)
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
  */
-void stencil2D(double *X, double *Y, int ri, int n);
+int save2D(MatrixData *md, elem_t *X, char * outfile);
+
+/**
+ *  @brief Deallocates or unmaps a matrix of md
+ *  @param md (MatrixData*) matrices
+ *  @param X (elem_t*) md->A or md->B
+ */
+void free2D(MatrixData *md, elem_t *X);
 
 /**
  *  @brief Validates integer arguments from cmdline
@@ -172,6 +475,165 @@ void stencil2D(double *X, double *Y, int ri, int n);
  */
 int parseInt(char *arg_ptr, int arg_min, int arg_max, char *arg_name);
 
+/**
+ *  @brief Finds and removes an optional "--name <value>" or "--name" switch from the cmdline args
+ *  @param argc (int*) # cmdline args
+ *  @param argv (char**) cmdline args
+ *  @param opt_name (char*) option name including leading "--"
+ *  @param value (char**) option value, pass NULL if option is a switch
+ *  @return [arg] argc (addr), argv (addr), value (addr); [val]: found (1) | not found (0) | ERROR (-1)
+ */
+int popOption(int *argc, char **argv, char *opt_name, char **value);
+
+/**
+ *  @brief Finds, removes and validates an optional "--name <int>" argument from cmdline
+ *  @param argc (int*) # cmdline args
+ *  @param argv (char**) cmdline args
+ *  @param opt_name (char*) option name including leading "--"
+ *  @param arg_min (int) min valid integer (SKIP_ARG = NULL)
+ *  @param arg_max (int) max valid integer (SKIP_ARG = NULL)
+ *  @param default_val (int) value returned if option is missing
+ *  @return [arg] argc (addr), argv (addr); [val]: parsed result (int) | default_val | ERROR (-1)
+ */
+int parseIntOption(int *argc, char **argv, char *opt_name, int arg_min, int arg_max, int default_val);
+
+/**
+ *  @brief Parses a cpu list like "0-3,8,10-11" from cmdline
+ *  @param list (char*) comma separated cpu ids and ranges
+ *  @param cpus (int**) parsed cpu ids in list order
+ *  @return [arg] cpus (addr); [val]: # cpus | ERROR (-1)
+ */
+int parseCpuList(char * list, int ** cpus);
+
+/**
+ *  @brief Finds, removes and validates the stacked file options "--every <n>", "--roi <rows>x<cols>+<row>+<col>", and "--pool <k>"
+ *  @param argc (int*) # cmdline args
+ *  @param argv (char**) cmdline args
+ *  @param sample (SampleData*) recorded iterations and region, the whole matrix every iteration if no option is found
+ *  @return [arg] argc (addr), argv (addr), sample (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int parseSampleOptions(int *argc, char **argv, SampleData *sample);
+
+/**
+ *  @brief Checks that the region of interest fits in the matrix, a missing region becomes the whole matrix
+ *  @param sample (SampleData*) options from parseSampleOptions()
+ *  @param rows (int) # rows of the computed matrix
+ *  @param cols (int) # cols of the computed matrix
+ *  @return [arg] sample (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int setSampleOrder(SampleData *sample, int rows, int cols);
+
+/**
+ *  @brief Finds, removes and validates the checkpoint options "--checkpoint <file>", "--checkpoint-every <n>",
+ *         "--checkpoint-secs <t>", and "--restart", checkpoints are every CKPT_SECS seconds if no interval is found
+ *  @param argc (int*) # cmdline args
+ *  @param argv (char**) cmdline args
+ *  @param cd (CheckpointData*) checkpoint file and interval, cd->file is NULL if no option is found
+ *  @return [arg] argc (addr), argv (addr), cd (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int parseCheckpointOptions(int *argc, char **argv, CheckpointData *cd);
+
+/**
+ *  @brief Checks if a checkpoint is due at an iteration
+ *  @param cd (CheckpointData*) checkpoint interval
+ *  @param iteration (int) current iteration
+ *  @param last (int) iteration of the last checkpoint (or the first iteration)
+ *  @param last_time (double) time of the last checkpoint (or the first iteration) from GET_TIME()
+ *  @return [val]: due (1) | not due (0)
+ */
+int checkpointDue(CheckpointData *cd, int iteration, int last, double last_time);
+
+/**
+ *  @brief Encodes the data file metadata and trailer of a checkpoint, the matrix goes between them
+ *  @param meta (int*) space for 3 ints
+ *  @param trailer (CheckpointTrailer*) trailer to encode
+ *  @param m (int) # rows
+ *  @param n (int) # columns
+ *  @param iteration (int) # iterations computed from the initial matrix
+ *  @return [arg] meta (addr), trailer (addr); [val]: # ints of metadata
+ */
+int encodeCheckpoint2D(int * meta, CheckpointTrailer * trailer, int m, int n, int iteration);
+
+/**
+ *  @brief Writes a checkpoint to tmpfile, flushes it to disk, and renames it over file,
+ *         so file always holds a whole checkpoint
+ *  @param X (elem_t*) Matrix to save
+ *  @param m (int) # rows
+ *  @param n (int) # columns
+ *  @param iteration (int) # iterations computed from the initial matrix
+ *  @param file (char*) checkpoint filename
+ *  @param tmpfile (char*) filename the checkpoint is written to first (same directory as file)
+ *  @return [val]: ERROR (-1) | SUCCESS (0)
+ */
+int writeCheckpoint2D(elem_t *X, int m, int n, int iteration, char * file, char * tmpfile);
+
+/**
+ *  @brief Reads the iteration of a checkpoint, the file must hold elem_t elements
+ *  @param iteration (int*) # iterations computed from the initial matrix
+ *  @param file (char*) checkpoint filename
+ *  @return [arg] iteration (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int readCheckpoint2D(int *iteration, char * file);
+
+/**
+ *  @brief Sets up a restart from fd->ckpt.file, which becomes the input file, only the iterations after
+ *         the checkpoint are computed and the stacked file is dropped
+ *  @param sd (StencilData*) sd->iterations is the total # iterations
+ *  @param fd (FileData*) file names and checkpoint options
+ *  @return [arg] sd->start (addr), sd->iterations (addr), fd->initfile (addr), fd->allfile (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int setRestart(StencilData *sd, FileData *fd);
+
+/**
+ *  @brief Finds, removes and validates the convergence options "--tolerance <tol>", "--residual <max|l2>",
+ *         and "--check-every <k>", the residual is checked every RESIDUAL_EVERY iterations by default
+ *  @param argc (int*) # cmdline args
+ *  @param argv (char**) cmdline args
+ *  @param res (ResidualData*) convergence options, res->tolerance is 0 if no option is found
+ *  @return [arg] argc (addr), argv (addr), res (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int parseResidualOptions(int *argc, char **argv, ResidualData *res);
+
+/**
+ *  @brief Shortens a sweep so a checked iteration is always swept alone, other sweeps stop just before it
+ *  @param res (ResidualData*) convergence options
+ *  @param iteration (int) iteration the matrix is at before the sweep
+ *  @param steps (int) # iterations the sweep would advance
+ *  @return [val]: # iterations to advance (1 if the next iteration is checked)
+ */
+int residualSteps(ResidualData *res, int iteration, int steps);
+
+/**
+ *  @brief Checks if the residual of an iteration is checked
+ *  @param res (ResidualData*) convergence options
+ *  @param iteration (int) iteration to compute
+ *  @return [val]: checked (1) | not checked (0)
+ */
+int residualDue(ResidualData *res, int iteration);
+
+/**
+ *  @brief Gets the residual from the combined partial residuals of every row, square root of the sum for RESIDUAL_L2
+ *  @param res (ResidualData*) convergence options
+ *  @param sum (acc_t) partial residuals combined with RESIDUAL_SUM()
+ *  @return [val]: residual
+ */
+double residualNorm(ResidualData *res, acc_t sum);
+
+/**
+ *  @brief Records the residual of a checked iteration and if it reached the tolerance
+ *  @param res (ResidualData*) convergence options
+ *  @param value (double) residual from residualNorm()
+ *  @param iteration (int) checked iteration
+ *  @return [arg] res (addr); [val]: converged (1) | not converged (0)
+ */
+int residualConverged(ResidualData *res, double value, int iteration);
+
+/**
+ *  @brief Prints the last residual and the iteration the run converged at (if it did)
+ *  @param res (ResidualData*) convergence result
+ */
+void printResidualInfo(ResidualData *res);
+
 /**
  *  @brief Check if valid thread reached the call to pth_barrier func()
  *  @param retval (int) return value from pth_barrier func()
@@ -199,6 +661,15 @@ int handleIOError(FILE * fptr, size_t count, size_t expected, char * location);
 */
 void printDataFileInfo(char * file_name, int m, int n, int state);
 
+/**
+ *  @brief prints file information for a volume
+ *  @param file_name (char*) output data filename
+ *  @param p (int) # planes
+ *  @param m (int) # rows
+ *  @param n (int) # cols
+*/
+void printVolumeFileInfo(char * file_name, int p, int m, int n);
+
 /**
  *  @brief prints file information for raw file with all iterations
  *  @param file_name (char*) output stacked filename
@@ -208,6 +679,14 @@ void printDataFileInfo(char * file_name, int m, int n, int state);
 */
 void printStackedFileInfo(char * file_name, int m, int n, int iter);
 
+/**
+ *  @brief prints checkpoint information
+ *  @param file_name (char*) checkpoint filename
+ *  @param saved (int) # checkpoints written
+ *  @param iteration (int) iteration of the last checkpoint
+*/
+void printCheckpointInfo(char * file_name, int saved, int iteration);
+
 /**
  *  @brief prints timing info ffor Overall, I/O, and Compute
  *  @param overall_time (double) overall time
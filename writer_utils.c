@@ -0,0 +1,383 @@
+/**
+ * @file writer_utils.c
+ * @author Leslie Horace
+ * @brief File storing the asynchronous stacked file and checkpoint writers
+ * @version 1.0
+ *
+ * The compute thread copies each iteration into a free snapshot buffer and
+ * goes on to the next iteration while a writer thread writes the queued
+ * snapshots in order. With O_DIRECT every write must start and end on a
+ * DIRECT_ALIGN boundary, so snapshot k is copied into its buffer at offset
+ * (k*m_bytes) % DIRECT_ALIGN, the unaligned tail of snapshot k-1 is put in
+ * front of it, and the tail of the last snapshot is written without O_DIRECT.
+ *
+ * Only the region of interest of every n-th iteration is copied, pooling the
+ * region into block averages happens on the writer thread while the next
+ * iterations are computed. A sampled raw file starts with a SampleHeader,
+ * with O_DIRECT it is the first tail in front of snapshot 0.
+ *
+ * Checkpoints are copied into a single buffer and written by their own
+ * thread, a checkpoint that comes due while the last one is still being
+ * written is taken at the first iteration after it is done.
+ */
+#include "writer_utils.h"
+
+// bytes in front of snapshot k in its buffer (the tail of snapshot k-1 with O_DIRECT)
+static size_t snapshotLead(StackedWriter *sw, long k){
+    return (sw->direct) ? (size_t)((sw->base + (off_t)k*(off_t)sw->m_bytes) % DIRECT_ALIGN) : 0;
+}
+
+// copies the region of interest of X into a snapshot buffer
+static void copySample(elem_t *out, elem_t *X, SampleData *s){
+    elem_t * in = X + MATRIX_COUNT(s->row0, s->src_cols) + s->col0;
+
+    if(s->roi_cols == s->src_cols){
+        memcpy(out, in, MATRIX_SIZE(s->roi_rows, s->roi_cols));
+        return;
+    }
+    for(int i = 0; i < s->roi_rows; i++) memcpy(out + MATRIX_COUNT(i, s->roi_cols), in + MATRIX_COUNT(i, s->src_cols), MATRIX_SIZE(1, s->roi_cols));
+}
+
+// replaces a copied region with the averages of its pool x pool blocks (smaller edge blocks average fewer elements),
+// block (i,j) is stored before any element of a later block so the region is pooled in place
+static void poolSample(elem_t *X, SampleData *s){
+    int p = s->pool, rows = s->roi_rows, cols = s->roi_cols, out_cols = SAMPLE_COLS(*s), h = 0, w = 0;
+    acc_t sum = 0;
+
+    for(int i = 0; i < rows; i += p){
+        h = MIN(p, rows-i);
+        for(int j = 0; j < cols; j += p){
+            w = MIN(p, cols-j);
+            sum = 0;
+            for(int a = 0; a < h; a++){
+                for(int b = 0; b < w; b++) sum += X[MATRIX_COUNT(i+a, cols)+j+b];
+            }
+            X[MATRIX_COUNT(i/p, out_cols)+j/p] = (elem_t)(sum/(h*w));
+        }
+    }
+}
+
+// writes one snapshot buffer, k is the snapshot index
+static int writeSnapshot(StackedWriter *sw, char * slot, long k){
+    size_t lead = 0, total = 0, aligned = 0;
+    off_t offset = sw->base + (off_t)k*(off_t)sw->m_bytes;
+
+    if(!sw->direct) return writeAll(sw->fd, slot, sw->m_bytes, offset);
+    // prepend the tail left over from the last snapshot, then write the aligned part
+    lead = snapshotLead(sw, k);
+    memcpy(slot, sw->tail, lead);
+    total = lead + sw->m_bytes;
+    aligned = total - total % DIRECT_ALIGN;
+    if(aligned > 0 && writeAll(sw->fd, slot, aligned, offset-(off_t)lead) == ERROR) return ERROR;
+    memcpy(sw->tail, slot+aligned, total-aligned);
+    return SUCCESS;
+}
+
+static void * writerThread(void * sw_ptr){
+    StackedWriter * sw = sw_ptr;
+    int slot = 0;
+
+    pthread_mutex_lock(&sw->lock);
+    for(;;){
+        while(sw->count == 0 && !sw->closing) pthread_cond_wait(&sw->filled, &sw->lock);
+        if(sw->count == 0) break;   // closing and nothing left to write
+        slot = sw->head;
+        pthread_mutex_unlock(&sw->lock);
+
+        if(!sw->error && sw->sample.pool > 1) poolSample((elem_t*)(sw->slots[slot] + snapshotLead(sw, sw->written)), &sw->sample);
+        // after an error snapshots are dropped so pushSnapshot() never waits forever
+        int failed = sw->error || ((sw->enc != NULL) ? encodeFrame(sw->enc, sw->slots[slot])
+                                                     : writeSnapshot(sw, sw->slots[slot], sw->written)) == ERROR;
+
+        pthread_mutex_lock(&sw->lock);
+        if(failed) sw->error = 1;
+        sw->written++;
+        sw->head = (sw->head+1) % sw->num_slots;
+        sw->count--;
+        pthread_cond_signal(&sw->emptied);
+    }
+    pthread_mutex_unlock(&sw->lock);
+    return NULL;
+}
+
+// allocates the snapshot buffers and starts the writer thread once the output is open
+static int startWriter(StackedWriter *sw){
+    int s = 0;
+
+    if(malloc1D((void*)&sw->slots, sw->num_slots*PTR_SIZE, "sw->slots") == ERROR) return ERROR;
+    for(s = 0; s < sw->num_slots; s++){
+        if(posix_memalign((void**)&sw->slots[s], DIRECT_ALIGN, sw->slot_bytes) != 0){
+            printf("Error [writer_utils:startWriter:posix_memalign()]: cannot allocate space for sw->slots[%d]\n", s);
+            goto end_slots;
+        }
+    }
+    pthread_mutex_init(&sw->lock, NULL);
+    pthread_cond_init(&sw->filled, NULL);
+    pthread_cond_init(&sw->emptied, NULL);
+    if((errno = pthread_create(&sw->thread, NULL, writerThread, (void*)sw)) != SUCCESS){
+        perror("Error [writer_utils:startWriter:pthread_create()]");
+        goto end_sync;
+    }
+    return SUCCESS;
+
+end_sync:
+    pthread_cond_destroy(&sw->emptied);
+    pthread_cond_destroy(&sw->filled);
+    pthread_mutex_destroy(&sw->lock);
+end_slots:
+    while(s-- > 0) free(sw->slots[s]);
+    free(sw->slots);
+    return ERROR;
+}
+
+// sets the recorded region and the bytes copied and written per snapshot
+static void setSample(StackedWriter *sw, SampleData *sample){
+    sw->sample = *sample;
+    sw->in_bytes = MATRIX_SIZE(sample->roi_rows, sample->roi_cols);
+    sw->m_bytes = MATRIX_SIZE(SAMPLE_ROWS(*sample), SAMPLE_COLS(*sample));
+}
+
+int openWriter(StackedWriter *sw, char * outfile, SampleData *sample, int num_buffers, int direct){
+    SampleHeader hdr;
+
+    memset(sw, 0, sizeof(StackedWriter));
+    setSample(sw, sample);
+    sw->num_slots = num_buffers;
+    sw->direct = direct;
+    // O_DIRECT buffers need room in front for the last snapshot's tail, and pooling needs the whole region
+    sw->slot_bytes = (direct) ? ((DIRECT_ALIGN + sw->in_bytes + DIRECT_ALIGN-1)/DIRECT_ALIGN)*DIRECT_ALIGN : sw->in_bytes;
+    // a sampled file records what it holds, with O_DIRECT the header is written as the tail before snapshot 0
+    if(IS_SAMPLED(*sample)){
+        memset(&hdr, 0, sizeof(SampleHeader));
+        memcpy(hdr.magic, SAMPLE_MAGIC, 4);
+        hdr.elem_size = ELEM_SIZE;
+        hdr.rows = SAMPLE_ROWS(*sample);
+        hdr.cols = SAMPLE_COLS(*sample);
+        hdr.sample = *sample;
+        memcpy(sw->tail, &hdr, sizeof(SampleHeader));
+        sw->base = sizeof(SampleHeader);
+    }
+
+    // the file is sized in closeWriter(), O_TRUNC would wait for writeback of an old file's pages
+    if((sw->fd = open(outfile, O_WRONLY | O_CREAT | ((direct) ? O_DIRECT : 0), 0644)) == -1){
+        printf("Error [writer_utils:openWriter:open()]: cannot open/write '%s'%s\n", outfile,
+            (direct && errno == EINVAL) ? " with O_DIRECT" : "");
+        return ERROR;
+    }
+    if((!direct && sw->base > 0 && writeAll(sw->fd, sw->tail, sw->base, 0) == ERROR) || startWriter(sw) == ERROR){
+        close(sw->fd);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int openCompressedWriter(StackedWriter *sw, char * outfile, SampleData *sample, int frames, int num_buffers, int num_workers){
+    memset(sw, 0, sizeof(StackedWriter));
+    setSample(sw, sample);
+    sw->slot_bytes = sw->in_bytes;
+    sw->num_slots = num_buffers;
+    sw->fd = -1;
+    if(malloc1D((void*)&sw->enc, sizeof(StackEncoder), "sw->enc") == ERROR) return ERROR;
+    if(openEncoder(sw->enc, outfile, sample, frames, num_workers) == ERROR) goto end_enc;
+    if(startWriter(sw) == ERROR){
+        closeEncoder(sw->enc);
+        goto end_enc;
+    }
+    return SUCCESS;
+
+end_enc:
+    free(sw->enc);
+    return ERROR;
+}
+
+int openStackedWriter(StackedWriter *sw, FileData *fd, int rows, int cols, int iterations){
+    if(setSampleOrder(&fd->sample, rows, cols) == ERROR) return ERROR;
+    if(fd->compress_workers > 0){
+        return openCompressedWriter(sw, fd->allfile, &fd->sample, SAMPLE_FRAMES(fd->sample, iterations), fd->write_buffers, fd->compress_workers);
+    }
+    return openWriter(sw, fd->allfile, &fd->sample, fd->write_buffers, fd->direct_io);
+}
+
+int pushSnapshot(StackedWriter *sw, elem_t *X){
+    int slot = 0;
+
+    // iterations that are not recorded are only counted
+    if(!IS_RECORDED(sw->sample, sw->offered++)) return SUCCESS;
+    // wait for a free buffer
+    pthread_mutex_lock(&sw->lock);
+    while(sw->count == sw->num_slots && !sw->error) pthread_cond_wait(&sw->emptied, &sw->lock);
+    if(sw->error){
+        pthread_mutex_unlock(&sw->lock);
+        return ERROR;
+    }
+    slot = (sw->head + sw->count) % sw->num_slots;
+    pthread_mutex_unlock(&sw->lock);
+
+    // the writer never touches a buffer before it is queued, so the copy needs no lock
+    copySample((elem_t*)(sw->slots[slot] + snapshotLead(sw, sw->pushed)), X, &sw->sample);
+    sw->pushed++;
+
+    pthread_mutex_lock(&sw->lock);
+    sw->count++;
+    pthread_cond_signal(&sw->filled);
+    pthread_mutex_unlock(&sw->lock);
+    return SUCCESS;
+}
+
+int closeWriter(StackedWriter *sw){
+    off_t size = sw->base + (off_t)sw->pushed*(off_t)sw->m_bytes;
+    size_t tail = (size_t)(size % DIRECT_ALIGN);
+
+    // let the writer drain the queue and stop
+    pthread_mutex_lock(&sw->lock);
+    sw->closing = 1;
+    pthread_cond_signal(&sw->filled);
+    pthread_mutex_unlock(&sw->lock);
+    pthread_join(sw->thread, NULL);
+
+    if(sw->enc != NULL){
+        // the encoder writes its frame index and header
+        if(closeEncoder(sw->enc) == ERROR) sw->error = 1;
+        free(sw->enc);
+    }else{
+        // the unaligned tail cannot be written with O_DIRECT
+        if(!sw->error && sw->direct && tail > 0){
+            if(fcntl(sw->fd, F_SETFL, fcntl(sw->fd, F_GETFL) & ~O_DIRECT) == -1){
+                perror("Error [writer_utils:closeWriter:fcntl()]");
+                sw->error = 1;
+            }else if(writeAll(sw->fd, sw->tail, tail, size-(off_t)tail) == ERROR) sw->error = 1;
+        }
+        // drop anything left from an older, larger file
+        if(!sw->error && ftruncate(sw->fd, size) == -1){
+            perror("Error [writer_utils:closeWriter:ftruncate()]");
+            sw->error = 1;
+        }
+        if(close(sw->fd) == -1){
+            perror("Error [writer_utils:closeWriter:close()]");
+            sw->error = 1;
+        }
+    }
+
+    pthread_cond_destroy(&sw->emptied);
+    pthread_cond_destroy(&sw->filled);
+    pthread_mutex_destroy(&sw->lock);
+    for(int s = 0; s < sw->num_slots; s++) free(sw->slots[s]);
+    free(sw->slots);
+    return (sw->error) ? ERROR : SUCCESS;
+}
+
+static void * checkpointThread(void * cp_ptr){
+    Checkpointer * cp = cp_ptr;
+
+    pthread_mutex_lock(&cp->lock);
+    for(;;){
+        while(!cp->queued && !cp->closing) pthread_cond_wait(&cp->queued_cond, &cp->lock);
+        if(!cp->queued) break;      // closing and nothing left to write
+        pthread_mutex_unlock(&cp->lock);
+
+        int failed = writeCheckpoint2D(cp->X, cp->rows, cp->cols, cp->iteration, cp->cd->file, cp->tmpfile) == ERROR;
+
+        pthread_mutex_lock(&cp->lock);
+        if(failed) cp->error = 1;
+        else{
+            cp->saved++;
+            cp->saved_iteration = cp->iteration;
+        }
+        cp->queued = cp->claimed = 0;
+    }
+    pthread_mutex_unlock(&cp->lock);
+    return NULL;
+}
+
+int openCheckpointer(Checkpointer *cp, CheckpointData *cd, int rows, int cols, int start){
+    memset(cp, 0, sizeof(Checkpointer));
+    cp->cd = cd;
+    cp->rows = rows;
+    cp->cols = cols;
+    cp->last = start;
+    GET_TIME(cp->last_time);
+    if(malloc1D((void*)&cp->tmpfile, strlen(cd->file)+5, "cp->tmpfile") == ERROR) return ERROR;
+    sprintf(cp->tmpfile, "%s.tmp", cd->file);
+    if(malloc1D((void*)&cp->X, MATRIX_SIZE(rows, cols), "cp->X") == ERROR) goto end_tmp;
+    pthread_mutex_init(&cp->lock, NULL);
+    pthread_cond_init(&cp->queued_cond, NULL);
+    if((errno = pthread_create(&cp->thread, NULL, checkpointThread, (void*)cp)) != SUCCESS){
+        perror("Error [writer_utils:openCheckpointer:pthread_create()]");
+        goto end_sync;
+    }
+    return SUCCESS;
+
+end_sync:
+    pthread_cond_destroy(&cp->queued_cond);
+    pthread_mutex_destroy(&cp->lock);
+    free(cp->X);
+end_tmp:
+    free(cp->tmpfile);
+    return ERROR;
+}
+
+int claimCheckpoint(Checkpointer *cp, int iteration){
+    int ret = 0;
+
+    if(!checkpointDue(cp->cd, iteration, cp->last, cp->last_time)) return 0;
+    pthread_mutex_lock(&cp->lock);
+    if(cp->error) ret = ERROR;
+    else if(!cp->claimed){
+        cp->claimed = 1;
+        cp->iteration = cp->last = iteration;
+        GET_TIME(cp->last_time);
+        ret = 1;
+    }
+    pthread_mutex_unlock(&cp->lock);
+    return ret;
+}
+
+void queueCheckpoint(Checkpointer *cp){
+    pthread_mutex_lock(&cp->lock);
+    cp->queued = 1;
+    pthread_cond_signal(&cp->queued_cond);
+    pthread_mutex_unlock(&cp->lock);
+}
+
+int saveCheckpoint(Checkpointer *cp, elem_t *X, int iteration){
+    int ret = claimCheckpoint(cp, iteration);
+
+    if(ret != 1) return ret;
+    // the writer never touches X before it is queued, so the copy needs no lock
+    memcpy(cp->X, X, MATRIX_SIZE(cp->rows, cp->cols));
+    queueCheckpoint(cp);
+    return SUCCESS;
+}
+
+int closeCheckpointer(Checkpointer *cp){
+    // let the writer finish a queued checkpoint and stop
+    pthread_mutex_lock(&cp->lock);
+    cp->closing = 1;
+    pthread_cond_signal(&cp->queued_cond);
+    pthread_mutex_unlock(&cp->lock);
+    pthread_join(cp->thread, NULL);
+
+    pthread_cond_destroy(&cp->queued_cond);
+    pthread_mutex_destroy(&cp->lock);
+    free(cp->X);
+    free(cp->tmpfile);
+    return (cp->error) ? ERROR : SUCCESS;
+}
+
+void printStackedOutputInfo(FileData *fd, int m, int n, int iter){
+    SampleData * s = &fd->sample;
+    struct stat st;
+    long size = 0;
+
+    if(!IS_SAMPLED(*s) && fd->compress_workers == 0){
+        printStackedFileInfo(fd->allfile, m, n, iter);
+        return;
+    }
+    size = (stat(fd->allfile, &st) == 0) ? (long)st.st_size : 0;
+    printf("------------------------------------------------------\n");
+    printf("Wrote %d %sframes[%dx%d] to '%s' (inital matrix + every %d of %d iterations, region %dx%d+%d+%d, %dx%d pooling)\n",
+        SAMPLE_FRAMES(*s, iter), (fd->compress_workers > 0) ? "compressed " : "", SAMPLE_ROWS(*s), SAMPLE_COLS(*s), fd->allfile,
+        s->every, iter, s->roi_rows, s->roi_cols, s->row0, s->col0, s->pool, s->pool);
+    printf("[%s] size = %ld(B) = %.6Lg(GB), %.2fx smaller than all iterations raw\n", fd->allfile, size, BtoGB(size),
+        (size > 0) ? (double)RAWFILE_SIZE(m, n, iter)/size : 0.0);
+}
@@ -0,0 +1,185 @@
+/**
+ *  @file writer_utils.h
+ *  @author Leslie Horace
+ *  @brief Header file for the asynchronous stacked file and checkpoint writers in writer_utils.c
+ *  @version 1.0
+ *
+ */
+#include "stack_utils.h"
+
+#ifndef WRITER_UTILS_
+#define WRITER_UTILS_
+
+#define WRITER_BUFFERS 2        // default # snapshot buffers (double buffered)
+#define DIRECT_ALIGN 4096       // buffer, size, and offset alignment for O_DIRECT writes
+#define SAMPLE_MAGIC "SMP1"     // first 4 bytes of a sampled raw stacked file
+
+/**
+ *  @struct _sampleHeader
+ *  @typedef SampleHeader
+ *  @brief struct at the start of a raw stacked file recorded with --every, --roi, or --pool (whole matrix files have no header)
+ */
+typedef struct _sampleHeader{
+    char magic[4];
+    int elem_size;              // bytes per element (DOUBLE_ELEM | FLOAT_ELEM)
+    int rows;                   // order of each frame
+    int cols;
+    SampleData sample;          // recorded iterations and region of the computed matrix
+}SampleHeader;
+
+/**
+ *  @struct _stackedWriter
+ *  @typedef StackedWriter (shared)
+ *  @brief struct for a writer thread and its ring of snapshot buffers, snapshots [head, head+count) are queued
+ */
+typedef struct _stackedWriter{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      // signaled when a snapshot is queued or the writer is closing
+    pthread_cond_t emptied;     // signaled when a snapshot has been written
+    char ** slots;
+    char tail[DIRECT_ALIGN];    // bytes of the last snapshot not yet written with O_DIRECT
+    SampleData sample;          // recorded iterations and region
+    size_t m_bytes;             // bytes written per snapshot
+    size_t in_bytes;            // bytes of the region copied per snapshot
+    size_t slot_bytes;
+    off_t base;                 // file offset of snapshot 0
+    long offered;               // # iterations given to pushSnapshot()
+    long pushed;
+    long written;
+    int num_slots;
+    int head;
+    int count;
+    int closing;
+    int error;
+    int direct;
+    int fd;
+    StackEncoder * enc;         // compressed stacked file encoder (NULL = raw snapshots)
+}StackedWriter;
+
+/**
+ *  @struct _checkpointer
+ *  @typedef Checkpointer (shared)
+ *  @brief struct for a checkpoint writer thread, a due checkpoint is claimed, its matrix copied into X, then queued for writing
+ */
+typedef struct _checkpointer{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued_cond; // signaled when a checkpoint is queued or the writer is closing
+    CheckpointData * cd;
+    char * tmpfile;             // checkpoints are written here and renamed over cd->file
+    elem_t * X;                 // copy of the checkpointed matrix
+    int rows;
+    int cols;
+    int iteration;              // iteration of the claimed checkpoint
+    int last;                   // iteration of the last claimed checkpoint (or the first iteration)
+    double last_time;
+    int claimed;                // 1 = X is being copied, queued, or written
+    int queued;
+    int closing;
+    int saved;                  // # checkpoints written
+    int saved_iteration;        // iteration of the last checkpoint written
+    int error;
+}Checkpointer;
+
+/**
+ *  @brief Opens a stacked file and starts a writer thread that writes queued snapshots in order
+ *  @param sw (StackedWriter*) writer to start
+ *  @param outfile (char*) stacked filename (.raw)
+ *  @param sample (SampleData*) recorded iterations and region (from setSampleOrder()), a sampled file starts with a SampleHeader
+ *  @param num_buffers (int) # snapshot buffers, pushSnapshot() waits when all are queued
+ *  @param direct (int) 1 = write with O_DIRECT (bypasses the page cache), 0 = buffered writes
+ *  @return [arg] sw (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int openWriter(StackedWriter *sw, char * outfile, SampleData *sample, int num_buffers, int direct);
+
+/**
+ *  @brief Opens a compressed stacked file (stack_utils.h) and starts a writer thread that encodes queued snapshots in order
+ *  @param sw (StackedWriter*) writer to start
+ *  @param outfile (char*) compressed stacked filename
+ *  @param sample (SampleData*) recorded iterations and region (from setSampleOrder())
+ *  @param frames (int) max # snapshots
+ *  @param num_buffers (int) # snapshot buffers, pushSnapshot() waits when all are queued
+ *  @param num_workers (int) # threads encoding each snapshot, including the writer thread
+ *  @return [arg] sw (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int openCompressedWriter(StackedWriter *sw, char * outfile, SampleData *sample, int frames, int num_buffers, int num_workers);
+
+/**
+ *  @brief Opens fd->allfile as a compressed stacked file if fd->compress_workers > 0, else as a raw stacked file
+ *  @param sw (StackedWriter*) writer to start
+ *  @param fd (FileData*) stacked filename and writer options, fd->sample is checked against the matrix order
+ *  @param rows (int) # rows
+ *  @param cols (int) # columns
+ *  @param iterations (int) # iterations after the initial matrix
+ *  @return [arg] sw (addr), fd->sample (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int openStackedWriter(StackedWriter *sw, FileData *fd, int rows, int cols, int iterations);
+
+/**
+ *  @brief Copies the region of a matrix into a free snapshot buffer and queues it for writing, only counts iterations that are not recorded
+ *  @param sw (StackedWriter*) writer from openWriter()
+ *  @param X (elem_t*) Matrix to snapshot, can be modified as soon as this returns
+ *  @return [val]: ERROR (-1) if any write failed | SUCCESS (0)
+ */
+int pushSnapshot(StackedWriter *sw, elem_t *X);
+
+/**
+ *  @brief Writes all queued snapshots, stops the writer thread, and closes the stacked file
+ *  @param sw (StackedWriter*) writer from openWriter()
+ *  @return [val]: ERROR (-1) if any write failed | SUCCESS (0)
+ */
+int closeWriter(StackedWriter *sw);
+
+/**
+ *  @brief Allocates the checkpoint copy and starts a thread that writes queued checkpoints with writeCheckpoint2D()
+ *  @param cp (Checkpointer*) checkpoint writer to start
+ *  @param cd (CheckpointData*) checkpoint file and interval
+ *  @param rows (int) # rows
+ *  @param cols (int) # columns
+ *  @param start (int) iteration of the matrix before the first iteration
+ *  @return [arg] cp (addr); [val]: ERROR (-1) | SUCCESS (0)
+ */
+int openCheckpointer(Checkpointer *cp, CheckpointData *cd, int rows, int cols, int start);
+
+/**
+ *  @brief Claims cp->X for a checkpoint if one is due and the last one has been written, the caller
+ *         copies the matrix into cp->X and calls queueCheckpoint()
+ *  @param cp (Checkpointer*) checkpoint writer from openCheckpointer()
+ *  @param iteration (int) iteration of the matrix to save
+ *  @return [val]: claimed (1) | not due or still writing (0) | ERROR (-1) if a checkpoint could not be written
+ */
+int claimCheckpoint(Checkpointer *cp, int iteration);
+
+/**
+ *  @brief Queues a claimed checkpoint for writing once its matrix is in cp->X
+ *  @param cp (Checkpointer*) checkpoint writer from openCheckpointer()
+ */
+void queueCheckpoint(Checkpointer *cp);
+
+/**
+ *  @brief Copies a matrix into cp->X and queues it for writing if a checkpoint is due and the last one has been written
+ *  @param cp (Checkpointer*) checkpoint writer from openCheckpointer()
+ *  @param X (elem_t*) Matrix to save, can be modified as soon as this returns
+ *  @param iteration (int) iteration of X
+ *  @return [val]: ERROR (-1) if a checkpoint could not be written | SUCCESS (0)
+ */
+int saveCheckpoint(Checkpointer *cp, elem_t *X, int iteration);
+
+/**
+ *  @brief Writes a queued checkpoint, stops the checkpoint thread, and deallocates the checkpoint copy
+ *  @param cp (Checkpointer*) checkpoint writer from openCheckpointer()
+ *  @return [val]: ERROR (-1) if a checkpoint could not be written | SUCCESS (0)
+ */
+int closeCheckpointer(Checkpointer *cp);
+
+/**
+ *  @brief prints file information for the stacked file written by openStackedWriter() or by each process
+ *  @param fd (FileData*) stacked filename and writer options
+ *  @param m (int) # rows
+ *  @param n (int) # cols
+ *  @param iter (int) # interations
+ */
+void printStackedOutputInfo(FileData *fd, int m, int n, int iter);
+
+#endif /* WRITER_UTILS_ */